@@ -28,11 +28,23 @@ For more information on the code and information on how to contact me, please se
 * @copyright Copyright &copy; 2016. The Regents of the University of California. Distributed under the Boost Software License, Version 1.0. (See http://www.boost.org/LICENSE_1_0.txt ).
 ***********************************************/
 #include "areacon.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define AREACON_HAVE_MMAP
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace AreaCon {
     // Point Class-------------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
-    double Point::Robustness_Constant;
+    thread_local double Point::Robustness_Constant = 10e-8;
     Point::Point(const double x, const double y):x(x), y(y){}
     double Point::Norm() const {return Norm(*this);}
     Point Point::AddPoint(const Point Test) const {return AddPoints(*this, Test);}
@@ -126,29 +138,168 @@ namespace AreaCon {
         return result;
     }
     
+    // HalfPlane Class--------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    HalfPlane::HalfPlane(const Point Normal, const double Offset):Normal(Normal), Offset(Offset){}
+    Point HalfPlane::FindIntersection(const Point &Test1, const Point &Test2) const{
+        double value1 = Evaluate(Test1), value2 = Evaluate(Test2);
+        if (value1 == value2){
+            return Test1;
+        }
+        return Point::FindPointAlongLine(Test1, Test2, value1/(value1-value2));
+    }
+    std::vector<Point> HalfPlane::ClipBox(const double minx, const double miny, const double maxx, const double maxy) const{
+        Point Corners[4] = {Point(minx,miny), Point(maxx,miny), Point(maxx,maxy), Point(minx,maxy)};
+        std::vector<Point> result;
+        double value1, value2;
+        for (int ii = 0; ii<4; ii++){
+            const Point &p1 = Corners[ii], &p2 = Corners[(ii+1)%4];
+            value1 = Evaluate(p1);
+            value2 = Evaluate(p2);
+            if (value1<=0){
+                result.push_back(p1);
+            }
+            if ((value1<0 && value2>0) || (value1>0 && value2<0)){
+                result.push_back(FindIntersection(p1, p2));
+            }
+        }
+        return result;
+    }
+    HalfPlane HalfPlane::PowerBisector(const Point &Center1, const double Weight1, const Point &Center2, const double Weight2){
+        //|p-c1|^2-w1 <= |p-c2|^2-w2  <=>  2(c2-c1).p <= |c2|^2-|c1|^2-w2+w1
+        Point Normal(Center2.x-Center1.x, Center2.y-Center1.y);
+        double Offset = (Center2.x*Center2.x+Center2.y*Center2.y-Center1.x*Center1.x-Center1.y*Center1.y-Weight2+Weight1)/2;
+        return HalfPlane(Normal, Offset);
+    }
+    
 // Poly Class-------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------------
     
-    Poly::Poly(std::vector<Point> Vertices):Vertices(Vertices), NPoly((int) Vertices.size()){InitializePoly();}
-    std::vector<Point> Poly::GetVertices(void) const{return Vertices;}
+    Poly::Poly(std::vector<Point> Vertices):Vertices(std::move(Vertices)), NPoly((int) this->Vertices.size()), Convex(false){InitializePoly();}
+    const std::vector<Point> &Poly::GetVertices(void) const{return Vertices;}
     int Poly::GetNVertices(void) const{return NPoly;}
+    double Poly::GetArea(void) const{
+        double area = 0;
+        for (int ii = 0; ii<NPoly; ii++){
+            area += Vertices[ii].x*Vertices[(ii+1)%NPoly].y-Vertices[(ii+1)%NPoly].x*Vertices[ii].y;
+        }
+        return std::abs(area)/2;
+    }
     void Poly::GetExtrema(double &minx, double &miny, double &maxx, double &maxy) const{minx = this->minx;maxx = this->maxx;miny = this->miny;maxy = this->maxy;}
-    void Poly::SetVertices(const std::vector<Point> Vertices, const bool GetExtrema){
-        this->Vertices = Vertices;
-        this->NPoly = (int) Vertices.size();
+    void Poly::SetVertices(std::vector<Point> Vertices, const bool GetExtrema){
+        this->Vertices = std::move(Vertices);
+        this->NPoly = (int) this->Vertices.size();
         if (GetExtrema){
             InitializePoly();
         }else{
-            bool flag = Vertices.empty();
+            bool flag = this->Vertices.empty();
             if (!flag && NPoly<3){
                 throw std::runtime_error("List of vertices must contain at least 3 points");
             }
+            CreateEdgePlanes();
+        }
+    }
+    void Poly::CreateEdgePlanes(void){
+        double orientation = 0, cross = 0, length = 0;
+        Point Edge, Next;
+        Edge_Planes.clear();
+        Edge_Lengths.clear();
+        Convex = false;
+        if (NPoly<3){
+            return;
+        }
+        for (int ii = 0; ii<NPoly; ii++){
+            orientation += Vertices[ii].x*Vertices[(ii+1)%NPoly].y-Vertices[(ii+1)%NPoly].x*Vertices[ii].y;
+        }
+        orientation = (orientation>=0) ? 1 : -1;
+        for (int ii = 0; ii<NPoly; ii++){
+            const Point &p1 = Vertices[ii], &p2 = Vertices[(ii+1)%NPoly], &p3 = Vertices[(ii+2)%NPoly];
+            Edge = Point(p2.x-p1.x, p2.y-p1.y);
+            Next = Point(p3.x-p2.x, p3.y-p2.y);
+            length = Point::Norm(Edge);
+            cross = orientation*(Edge.x*Next.y-Edge.y*Next.x);
+            if (length == 0 || cross < -Point::Robustness_Constant*length*Point::Norm(Next)){
+                Edge_Planes.clear();
+                Edge_Lengths.clear();
+                return;
+            }
+            //The outward normal points to the right of a counter-clockwise edge
+            HalfPlane Plane(Point(orientation*Edge.y/length, -orientation*Edge.x/length), 0);
+            Plane.Offset = Plane.Normal.x*p1.x+Plane.Normal.y*p1.y;
+            Edge_Planes.push_back(Plane);
+            Edge_Lengths.push_back(length);
+        }
+        Convex = true;
+    }
+    bool Poly::ContainsConvex(const Point &Test) const{
+        const double tolerance = Point::Robustness_Constant;
+        for (int ii = 0; ii<NPoly; ii++){
+            if (Edge_Planes[ii].Evaluate(Test)>tolerance*Edge_Lengths[ii]){
+                return false;
+            }
+        }
+        return true;
+    }
+    void Poly::Scanline(const Point &Start, const Point &Step, const int NPoints, std::vector<int> &Spans) const{
+        const double tolerance = Point::Robustness_Constant;
+        double tlo = 0, thi = NPoints-1, base = 0, slope = 0;
+        int first = 0, last = 0;
+        bool previous = false, current = false;
+        Spans.clear();
+        if (Vertices.empty()){
+            throw std::runtime_error("Polygon vertices have not been initialized");
+        }else if (NPoints<=0){
+            return;
+        }else if (!Convex){
+            for (int kk = 0; kk<NPoints; kk++){
+                current = pnpoly(Point(Start.x+kk*Step.x, Start.y+kk*Step.y));
+                if (current && !previous){
+                    Spans.push_back(kk);
+                }else if (!current && previous){
+                    Spans.push_back(kk-1);
+                }
+                previous = current;
+            }
+            if (previous){
+                Spans.push_back(NPoints-1);
+            }
+            return;
+        }
+        //Along the line, every edge test is affine in k, so the points inside a convex polygon form the interval [tlo, thi]
+        for (int ii = 0; ii<NPoly && tlo<=thi; ii++){
+            base = Edge_Planes[ii].Evaluate(Start)-tolerance*Edge_Lengths[ii];
+            slope = Edge_Planes[ii].Normal.x*Step.x+Edge_Planes[ii].Normal.y*Step.y;
+            if (slope>0){
+                thi = std::min(thi, -base/slope);
+            }else if (slope<0){
+                tlo = std::max(tlo, -base/slope);
+            }else if (base>0){
+                return;
+            }
+        }
+        if (tlo>thi+2){
+            return;
+        }
+        //Rounding may move the ends of the interval by one point, so the ends are confirmed with the pointwise test
+        first = std::max(0, (int) ceil(std::min(tlo, (double) NPoints))-1);
+        last = std::min(NPoints-1, (int) floor(std::max(thi, -1.0))+1);
+        while (first<=last && !ContainsConvex(Point(Start.x+first*Step.x, Start.y+first*Step.y))){
+            first++;
+        }
+        while (last>=first && !ContainsConvex(Point(Start.x+last*Step.x, Start.y+last*Step.y))){
+            last--;
+        }
+        if (first<=last){
+            Spans.push_back(first);
+            Spans.push_back(last);
         }
     }
     bool Poly::pnpoly(const Point Test) const{
         bool value = false;
         if (Vertices.empty()){
             throw std::runtime_error("Polygon vertices have not been initialized");
+        }else if (Convex){
+            return ContainsConvex(Test);
         }else{
             Point Test_1 = Vertices.back(), Test_2;
             for (int ii = 0; ii<NPoly; ii++){
@@ -169,6 +320,78 @@ namespace AreaCon {
         }
         return value;
     }
+    Poly Poly::ClipToHalfPlane(const HalfPlane &Plane, const double tolerance) const{
+        std::vector<Point> Result = Vertices, Buffer;
+        if (Result.empty()){
+            return Poly();
+        }
+        ClipToHalfPlane(Plane, tolerance, Result, Buffer);
+        if (Result.size()<3){
+            return Poly();
+        }
+        return Poly(Result);
+    }
+    void Poly::ClipToHalfPlane(const HalfPlane &Plane, const double tolerance, std::vector<Point> &Vertices, std::vector<Point> &Buffer, std::vector<int> *Labels, std::vector<int> *LabelBuffer, const int label){
+        int NVert = (int) Vertices.size(), state1 = 0, state2 = 0, state3 = 0;
+        double norm = Plane.Normal.Norm(), value1, value2, value3;
+        bool labelled = (Labels != NULL && LabelBuffer != NULL && Labels->size() == NVert);
+        if (NVert == 0 || norm == 0){
+            return;
+        }
+        Buffer.clear();
+        if (labelled){
+            LabelBuffer->clear();
+        }
+        //Classify vertices as inside (-1), on the boundary (0), or outside (1)
+        value1 = Plane.Evaluate(Vertices.back())/norm;
+        state1 = (value1<-tolerance) ? -1 : ((value1>tolerance) ? 1 : 0);
+        for (int ii = 0; ii<NVert; ii++){
+            const Point &p1 = Vertices[(ii+NVert-1)%NVert], &p2 = Vertices[ii];
+            value2 = Plane.Evaluate(p2)/norm;
+            state2 = (value2<-tolerance) ? -1 : ((value2>tolerance) ? 1 : 0);
+            if (state1*state2<0){
+                Buffer.push_back(Point::FindPointAlongLine(p1, p2, value1/(value1-value2)));
+                //The edge leaving an entry point follows the original edge, the edge leaving an exit point follows the boundary of the half-plane
+                if (labelled){
+                    LabelBuffer->push_back((state2<0) ? (*Labels)[(ii+NVert-1)%NVert] : label);
+                }
+            }
+            if (state2<=0){
+                Buffer.push_back(p2);
+                if (labelled){
+                    state3 = -1;
+                    if (state2 == 0){
+                        value3 = Plane.Evaluate(Vertices[(ii+1)%NVert])/norm;
+                        state3 = (value3<-tolerance) ? -1 : ((value3>tolerance) ? 1 : 0);
+                    }
+                    LabelBuffer->push_back((state3>0) ? label : (*Labels)[ii]);
+                }
+            }
+            value1 = value2;
+            state1 = state2;
+        }
+        //Merge vertices that are numerically identical. The edge leaving a merged vertex is the edge leaving the last of the merged vertices.
+        Vertices.clear();
+        if (labelled){
+            Labels->clear();
+        }
+        for (int ii = 0; ii<Buffer.size(); ii++){
+            if (Vertices.empty() || Point::Distance(Vertices.back(), Buffer[ii])>tolerance){
+                Vertices.push_back(Buffer[ii]);
+                if (labelled){
+                    Labels->push_back((*LabelBuffer)[ii]);
+                }
+            }else if (labelled){
+                Labels->back() = (*LabelBuffer)[ii];
+            }
+        }
+        while (Vertices.size()>1 && Point::Distance(Vertices.back(), Vertices.front())<=tolerance){
+            Vertices.pop_back();
+            if (labelled){
+                Labels->pop_back();
+            }
+        }
+    }
     void Poly::InitializePoly(void){
         minx = INFINITY;
         maxx = -INFINITY;
@@ -179,7 +402,7 @@ namespace AreaCon {
             throw std::runtime_error("List of vertices must contain at least 3 points");
         }else if(!flag){
             for (int ii = 0; ii<NPoly; ii++){
-                if (isinf(Vertices[ii].x) || isinf(Vertices[ii].y)){
+                if (std::isinf(Vertices[ii].x) || std::isinf(Vertices[ii].y)){
                     throw std::runtime_error("Polygon vertices cannot be infinite");
                 }else{
                     if (Vertices[ii].x<minx){
@@ -206,93 +429,254 @@ namespace AreaCon {
                 throw std::runtime_error("Polygon must have non-zero nominal area");
             }
         }
+        CreateEdgePlanes();
     }
     
     // Mult_Array Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
 
-    Mult_Array::Mult_Array(const int N):N(N){
-        Array = new double*[N];
-        for (int ii = 0; ii<N; ii++){
-            Array[ii] = new double[N];
+    Mult_Array::Mult_Array(const int N, const double value):N(0){
+        Assign(N, value);
+    }
+    Mult_Array::Mult_Array(Mult_Array &&obj):N(obj.N), Array(std::move(obj.Array)){
+        obj.N = 0;
+        obj.Array.clear();
+    }
+    Mult_Array& Mult_Array::operator=(Mult_Array &&obj){
+        if (this != &obj){
+            N = obj.N;
+            Array = std::move(obj.Array);
+            obj.N = 0;
+            obj.Array.clear();
         }
+        return *this;
     }
-    Mult_Array::Mult_Array(const Mult_Array &obj):N(obj.N){
-        Array = new double* [N];
-        for (int ii = 0; ii<N; ii++){
-            Array[ii] = new double [N];
-            for (int jj = 0; jj<N; jj++){
-                Array[ii][jj] = obj.Array[ii][jj];
-            }
+    void Mult_Array::Assign(const int N, const double value){
+        if (N<0){
+            throw std::runtime_error("Incompatible sizes");
         }
+        this->N = N;
+        Array.assign((size_t) N*N, value);
+    }
+    // Delaunay Class--------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    DelaunayGraph::DelaunayGraph(const int NRegions):NRegions(0){
+        Clear(NRegions);
+    }
+    DelaunayGraph::DelaunayGraph(DelaunayGraph &&obj):NRegions(obj.NRegions), Graph(std::move(obj.Graph)){
+        obj.NRegions = 0;
+        obj.Graph.clear();
     }
-    Mult_Array& Mult_Array::operator=(const Mult_Array &obj){
+    DelaunayGraph& DelaunayGraph::operator=(DelaunayGraph &&obj){
         if (this != &obj){
-            if (obj.N !=this->N){
-                throw std::runtime_error("Incompatible sizes");
-            }
-            for (int ii = 0; ii<this->N; ii++){
-                for (int jj = 0; jj<this->N;jj++){
-                    this->Array[ii][jj] = obj.Array[ii][jj];
-                }
-            }
+            NRegions = obj.NRegions;
+            Graph = std::move(obj.Graph);
+            obj.NRegions = 0;
+            obj.Graph.clear();
         }
         return *this;
     }
-    Mult_Array::~Mult_Array(){
-        for (int ii = 0; ii < N; ++ii){
-            delete [] Array[ii];
+    void DelaunayGraph::Clear(const int NRegions){
+        if (NRegions<0){
+            throw std::runtime_error("Incompatible Dimensions");
         }
-        delete [] Array;
+        this->NRegions = NRegions;
+        Graph.assign(2*(size_t) NRegions*NRegions, Point());
     }
-    // Delaunay Class--------------------------------------------------------------------------------------------------
+    // SparseAdjacency Class--------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     
-    DelaunayGraph::DelaunayGraph(int NRegions):NRegions(NRegions){
-        Graph = new Point** [NRegions];
-        for (int ii = 0; ii<NRegions; ii++){
-            Graph[ii] = new Point* [NRegions];
-            for (int jj = 0;jj<NRegions;jj++){
-                Graph[ii][jj] = new Point[2];
-            }
+    SparseAdjacency::SparseAdjacency(void):Offsets(1, 0){
+    }
+    void SparseAdjacency::Clear(const int NRows){
+        Offsets.clear();
+        Offsets.reserve(NRows+1);
+        Offsets.push_back(0);
+        Neighbors.clear();
+        Starts.clear();
+        Ends.clear();
+    }
+    void SparseAdjacency::AddEdge(const int Neighbor, const Point &Start, const Point &End){
+        Neighbors.push_back(Neighbor);
+        Starts.push_back(Start);
+        Ends.push_back(End);
+    }
+    void SparseAdjacency::EndRow(void){
+        Offsets.push_back((int) Neighbors.size());
+    }
+    // CenterGrid Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    CenterGrid::CenterGrid(const std::vector<Point> &Points, const double minx, const double miny, const double maxx, const double maxy):minx(minx), miny(miny){
+        int NPoints = (int) Points.size(), bucket, Index_x, Index_y;
+        double width = std::max(maxx-minx, maxy-miny);
+        //Aim for roughly one point per bucket
+        h = width/std::max(1.0, ceil(sqrt((double) NPoints)));
+        if (h<=0){
+            h = 1;
+        }
+        Nx = std::max(1, (int) ceil((maxx-minx)/h));
+        Ny = std::max(1, (int) ceil((maxy-miny)/h));
+        BucketStart = std::vector<int>(Nx*Ny+1, 0);
+        BucketPoints = std::vector<int>(NPoints);
+        PointBucket = std::vector<int>(NPoints);
+        for (int ii = 0; ii<NPoints; ii++){
+            Index_x = std::min(Nx-1, std::max(0, (int) ((Points[ii].x-minx)/h)));
+            Index_y = std::min(Ny-1, std::max(0, (int) ((Points[ii].y-miny)/h)));
+            bucket = Ny*Index_x+Index_y;
+            PointBucket[ii] = bucket;
+            BucketStart[bucket+1]++;
+        }
+        for (int ii = 0; ii<Nx*Ny; ii++){
+            BucketStart[ii+1] += BucketStart[ii];
+        }
+        std::vector<int> position(BucketStart.begin(), BucketStart.end()-1);
+        for (int ii = 0; ii<NPoints; ii++){
+            BucketPoints[position[PointBucket[ii]]++] = ii;
         }
     }
-    DelaunayGraph::~DelaunayGraph(){
-        int N = NRegions;
-        for (int ii = 0; ii < N; ++ii){
-            for (int jj = 0; jj<N;++jj){
-                delete [] Graph[ii][jj];
+    void CenterGrid::GetRing(const int ii, const int ring, std::vector<int> &Indices) const{
+        int Index_x = PointBucket[ii]/Ny, Index_y = PointBucket[ii]%Ny, bucket;
+        for (int kk = Index_x-ring; kk<=Index_x+ring; kk++){
+            if (kk<0 || kk>=Nx){
+                continue;
+            }
+            //Only the boundary of the square of buckets belongs to the ring
+            int step = (kk == Index_x-ring || kk == Index_x+ring) ? 1 : std::max(1, 2*ring);
+            for (int pp = Index_y-ring; pp<=Index_y+ring; pp+=step){
+                if (pp<0 || pp>=Ny){
+                    continue;
+                }
+                bucket = Ny*kk+pp;
+                for (int qq = BucketStart[bucket]; qq<BucketStart[bucket+1]; qq++){
+                    Indices.push_back(BucketPoints[qq]);
+                }
             }
-            delete [] Graph[ii];
         }
-        delete [] Graph;
     }
-    DelaunayGraph::DelaunayGraph(const DelaunayGraph &obj):NRegions(obj.NRegions){
-        Graph = new Point** [NRegions];
-        for (int ii = 0; ii<NRegions; ii++){
-            Graph[ii] = new Point* [NRegions];
-            for (int jj = 0;jj<NRegions;jj++){
-                Graph[ii][jj] = new Point[2];
-                Graph[ii][jj][0] = obj.Graph[ii][jj][0];
-                Graph[ii][jj][1] = obj.Graph[ii][jj][1];
-            }
+    // ThreadPool Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    ThreadPool::ThreadPool(const int NThreads):NThreads(NThreads), Task(NULL), NTasks(0), NextTask(0), NBusy(0), Generation(0), Stop(false){
+        if (this->NThreads <= 0){
+            this->NThreads = std::max(1, (int) std::thread::hardware_concurrency());
+        }
+        for (int ii = 1; ii<this->NThreads; ii++){
+            Workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, ii));
         }
     }
-    DelaunayGraph& DelaunayGraph::operator=(const DelaunayGraph &obj){
-        if (this != &obj) // protect against invalid self-assignment
+    ThreadPool::~ThreadPool(void){
         {
-            if (this->NRegions != obj.NRegions){
-                throw std::runtime_error("Incompatible Dimensions");
+            std::lock_guard<std::mutex> lock(Mutex);
+            Stop = true;
+        }
+        JobStarted.notify_all();
+        for (int ii = 0; ii<Workers.size(); ii++){
+            Workers[ii].join();
+        }
+    }
+    void ThreadPool::RunTasks(const int worker){
+        int index;
+        while ((index = NextTask++)<NTasks){
+            try{
+                (*Task)(index, worker);
+            }catch(...){
+                std::lock_guard<std::mutex> lock(Mutex);
+                if (!Error){
+                    Error = std::current_exception();
+                }
             }
-            for (int ii = 0; ii<NRegions; ii++){
-                for (int jj = 0;jj<NRegions;jj++){
-                    this->Graph[ii][jj][0] = obj.Graph[ii][jj][0];
-                    this->Graph[ii][jj][1] = obj.Graph[ii][jj][1];
+        }
+    }
+    void ThreadPool::WorkerLoop(const int worker){
+        long seen = 0;
+        while (true){
+            {
+                std::unique_lock<std::mutex> lock(Mutex);
+                JobStarted.wait(lock, [&]{return Stop || Generation != seen;});
+                if (Stop){
+                    return;
                 }
+                seen = Generation;
             }
+            RunTasks(worker);
+            {
+                std::lock_guard<std::mutex> lock(Mutex);
+                NBusy--;
+            }
+            JobFinished.notify_one();
         }
-        
-        return *this;
+    }
+    void ThreadPool::ParallelFor(const int N, const std::function<void(const int index, const int worker)> &Task){
+        if (N<=0){
+            return;
+        }else if (Workers.empty() || N == 1){
+            for (int ii = 0; ii<N; ii++){
+                Task(ii, 0);
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> call_lock(CallMutex);
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            this->Task = &Task;
+            NTasks = N;
+            NextTask = 0;
+            NBusy = (int) Workers.size();
+            Error = std::exception_ptr();
+            Generation++;
+        }
+        JobStarted.notify_all();
+        RunTasks(0);
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            JobFinished.wait(lock, [&]{return NBusy == 0;});
+            this->Task = NULL;
+            error = Error;
+        }
+        if (error){
+            std::rethrow_exception(error);
+        }
+    }
+    // MappedFile Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    MappedFile::MappedFile(const std::string filename):Data(NULL), Size(0), Mapped(false){
+#ifdef AREACON_HAVE_MMAP
+        int descriptor = open(filename.c_str(), O_RDONLY);
+        if (descriptor<0){
+            throw std::runtime_error("Input file could not be opened");
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) == 0 && info.st_size>0){
+            void *address = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (address != MAP_FAILED){
+                Data = static_cast<const char*>(address);
+                Size = (size_t) info.st_size;
+                Mapped = true;
+            }
+        }
+        close(descriptor);
+        if (Mapped){
+            return;
+        }
+#endif
+        std::ifstream File(filename, std::ios::in | std::ios::binary);
+        if (!File.is_open()){
+            throw std::runtime_error("Input file could not be opened");
+        }
+        Buffer.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+        Data = Buffer.data();
+        Size = Buffer.size();
+    }
+    MappedFile::~MappedFile(void){
+#ifdef AREACON_HAVE_MMAP
+        if (Mapped){
+            munmap(const_cast<char*>(Data), Size);
+        }
+#endif
     }
     // Int_Params Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
@@ -320,7 +704,7 @@ namespace AreaCon {
     }
     // Parameters Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
-    Parameters::Parameters(const double line_int_step,const double weights_step, const double centers_step,const double volume_tolerance, const double convergence_criterion, const int max_iterations_volume, const int max_iterations_centers, const double Volume_Lower_Bound, const double Robustness_Constant):line_int_step(line_int_step), weights_step(weights_step), centers_step(centers_step), volume_tolerance(volume_tolerance), convergence_criterion(convergence_criterion), max_iterations_volume(max_iterations_volume), max_iterations_centers(max_iterations_centers), Volume_Lower_Bound(Volume_Lower_Bound), Robustness_Constant(Robustness_Constant){CheckParameters();};
+    Parameters::Parameters(const double line_int_step,const double weights_step, const double centers_step,const double volume_tolerance, const double convergence_criterion, const int max_iterations_volume, const int max_iterations_centers, const double Volume_Lower_Bound, const double Robustness_Constant, const PowerDiagramMethod diagram_method, const int num_threads, const IntegrationMethod integration_method, const bool exact_integration, const bool incremental_diagram, const bool exact_line_integral, const int verbosity, const WeightUpdateMethod weights_method, const int pyramid_levels):line_int_step(line_int_step), weights_step(weights_step), centers_step(centers_step), volume_tolerance(volume_tolerance), convergence_criterion(convergence_criterion), max_iterations_volume(max_iterations_volume), max_iterations_centers(max_iterations_centers), Volume_Lower_Bound(Volume_Lower_Bound), Robustness_Constant(Robustness_Constant), diagram_method(diagram_method), num_threads(num_threads), integration_method(integration_method), exact_integration(exact_integration), incremental_diagram(incremental_diagram), exact_line_integral(exact_line_integral), verbosity(verbosity), weights_method(weights_method), pyramid_levels(pyramid_levels){CheckParameters();};
     void Parameters::CheckParameters(void){
         if (line_int_step<=0){
             throw std::runtime_error("line_int_step must be greater than 0");
@@ -340,14 +724,75 @@ namespace AreaCon {
             throw std::runtime_error("Volume_Lower_Bound must be between 0 and 1");
         }else if (Robustness_Constant<=0){
             throw std::runtime_error("Robustness_Constant must be greater than 0");
+        }else if (diagram_method != All_Pairs && diagram_method != Nearest_Neighbors){
+            throw std::runtime_error("diagram_method is not a valid PowerDiagramMethod");
+        }else if (num_threads<0){
+            throw std::runtime_error("num_threads must be greater than or equal to 0");
+        }else if (integration_method != Per_Region && integration_method != Ownership_Map && integration_method != Column_Spans && integration_method != Device_Spans){
+            throw std::runtime_error("integration_method is not a valid IntegrationMethod");
+        }else if (verbosity<0){
+            throw std::runtime_error("verbosity must be greater than or equal to 0");
+        }else if (weights_method != Gradient_Descent && weights_method != Newton){
+            throw std::runtime_error("weights_method is not a valid WeightUpdateMethod");
+        }else if (pyramid_levels<1){
+            throw std::runtime_error("pyramid_levels must be greater than 0");
+        }
+    }
+    // DeviceTables Class-----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    DeviceTables::DeviceTables(const Int_Params &Integral):Int_Prefix(Integral.Int_Prefix.data()), Intx_Prefix(Integral.Intx_Prefix.data()), Inty_Prefix(Integral.Inty_Prefix.data()), Size(Integral.Int_Prefix.size()){
+#ifdef AREACON_OFFLOAD
+        const size_t n = Size;
+#pragma omp target enter data map(to: Int_Prefix[0:n], Intx_Prefix[0:n], Inty_Prefix[0:n])
+#endif
+    }
+    DeviceTables::~DeviceTables(void){
+#ifdef AREACON_OFFLOAD
+        const size_t n = Size;
+#pragma omp target exit data map(delete: Int_Prefix[0:n], Intx_Prefix[0:n], Inty_Prefix[0:n])
+#endif
+    }
+    // DeviceCache Class------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    std::shared_ptr<const DeviceTables> DeviceCache::Get(const Int_Params &Integral){
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (!Tables || !Tables->IsCurrent(Integral)){
+            Tables = std::make_shared<const DeviceTables>(Integral);
         }
+        return Tables;
+    }
+    void DeviceCache::Reset(void){
+        std::lock_guard<std::mutex> lock(Mutex);
+        Tables.reset();
     }
     // Density Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
-    Density::Density():Volume_Lower_Bound(0){SetNewRegion(Region);}
-    Density::Density(const Poly Region, const int Nx, const int Ny, const std::vector<double> Values):Volume_Lower_Bound(0){SetNewRegion(Region,Nx,Ny,Values);}
+    Density::Density():Volume_Lower_Bound(0), Exact_Integration(false), Compact_Storage(false), Normalization(1), Region_Volume(1), Bit_Stride(0){SetNewRegion(Region);}
+    Density::Density(Poly Region, const int Nx, const int Ny, std::vector<double> Values, const int num_threads, const bool compact_storage):Volume_Lower_Bound(0), Exact_Integration(false), Compact_Storage(compact_storage), Normalization(1), Region_Volume(1), Bit_Stride(0){SetNumThreads(num_threads); SetNewRegion(std::move(Region),Nx,Ny,std::move(Values));}
+    void Density::SetNumThreads(const int num_threads){
+        if (num_threads<0){
+            throw std::runtime_error("num_threads must be greater than or equal to 0");
+        }else if (num_threads == 1){
+            Pool.reset();
+        }else{
+            Pool = std::make_shared<ThreadPool>(num_threads);
+        }
+    }
+    void Density::ParallelFor(const int N, const std::function<void(const int index, const int worker)> &Task) const{
+        if (Pool){
+            //The workers use the robustness constant of the calling thread
+            const double tolerance = Point::Robustness_Constant;
+            Pool->ParallelFor(N, [&](const int index, const int worker){RobustnessScope Scope(tolerance); Task(index, worker);});
+        }else{
+            for (int ii = 0; ii<N; ii++){
+                Task(ii, 0);
+            }
+        }
+    }
     void Density::SetExtrema(){Region.GetExtrema(minx, miny, maxx, maxy);}
-    void Density::SetNewRegion(const Poly Region, const int Nx,const int Ny, const std::vector<double> Values){this->Region = Region;SetExtrema();SetParameters(Nx,Ny,Values);}
+    void Density::SetNewRegion(Poly Region, const int Nx,const int Ny, std::vector<double> Values){this->Region = std::move(Region);SetExtrema();SetParameters(Nx,Ny,std::move(Values));}
     Point Density::ConvertIndextoWorld(const int ii) const{int Index_x = ii/Ny, Index_y=ii%Ny;return Point(minx+Index_x*dx, miny+Index_y*dy);}
     void Density::CheckParameterSizes(void){
         int npoly = Region.GetNVertices();
@@ -370,6 +815,18 @@ namespace AreaCon {
     double Density::GetVolumeLowerBound(void){
         return Volume_Lower_Bound;
     }
+    void Density::SetExactIntegration(const bool Exact){
+        this->Exact_Integration = Exact;
+    }
+    void Density::SetCompactStorage(const bool Compact){
+        if (Compact == Compact_Storage){
+            return;
+        }
+        Compact_Storage = Compact;
+        if (!Values.empty()){
+            PreprocessIntegral();
+        }
+    }
     
     
     void Density::Setdxy(void){
@@ -378,131 +835,259 @@ namespace AreaCon {
         if (Nx!=0 && Ny!=0){
             dx = (maxx-minx)/(Nx-1);
             dy = (maxy-miny)/(Ny-1);
+            Inv_dx = 1/dx;
+            Inv_dy = 1/dy;
         }else{
             dx = 0;
             dy = 0;
+            Inv_dx = 0;
+            Inv_dy = 0;
         }
     }
-    void Density::SetParameters(const int Nx, const int Ny, const std::vector<double> Values){
+    void Density::SetParameters(const int Nx, const int Ny, std::vector<double> Values){
+        Device.Reset();
         this -> Nx = Nx;
         this -> Ny = Ny;
-        this -> Values = Values;
+        this -> Values = std::move(Values);
         CheckParameterSizes();
         Setdxy();
-        if (!Values.empty()){
+        if (!this->Values.empty()){
             PreprocessIntegral();
         }
     }
     double Density::InterpolateValue(const Point &Test) const{
-        int i = (int) ((Test.x-minx)/dx), j = (int) ((Test.y-miny)/dy);
-        int i1,j1;
-        Point p = ConvertIndextoWorld(i*Ny+j);
-        double val00, val01, val10, val11;
-        double val0s,valr0,valr1,val1s;
-        double ys,xr;
-        
-        if (i == Nx-1){
-            xr = 0;
-            i1 = i;
-        }else{
-            xr = (Test.x-p.x)/dx;
-            i1 = i+1;
+        double result = 0;
+        InterpolateValues(1, &Test.x, &Test.y, &result);
+        return result;
+    }
+    void Density::InterpolateValues(const int NPoints, const double *x, const double *y, double *Result) const{
+        const double *V = Values.data();
+        const int imax = Nx-2, jmax = Ny-2, ny = Ny;
+        int kk = 0;
+        //The vector paths evaluate the same expression in the same order as the scalar loop below, which handles the remaining points
+#if defined(__AVX2__)
+        const __m256d Min_x = _mm256_set1_pd(minx), Min_y = _mm256_set1_pd(miny), Scale_x = _mm256_set1_pd(Inv_dx), Scale_y = _mm256_set1_pd(Inv_dy);
+        const __m128i Zero = _mm_setzero_si128(), Max_i = _mm_set1_epi32(imax), Max_j = _mm_set1_epi32(jmax), Stride = _mm_set1_epi32(ny);
+        for (; kk+4<=NPoints; kk+=4){
+            __m256d u = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(x+kk), Min_x), Scale_x), v = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(y+kk), Min_y), Scale_y);
+            __m128i i = _mm_min_epi32(_mm_max_epi32(_mm256_cvttpd_epi32(u), Zero), Max_i), j = _mm_min_epi32(_mm_max_epi32(_mm256_cvttpd_epi32(v), Zero), Max_j);
+            __m256d xr = _mm256_sub_pd(u, _mm256_cvtepi32_pd(i)), ys = _mm256_sub_pd(v, _mm256_cvtepi32_pd(j));
+            __m128i corner = _mm_add_epi32(_mm_mullo_epi32(Stride, i), j);
+            __m256d val00 = _mm256_i32gather_pd(V, corner, 8), val01 = _mm256_i32gather_pd(V+1, corner, 8), val10 = _mm256_i32gather_pd(V+ny, corner, 8), val11 = _mm256_i32gather_pd(V+ny+1, corner, 8);
+            __m256d cross = _mm256_sub_pd(_mm256_sub_pd(_mm256_add_pd(val00, val11), val01), val10);
+            __m256d result = _mm256_add_pd(val00, _mm256_mul_pd(_mm256_sub_pd(val10, val00), xr));
+            result = _mm256_add_pd(result, _mm256_mul_pd(_mm256_sub_pd(val01, val00), ys));
+            result = _mm256_add_pd(result, _mm256_mul_pd(_mm256_mul_pd(cross, xr), ys));
+            _mm256_storeu_pd(Result+kk, result);
         }
-        if (j == Ny-1){
-            ys = 0;
-            j1 = j;
-        }else{
-            ys = (Test.y-p.y)/dy;
-            j1 = j+1;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float64x2_t Min_x = vdupq_n_f64(minx), Min_y = vdupq_n_f64(miny), Scale_x = vdupq_n_f64(Inv_dx), Scale_y = vdupq_n_f64(Inv_dy);
+        const float64x2_t Zero = vdupq_n_f64(0), Max_i = vdupq_n_f64(imax), Max_j = vdupq_n_f64(jmax);
+        for (; kk+2<=NPoints; kk+=2){
+            float64x2_t u = vmulq_f64(vsubq_f64(vld1q_f64(x+kk), Min_x), Scale_x), v = vmulq_f64(vsubq_f64(vld1q_f64(y+kk), Min_y), Scale_y);
+            //The bounds are integers, so clamping before the truncation gives the same indices as clamping after it
+            int64x2_t i = vcvtq_s64_f64(vminq_f64(vmaxq_f64(u, Zero), Max_i)), j = vcvtq_s64_f64(vminq_f64(vmaxq_f64(v, Zero), Max_j));
+            float64x2_t xr = vsubq_f64(u, vcvtq_f64_s64(i)), ys = vsubq_f64(v, vcvtq_f64_s64(j));
+            const double *corner0 = V+ny*(int) vgetq_lane_s64(i, 0)+(int) vgetq_lane_s64(j, 0), *corner1 = V+ny*(int) vgetq_lane_s64(i, 1)+(int) vgetq_lane_s64(j, 1);
+            float64x2_t val00 = vcombine_f64(vld1_f64(corner0), vld1_f64(corner1)), val01 = vcombine_f64(vld1_f64(corner0+1), vld1_f64(corner1+1));
+            float64x2_t val10 = vcombine_f64(vld1_f64(corner0+ny), vld1_f64(corner1+ny)), val11 = vcombine_f64(vld1_f64(corner0+ny+1), vld1_f64(corner1+ny+1));
+            float64x2_t cross = vsubq_f64(vsubq_f64(vaddq_f64(val00, val11), val01), val10);
+            float64x2_t result = vaddq_f64(val00, vmulq_f64(vsubq_f64(val10, val00), xr));
+            result = vaddq_f64(result, vmulq_f64(vsubq_f64(val01, val00), ys));
+            result = vaddq_f64(result, vmulq_f64(vmulq_f64(cross, xr), ys));
+            vst1q_f64(Result+kk, result);
+        }
+#endif
+        for (; kk<NPoints; kk++){
+            double u = (x[kk]-minx)*Inv_dx, v = (y[kk]-miny)*Inv_dy;
+            int i = std::min(std::max((int) u, 0), imax), j = std::min(std::max((int) v, 0), jmax);
+            double xr = u-i, ys = v-j;
+            const double *corner = V+ny*i+j;
+            double val00 = corner[0], val01 = corner[1], val10 = corner[ny], val11 = corner[ny+1];
+            Result[kk] = val00+(val10-val00)*xr+(val01-val00)*ys+(val00+val11-val01-val10)*xr*ys;
+        }
+    }
+    void Density::CreateRegionBits(void){
+        Bit_Stride = (Ny+63)/64;
+        Region_Bits.assign((size_t) Nx*Bit_Stride, 0);
+        //Every column owns whole words of Region_Bits, so that columns can be processed in parallel
+        ParallelFor(Nx, [&](const int ii, const int worker){
+            std::vector<int> Spans;
+            std::uint64_t *Column = &Region_Bits[(size_t) ii*Bit_Stride];
+            Region.Scanline(ConvertIndextoWorld(ii*Ny), Point(0, dy), Ny, Spans);
+            for (int kk = 0; kk+1<Spans.size(); kk+=2){
+                for (int jj = Spans[kk]; jj<=Spans[kk+1]; jj++){
+                    Column[jj/64] |= ((std::uint64_t) 1) << (jj%64);
+                }
+            }
+        });
+    }
+    std::vector<bool> Density::GetGridInRegion(void) const{
+        std::vector<bool> GridInRegion(Nx*Ny, false);
+        for (int ii = 0; ii<Nx; ii++){
+            for (int jj = 0; jj<Ny; jj++){
+                GridInRegion[ii*Ny+jj] = IsGridPointInRegion(ii, jj);
+            }
+        }
+        return GridInRegion;
+    }
+    void Density::CreateGridCoordinates(std::vector<double> &X, std::vector<double> &Y) const{
+        //The coordinates are accumulated as in a sequential sweep, so that the results do not depend on the number of threads
+        X.assign(std::max(Nx, 1), minx);
+        Y.assign(std::max(Ny, 1), miny);
+        for (int ii = 1; ii<Nx; ii++){
+            X[ii] = X[ii-1]+dx;
+        }
+        for (int jj = 1; jj<Ny; jj++){
+            Y[jj] = Y[jj-1]+dy;
         }
-        
-        val00 = Values[Ny*i+j];
-        val10 = Values[Ny*i1+j];
-        val01 = Values[Ny*i+j1];
-        val11 = Values[Ny*i1+j1];
-        
-        val0s = val00+(val01-val00)*ys;
-        valr1 = val01+(val11-val01)*xr;
-        val1s = val10+(val11-val10)*ys;
-        valr0 = val00+(val10-val00)*xr;
-        
-        return (val0s+valr0-val00)+xr*(val00+val1s-val0s-val10)+ys*(val00+valr0-val01-valr1)+xr*ys*(val01+val10-val00-val11);
     }
     void Density::CreateIntegralCoefficients(void){
         Int_Params New;
         Integral = New;
-        GridInRegion.clear();
+        CreateRegionBits();
+        if (Compact_Storage){
+            //The coefficients are re-computed from Values whenever they are needed (see GetSquareCoefficients)
+            return;
+        }
         
-        double a = 0, b = 0, c = 0, d = 0, gamma = 0, eta = 0, xi = 0,yval = miny, xval = minx;
-        for (int ii = 0; ii< Nx-1; ii++){
-            yval = miny;
-            for (int jj = 0; jj<Ny-1;jj++){
-                GridInRegion.push_back(Region.pnpoly(ConvertIndextoWorld(ii*Ny+jj)));
-                gamma = -(1/(dx*dy))*(Values[ii*Ny+jj]+Values[(ii+1)*Ny+jj]-Values[ii*Ny+jj]-Values[(ii+1)*Ny+jj+1]);
-                eta = (Values[(ii+1)*Ny+jj]-Values[ii*Ny+jj])/dx;
-                xi = -(Values[ii*Ny+jj]-Values[ii*Ny+jj+1])/dy;
-                a = -gamma*yval+eta;
-                b = -gamma*xval+xi;
-                c = gamma;
-                d = xval*yval*gamma-yval*xi-xval*eta+Values[ii*Ny+jj];
-                Integral.Coefficient_a.push_back(a);
-                Integral.Coefficient_b.push_back(b);
-                Integral.Coefficient_c.push_back(c);
-                Integral.Coefficient_d.push_back(d);
-                
-                if (jj == Ny-2){
-                    GridInRegion.push_back(Region.pnpoly(ConvertIndextoWorld(ii*Ny+jj+1)));
-                }else{
-                    yval += dy;
-                }
-            }
-            if (ii == Nx-2){
-                yval = miny;
-                for (int jj = 0;jj<Ny;jj++){
-                    GridInRegion.push_back(Region.pnpoly(ConvertIndextoWorld((ii+1)*Ny+jj)));
-                    yval += dy;
-                }
-            }else{
-                xval += dx;
+        int NSquares = std::max(Nx-1, 0)*std::max(Ny-1, 0);
+        std::vector<double> X, Y;
+        CreateGridCoordinates(X, Y);
+        Integral.Coefficient_a.resize(NSquares);
+        Integral.Coefficient_b.resize(NSquares);
+        Integral.Coefficient_c.resize(NSquares);
+        Integral.Coefficient_d.resize(NSquares);
+        ParallelFor(Nx-1, [&](const int ii, const int worker){
+            for (int jj = 0; jj<Ny-1; jj++){
+                CreateSquareCoefficients(ii, jj, X[ii], Y[jj]);
             }
-            
-            
+        });
+    }
+    void Density::ComputeSquareCoefficients(const int ii, const int jj, const double xval, const double yval, double &a, double &b, double &c, double &d) const{
+        BilinearCoefficients(Values[ii*Ny+jj], Values[ii*Ny+jj+1], Values[(ii+1)*Ny+jj], Values[(ii+1)*Ny+jj+1], xval, yval, dx, dy, a, b, c, d);
+    }
+    void Density::BilinearCoefficients(const double v00, const double v01, const double v10, const double v11, const double xval, const double yval, const double dx, const double dy, double &a, double &b, double &c, double &d){
+        double gamma = 0, eta = 0, xi = 0;
+        gamma = -(1/(dx*dy))*(v01+v10-v00-v11);
+        eta = (v10-v00)/dx;
+        xi = -(v00-v01)/dy;
+        a = -gamma*yval+eta;
+        b = -gamma*xval+xi;
+        c = gamma;
+        d = xval*yval*gamma-yval*xi-xval*eta+v00;
+    }
+    void Density::CreateSquareCoefficients(const int ii, const int jj, const double xval, const double yval){
+        double a = 0, b = 0, c = 0, d = 0;
+        int index = (Ny-1)*ii+jj;
+        ComputeSquareCoefficients(ii, jj, xval, yval, a, b, c, d);
+        Integral.Coefficient_a[index] = a;
+        Integral.Coefficient_b[index] = b;
+        Integral.Coefficient_c[index] = c;
+        Integral.Coefficient_d[index] = d;
+    }
+    void Density::GetSquareCoefficients(const int ii, const int jj, double &a, double &b, double &c, double &d) const{
+        if (Compact_Storage){
+            ComputeSquareCoefficients(ii, jj, minx+ii*dx, miny+jj*dy, a, b, c, d);
+            return;
+        }
+        int index = (Ny-1)*ii+jj;
+        a = Integral.Coefficient_a[index];
+        b = Integral.Coefficient_b[index];
+        c = Integral.Coefficient_c[index];
+        d = Integral.Coefficient_d[index];
+    }
+    void Density::CreateSquareIntegrals(const int ii, const int jj, const double xval, const double xval1, const double yval, const double yval1, double &result, double &resultx, double &resulty) const{
+        double a = 0, b = 0, c = 0, d = 0;
+        GetSquareCoefficients(ii, jj, a, b, c, d);
+        BilinearIntegrals(a, b, c, d, xval, xval1, yval, yval1, dx, dy, result, resultx, resulty);
+    }
+    void Density::BilinearIntegrals(const double a, const double b, const double c, const double d, const double xval, const double xval1, const double yval, const double yval1, const double dx, const double dy, double &result, double &resultx, double &resulty){
+        result = dy*dx*d+dy*(xval1*xval1-xval*xval)/2*a+dx*(yval1*yval1-yval*yval)/2*b+(yval1*yval1-yval*yval)*(xval1*xval1-xval*xval)/4*c;
+        resultx = dy*(xval1*xval1-xval*xval)*d/2+dy*(xval1*xval1*xval1-xval*xval*xval)*a/3+(xval1*xval1-xval*xval)*(yval1*yval1-yval*yval)/4*b+(yval1*yval1-yval*yval)*(xval1*xval1*xval1-xval*xval*xval)/6*c;
+        resulty = (yval1*yval1-yval*yval)*dx*d/2+(yval1*yval1-yval*yval)*(xval1*xval1-xval*xval)/4*a+dx*(yval1*yval1*yval1-yval*yval*yval)/3*b+(yval1*yval1*yval1-yval*yval*yval)*(xval1*xval1-xval*xval)/6*c;
+    }
+    void Density::StoreSquareIntegrals(const int ii, const int jj, const double result, const double resultx, const double resulty){
+        size_t index = (size_t) (Ny-1)*ii+jj;
+        if (Compact_Storage){
+            //The moments are stored relative to the lower-left grid point, so that their float32 precision is relative to the size of the grid square rather than to the coordinates
+            float *square = &Integral.Compact[3*index];
+            square[0] = (float) result;
+            square[1] = (float) (resultx-(minx+ii*dx)*result);
+            square[2] = (float) (resulty-(miny+jj*dy)*result);
+            return;
+        }
+        Integral.Int[index] = result;
+        Integral.Intx[index] = resultx;
+        Integral.Inty[index] = resulty;
+    }
+    void Density::AddSquareIntegrals(const int ii, const int jj, double &sum, double &sumx, double &sumy) const{
+        size_t index = (size_t) (Ny-1)*ii+jj;
+        if (Compact_Storage){
+            const float *square = &Integral.Compact[3*index];
+            double result = square[0];
+            sum += result;
+            sumx += (minx+ii*dx)*result+square[1];
+            sumy += (miny+jj*dy)*result+square[2];
+            return;
         }
+        sum += Integral.Int[index];
+        sumx += Integral.Intx[index];
+        sumy += Integral.Inty[index];
+    }
+    bool Density::IsSquareInRegion(const int ii, const int jj) const{
+        return IsGridPointInRegion(ii, jj) && IsGridPointInRegion(ii+1, jj) && IsGridPointInRegion(ii, jj+1) && IsGridPointInRegion(ii+1, jj+1);
     }
     double Density::CreateIntegralVector(void){
+        int NSquares = std::max(Nx-1, 0)*std::max(Ny-1, 0);
+        double total = 0;
+        std::vector<double> X, Y, Column_Area(std::max(Nx-1, 0), 0);
+        CreateGridCoordinates(X, Y);
         Integral.Unweighted_Area = 0;
-        double result = 0, resultx = 0,resulty = 0, xval,xval1,yval,yval1, total=0;
-        int index = 0;
-        xval1 = minx;
-        for (int ii = 0;ii<Nx-1;ii++){
-            xval = xval1;
-            xval1 = xval+dx;
-            yval1 = miny;
+        Column_Totals.assign(std::max(Nx-1, 0), 0);
+        if (Compact_Storage){
+            Integral.Compact.resize((size_t) 3*NSquares);
+        }else{
+            Integral.Int.resize(NSquares);
+            Integral.Intx.resize(NSquares);
+            Integral.Inty.resize(NSquares);
+        }
+        ParallelFor(Nx-1, [&](const int ii, const int worker){
+            Column_Totals[ii] = CreateColumnIntegrals(ii, 0, Ny-2, X, Y);
             for (int jj = 0;jj<Ny-1;jj++){
-                yval = yval1;
-                yval1 = yval+dy;
-                result = dy*dx*Integral.Coefficient_d[index]+dy*(xval1*xval1-xval*xval)/2*Integral.Coefficient_a[index]+dx*(yval1*yval1-yval*yval)/2*Integral.Coefficient_b[index]+(yval1*yval1-yval*yval)*(xval1*xval1-xval*xval)/4*Integral.Coefficient_c[index];
-                resultx = dy*(xval1*xval1-xval*xval)*Integral.Coefficient_d[index]/2+dy*(xval1*xval1*xval1-xval*xval*xval)*Integral.Coefficient_a[index]/3+(xval1*xval1-xval*xval)*(yval1*yval1-yval*yval)/4*Integral.Coefficient_b[index]+(yval1*yval1-yval*yval)*(xval1*xval1*xval1-xval*xval*xval)/6*Integral.Coefficient_c[index];
-                resulty = (yval1*yval1-yval*yval)*dx*Integral.Coefficient_d[index]/2+(yval1*yval1-yval*yval)*(xval1*xval1-xval*xval)/4*Integral.Coefficient_a[index]+dx*(yval1*yval1*yval1-yval*yval*yval)/3*Integral.Coefficient_b[index]+(yval1*yval1*yval1-yval*yval*yval)*(xval1*xval1-xval*xval)/6*Integral.Coefficient_c[index];
-                Integral.Int.push_back(result);
-                Integral.Intx.push_back(resultx);
-                Integral.Inty.push_back(resulty);
-                if (Region.pnpoly(ConvertIndextoWorld(ii*Ny+jj))){
-                    if (Region.pnpoly(ConvertIndextoWorld((ii+1)*Ny+jj))){
-                        if (Region.pnpoly(ConvertIndextoWorld(ii*Ny+jj+1))){
-                            if (Region.pnpoly(ConvertIndextoWorld((ii+1)*Ny+jj+1))){
-                                total+= result;
-                                Integral.Unweighted_Area +=dx*dy;
-                            }
-                        }
-                    }
+                if (IsSquareInRegion(ii, jj)){
+                    Column_Area[ii] += dx*dy;
                 }
-                index++;
+            }
+        });
+        for (int ii = 0; ii<Nx-1; ii++){
+            total += Column_Totals[ii];
+            Integral.Unweighted_Area += Column_Area[ii];
+        }
+        return total;
+    }
+    double Density::CreateColumnIntegrals(const int ii, const int j0, const int j1, const std::vector<double> &X, const std::vector<double> &Y){
+        double total = 0, result = 0, resultx = 0, resulty = 0;
+        for (int jj = 0; jj<Ny-1; jj++){
+            const bool inside = IsSquareInRegion(ii, jj);
+            if (jj>=j0 && jj<=j1){
+                CreateSquareIntegrals(ii, jj, X[ii], X[ii+1], Y[jj], Y[jj+1], result, resultx, resulty);
+                StoreSquareIntegrals(ii, jj, result, resultx, resulty);
+            }else if (!inside){
+                continue;
+            }else if (Compact_Storage){
+                //The stored integrals are rounded to float32, so the total is summed from the exact ones, as in a full pre-processing
+                CreateSquareIntegrals(ii, jj, X[ii], X[ii+1], Y[jj], Y[jj+1], result, resultx, resulty);
+            }else{
+                result = Integral.Int[(size_t) (Ny-1)*ii+jj];
+            }
+            if (inside){
+                total += result;
             }
         }
         return total;
     }
-    void Density::NormalizeIntegralVector(const double &Total){
+    void Density::SetNormalization(const double &Total){
         if (Total == 0){
             std::cout<<"Warning: Density values do not have sufficient support. Treated as Uniform"<<std::endl;
             for (int ii = 0; ii<(Nx)*(Ny); ii++){
@@ -510,21 +1095,176 @@ namespace AreaCon {
             }
             SetParameters(Nx, Ny, Values);
         }else{
-            for (int ii = 0; ii<(Nx-1)*(Ny-1); ii++){
-                Integral.Int[ii] /= Total;
-                Integral.Intx[ii] /= Total;
-                Integral.Inty[ii] /= Total;
+            Normalization = Total;
+        }
+    }
+    void Density::CreatePrefixSums(void){
+        if (Compact_Storage){
+            //Spans are summed square by square instead (see SumColumnSpan)
+            Integral.Int_Prefix.clear();
+            Integral.Intx_Prefix.clear();
+            Integral.Inty_Prefix.clear();
+            return;
+        }
+        Integral.Int_Prefix.assign(std::max(Nx-1, 0)*Ny, 0);
+        Integral.Intx_Prefix.assign(std::max(Nx-1, 0)*Ny, 0);
+        Integral.Inty_Prefix.assign(std::max(Nx-1, 0)*Ny, 0);
+        ParallelFor(Nx-1, [&](const int ii, const int worker){CreateColumnPrefixSums(ii);});
+    }
+    void Density::CreateColumnPrefixSums(const int ii){
+        int sizex = Ny-1;
+        if (Compact_Storage){
+            return;
+        }
+        for (int jj = 0; jj<Ny-1; jj++){
+            Integral.Int_Prefix[Ny*ii+jj+1] = Integral.Int_Prefix[Ny*ii+jj]+Integral.Int[sizex*ii+jj];
+            Integral.Intx_Prefix[Ny*ii+jj+1] = Integral.Intx_Prefix[Ny*ii+jj]+Integral.Intx[sizex*ii+jj];
+            Integral.Inty_Prefix[Ny*ii+jj+1] = Integral.Inty_Prefix[Ny*ii+jj]+Integral.Inty[sizex*ii+jj];
+        }
+    }
+    Density Density::Downsample(void) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }
+        Density Coarse;
+        Coarse.Volume_Lower_Bound = Volume_Lower_Bound;
+        Coarse.Exact_Integration = Exact_Integration;
+        Coarse.Compact_Storage = Compact_Storage;
+        Coarse.Pool = Pool;
+        Coarse.Region = Region;
+        Coarse.SetExtrema();
+        int nx = (Nx+1)/2, ny = (Ny+1)/2;
+        std::vector<int> First_x, Index_x, First_y, Index_y;
+        std::vector<double> Weight_x, Weight_y, Columns((size_t) Nx*ny), Coarse_Values((size_t) nx*ny);
+        DownsampleWeights(Nx, nx, First_x, Index_x, Weight_x);
+        DownsampleWeights(Ny, ny, First_y, Index_y, Weight_y);
+        //The filter is separable: every column of grid points is filtered in the y direction first, then the filtered columns in the x direction
+        ParallelFor(Nx, [&](const int ii, const int worker){
+            for (int jj = 0; jj<ny; jj++){
+                double sum = 0;
+                for (int kk = First_y[jj]; kk<First_y[jj+1]; kk++){
+                    sum += Weight_y[kk]*Values[(size_t) Ny*ii+Index_y[kk]];
+                }
+                Columns[(size_t) ny*ii+jj] = sum;
+            }
+        });
+        ParallelFor(nx, [&](const int ii, const int worker){
+            for (int jj = 0; jj<ny; jj++){
+                double sum = 0;
+                for (int kk = First_x[ii]; kk<First_x[ii+1]; kk++){
+                    sum += Weight_x[kk]*Columns[(size_t) ny*Index_x[kk]+jj];
+                }
+                Coarse_Values[(size_t) ny*ii+jj] = sum;
+            }
+        });
+        Coarse.SetParameters(nx, ny, std::move(Coarse_Values));
+        return Coarse;
+    }
+    void Density::DownsampleWeights(const int N, const int n, std::vector<int> &First, std::vector<int> &Index, std::vector<double> &Weight){
+        First.assign(n+1, 0);
+        Index.clear();
+        Weight.clear();
+        //The positions and the spacing of the coarse grid points in units of the fine spacing
+        const double spacing = (n>1) ? (double) (N-1)/(n-1) : 1;
+        for (int ii = 0; ii<n; ii++){
+            const double center = ii*spacing;
+            double total = 0;
+            for (int kk = std::max(0, (int) floor(center-spacing)); kk<=std::min(N-1, (int) ceil(center+spacing)); kk++){
+                const double weight = 1-fabs(kk-center)/spacing;
+                if (weight>0){
+                    Index.push_back(kk);
+                    Weight.push_back(weight);
+                    total += weight;
+                }
             }
+            for (int kk = First[ii]; kk<(int) Weight.size(); kk++){
+                Weight[kk] /= total;
+            }
+            First[ii+1] = (int) Weight.size();
         }
-        
-        
-        
+    }
+    void Density::UpdateValues(const std::vector<double> &Values){
+        int i0 = Nx, i1 = -1, j0 = Ny, j1 = -1;
+        if (this->Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }else if (Values.size() != this->Values.size()){
+            throw std::runtime_error("The size of Values must be equal to Nx*Ny");
+        }
+        for (int ii = 0; ii<Nx; ii++){
+            for (int jj = 0; jj<Ny; jj++){
+                if (Values[Ny*ii+jj] != this->Values[Ny*ii+jj]){
+                    i0 = std::min(i0, ii);
+                    i1 = std::max(i1, ii);
+                    j0 = std::min(j0, jj);
+                    j1 = std::max(j1, jj);
+                }
+            }
+        }
+        if (i1<0){
+            return;
+        }else if (i0 == 0 && j0 == 0 && i1 == Nx-1 && j1 == Ny-1){
+            SetParameters(Nx, Ny, Values);
+            return;
+        }
+        std::vector<double> Block;
+        Block.reserve((i1-i0+1)*(j1-j0+1));
+        for (int ii = i0; ii<=i1; ii++){
+            Block.insert(Block.end(), Values.begin()+Ny*ii+j0, Values.begin()+Ny*ii+j1+1);
+        }
+        UpdateValues(i0, j0, i1, j1, Block);
+    }
+    void Density::UpdateValues(const int i0, const int j0, const int i1, const int j1, const std::vector<double> &Block){
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }else if (i0<0 || j0<0 || i1>=Nx || j1>=Ny || i0>i1 || j0>j1){
+            throw std::runtime_error("The updated grid points must lie within the grid");
+        }else if (Block.size() != (i1-i0+1)*(j1-j0+1)){
+            throw std::runtime_error("The size of Block must be equal to (i1-i0+1)*(j1-j0+1)");
+        }
+        const int height = j1-j0+1;
+        Device.Reset();
+        for (int ii = i0; ii<=i1; ii++){
+            std::copy(Block.begin()+height*(ii-i0), Block.begin()+height*(ii-i0+1), Values.begin()+Ny*ii+j0);
+        }
+        //Only the grid squares with a corner among the updated grid points change, and with them the prefix sums and the totals of their columns
+        const int s0 = std::max(i0-1, 0), s1 = std::min(i1, Nx-2), t0 = std::max(j0-1, 0), t1 = std::min(j1, Ny-2);
+        std::vector<double> X, Y;
+        CreateGridCoordinates(X, Y);
+        ParallelFor(s1-s0+1, [&](const int column, const int worker){
+            int ii = s0+column;
+            if (!Compact_Storage){
+                for (int jj = t0; jj<=t1; jj++){
+                    CreateSquareCoefficients(ii, jj, X[ii], Y[jj]);
+                }
+            }
+            Column_Totals[ii] = CreateColumnIntegrals(ii, t0, t1, X, Y);
+            CreateColumnPrefixSums(ii);
+        });
+        //The tables are not normalized, so a change of the total integral only changes Normalization
+        double Total = 0;
+        for (int ii = 0; ii<Nx-1; ii++){
+            Total += Column_Totals[ii];
+        }
+        if (Total<=0){
+            SetParameters(Nx, Ny, Values);
+            return;
+        }
+        Normalization = Total;
+        double sum = 0, sumx = 0, sumy = 0;
+        IntegratePolygonExact(Region.GetVertices(), true, sum, sumx, sumy);
+        Region_Volume = (sum>0) ? sum/Normalization : 1;
     }
     void Density::PreprocessIntegral(void){
         double Total;
+        Device.Reset();
         CreateIntegralCoefficients();
         Total = CreateIntegralVector();
-        NormalizeIntegralVector(Total);
+        SetNormalization(Total);
+        CreatePrefixSums();
+        //The exact integral over Region exceeds Normalization by the contribution of the grid squares straddling its boundary
+        double sum = 0, sumx = 0, sumy = 0;
+        IntegratePolygonExact(Region.GetVertices(), true, sum, sumx, sumy);
+        Region_Volume = (sum>0) ? sum/Normalization : 1;
     }
     double Density::LineIntegral(double spacing, const Point &p1, const Point &p2) const{
         if (Values.empty()){
@@ -544,102 +1284,557 @@ namespace AreaCon {
         }
         sum = sum*spacing*Point::Distance(p1,p2)/2;
         return sum;
-        //    }
     }
-    double Density::CalculateWeightedArea(const Poly Test) const{
+    void Density::LineIntegrals(double spacing, const int NLines, const Point *Starts, const Point *Ends, double *Results) const{
         if (Values.empty()){
             throw std::runtime_error("Values have not been set!");
+        }else if(spacing <= 0 || spacing >1){
+            throw std::runtime_error("Spacing cannot be less than or equal to 0 or greater than 1");
         }
-        double sum = 0;
-        int index = 0;
-        double minx1,maxx1,miny1,maxy1,y0 = miny,x0 = minx;
-        int size = Test.GetNVertices(), sizex = Ny-1;
-        std::vector<bool> GridInPolyTemp = GetGridInRegion();
-        if (size == 0){
-            return Volume_Lower_Bound;
-        }else{
-            Test.GetExtrema(minx1, miny1, maxx1, maxy1);
-            for(int ii=0;ii<Nx;ii++){
-                if(x0<minx1 || x0>maxx1){
-                    for(int jj=0;jj<Ny;jj++){
-                        GridInPolyTemp[ii*Ny+jj] = false;
-                    }
-                }else{
-                    y0 = miny;
-                    for(int jj=0;jj<Ny;jj++){
-                        if(y0<miny1 || y0>maxy1){
-                            GridInPolyTemp[ii*Ny+jj] = false;
-                        }else if(Test.pnpoly(Point(x0, y0))){
-                            GridInPolyTemp[ii*Ny+jj] = true;
-                            if (ii>0 && jj>0){
-                                if (GridInPolyTemp[ii*Ny+jj] &&  GridInPolyTemp[(ii-1)*Ny+jj] && GridInPolyTemp[(ii-1)*Ny+jj-1] && GridInPolyTemp[ii*Ny+jj-1]){
-                                    index = sizex*(ii-1)+jj-1;
-                                    sum += Integral.Int[index];
-                                }
-                            }
-                        }else{
-                            GridInPolyTemp[ii*Ny+jj] = false;
-                        }
-                        y0+=dy;
-                    }
-                }
-                x0+=dx;
+        //The evaluation points only depend on spacing, so their line parameters are shared by all lines
+        std::vector<double> t(1, 0);
+        for (double ii = 0;ii<1-spacing;ii+=spacing){
+            t.push_back(ii+spacing);
+        }
+        int NPoints = (int) t.size();
+        std::vector<double> x(NPoints), y(NPoints), f(NPoints);
+        for (int ll = 0; ll<NLines; ll++){
+            const Point &p1 = Starts[ll], &p2 = Ends[ll];
+            double sum = 0;
+            for (int kk = 0; kk<NPoints; kk++){
+                x[kk] = p1.x+(p2.x-p1.x)*t[kk];
+                y[kk] = p1.y+(p2.y-p1.y)*t[kk];
             }
-            
-            if (sum>=Volume_Lower_Bound){
-                return sum;
-            }else{
-                return Volume_Lower_Bound;
+            InterpolateValues(NPoints, x.data(), y.data(), f.data());
+            for (int kk = 1; kk<NPoints; kk++){
+                sum += (f[kk-1]+f[kk]);
             }
+            Results[ll] = sum*spacing*Point::Distance(p1, p2)/2;
         }
     }
-    Point Density::CalculateCentroid(const Poly Test, const double &Volume) const{
+    double Density::ExactLineIntegral(const Point &p1, const Point &p2) const{
         if (Values.empty()){
             throw std::runtime_error("Values have not been set!");
         }
-        double sumx = 0, sumy = 0;
-        int index = 0;
-        double minx1,maxx1,miny1,maxy1,y0 = miny,x0 = minx;
-        int size = Test.GetNVertices(), sizex = Ny-1;
-        std::vector<bool> GridInPolyTemp = GetGridInRegion();
-        if (size == 0){
-            return Point();
-        }else{
-            Test.GetExtrema(minx1, miny1, maxx1, maxy1);
-            for(int ii=0;ii<Nx;ii++){
-                if(x0<minx1 || x0>maxx1){
-                    for(int jj=0;jj<Ny;jj++){
-                        GridInPolyTemp[ii*Ny+jj] = false;
-                    }
-                }else{
-                    y0 = miny;
-                    for(int jj=0;jj<Ny;jj++){
-                        if(y0<miny1 || y0>maxy1){
-                            GridInPolyTemp[ii*Ny+jj] = false;
-                        }else if(Test.pnpoly(Point(x0, y0))){
-                            GridInPolyTemp[ii*Ny+jj] = true;
-                            if (ii>0 && jj>0){
-                                if (GridInPolyTemp[ii*Ny+jj] &&  GridInPolyTemp[(ii-1)*Ny+jj] && GridInPolyTemp[(ii-1)*Ny+jj-1] && GridInPolyTemp[ii*Ny+jj-1]){
-                                    index = sizex*(ii-1)+jj-1;
-                                    sumx += Integral.Intx[index];
-                                    sumy += Integral.Inty[index];
-                                }
-                            }
-                        }else{
-                            GridInPolyTemp[ii*Ny+jj] = false;
-                        }
-                        y0+=dy;
-                    }
-                }
-                x0+=dx;
-            }
-            if (Volume<=Volume_Lower_Bound){
+        double length = Point::Distance(p1, p2), ddx = p2.x-p1.x, ddy = p2.y-p1.y, sum = 0;
+        double t0 = 0, t1 = 0, tm = 0, tmax_x = INFINITY, tmax_y = INFINITY, tdelta_x = INFINITY, tdelta_y = INFINITY;
+        int ii = (int) floor((p1.x-minx)/dx), jj = (int) floor((p1.y-miny)/dy), step_x = (ddx>0) ? 1 : -1, step_y = (ddy>0) ? 1 : -1;
+        if (length == 0){
+            return 0;
+        }
+        //Points outside of the grid use the polynomial of the nearest grid square
+        ii = std::min(std::max(ii, 0), Nx-2);
+        jj = std::min(std::max(jj, 0), Ny-2);
+        //tmax_x and tmax_y are the line parameters at which the next vertical and horizontal grid lines are crossed
+        if (ddx != 0){
+            tmax_x = (minx+(ii+(ddx>0))*dx-p1.x)/ddx;
+            tdelta_x = dx/std::abs(ddx);
+        }
+        if (ddy != 0){
+            tmax_y = (miny+(jj+(ddy>0))*dy-p1.y)/ddy;
+            tdelta_y = dy/std::abs(ddy);
+        }
+        double a = 0, b = 0, c = 0, d = 0;
+        auto Evaluate = [&](const double t){
+            double x = p1.x+ddx*t, y = p1.y+ddy*t;
+            return a*x+b*y+c*x*y+d;
+        };
+        while (t0<1){
+            t1 = std::max(t0, std::min(std::min(tmax_x, tmax_y), 1.0));
+            if (t1>t0){
+                //The density is quadratic in t along the line, so Simpson's rule is exact on each piece
+                GetSquareCoefficients(ii, jj, a, b, c, d);
+                tm = (t0+t1)/2;
+                sum += (t1-t0)*(Evaluate(t0)+4*Evaluate(tm)+Evaluate(t1))/6;
+            }
+            t0 = t1;
+            if (tmax_x<=tmax_y){
+                if (ii+step_x>=0 && ii+step_x<=Nx-2){
+                    ii += step_x;
+                }
+                tmax_x += tdelta_x;
+            }else{
+                if (jj+step_y>=0 && jj+step_y<=Ny-2){
+                    jj += step_y;
+                }
+                tmax_y += tdelta_y;
+            }
+        }
+        return sum*length;
+    }
+    void Density::SweepPolygon(const Poly &Test, double &sum, double &sumx, double &sumy) const{
+        double minx1,maxx1,miny1,maxy1,x0 = minx;
+        //Only the current and the previous column of grid points are needed to test the corners of each grid square
+        std::vector<char> Column(Ny, 0), Previous(Ny, 0);
+        std::vector<int> Spans;
+        sum = 0;
+        sumx = 0;
+        sumy = 0;
+        Test.GetExtrema(minx1, miny1, maxx1, maxy1);
+        for(int ii=0;ii<Nx;ii++){
+            Column.swap(Previous);
+            std::fill(Column.begin(), Column.end(), 0);
+            x0 = minx+ii*dx;
+            if(x0<minx1 || x0>maxx1){
+                continue;
+            }
+            Test.Scanline(Point(x0, miny), Point(0, dy), Ny, Spans);
+            for (int kk = 0; kk+1<Spans.size(); kk+=2){
+                for (int jj = Spans[kk]; jj<=Spans[kk+1]; jj++){
+                    Column[jj] = true;
+                    if (ii>0 && jj>Spans[kk] && Previous[jj] && Previous[jj-1]){
+                        AddSquareIntegrals(ii-1, jj-1, sum, sumx, sumy);
+                    }
+                }
+            }
+        }
+    }
+    void Density::IntegratePolygon(const Poly &Test, double &sum, double &sumx, double &sumy) const{
+        const double scale = GetVolumeScale();
+        if (Exact_Integration){
+            sum = 0;
+            sumx = 0;
+            sumy = 0;
+            IntegratePolygonExact(Test.GetVertices(), true, sum, sumx, sumy);
+        }else{
+            SweepPolygon(Test, sum, sumx, sumy);
+        }
+        sum /= scale;
+        sumx /= scale;
+        sumy /= scale;
+    }
+    void Density::IntegratePolygonExact(const std::vector<Point> &Vertices, const bool include_interior, double &sum, double &sumx, double &sumy) const{
+        int NVert = (int) Vertices.size(), i0, i1, j0 = 0, j1 = -1, j0_next = 0, j1_next = -1, jin0, jin1, jb0, jb1;
+        double minx1 = INFINITY, maxx1 = -INFINITY, miny1, maxy1, tolerance = Point::Robustness_Constant, y0, y1;
+        bool inside, inside_next;
+        std::vector<Point> Strip, Piece, Buffer;
+        if (NVert<3 || Nx<2 || Ny<2){
+            return;
+        }
+        for (int kk = 0; kk<NVert; kk++){
+            minx1 = std::min(minx1, Vertices[kk].x);
+            maxx1 = std::max(maxx1, Vertices[kk].x);
+        }
+        i0 = std::max(0, (int) floor((minx1-minx)/dx));
+        i1 = std::min(Nx-2, (int) floor((maxx1-minx)/dx));
+        if (i0>i1){
+            return;
+        }
+        inside = FindColumnSpan(Vertices, i0, j0, j1);
+        for (int ii = i0; ii<=i1; ii++){
+            inside_next = FindColumnSpan(Vertices, ii+1, j0_next, j1_next);
+            //Grid squares counted as interior, in the same way as in CalculateCoveringIntegrals
+            jin0 = 0;
+            jin1 = -1;
+            if (inside && inside_next){
+                jin0 = std::max(j0, j0_next);
+                jin1 = std::min(j1, j1_next)-1;
+            }
+            inside = inside_next;
+            j0 = j0_next;
+            j1 = j1_next;
+            if (include_interior && jin0<=jin1){
+                SumColumnSpan(ii, jin0, jin1, sum, sumx, sumy);
+            }
+            //The part of the polygon inside the ii-th column of grid squares
+            Strip = Vertices;
+            Poly::ClipToHalfPlane(HalfPlane(Point(-1,0), -(minx+ii*dx)), tolerance, Strip, Buffer);
+            Poly::ClipToHalfPlane(HalfPlane(Point(1,0), minx+(ii+1)*dx), tolerance, Strip, Buffer);
+            if (Strip.size()<3){
+                continue;
+            }
+            miny1 = INFINITY;
+            maxy1 = -INFINITY;
+            for (int kk = 0; kk<Strip.size(); kk++){
+                miny1 = std::min(miny1, Strip[kk].y);
+                maxy1 = std::max(maxy1, Strip[kk].y);
+            }
+            jb0 = std::max(0, (int) floor((miny1-miny)/dy));
+            jb1 = std::min(Ny-2, (int) floor((maxy1-miny)/dy));
+            if (jin0<=jin1){
+                jb0 = std::min(jb0, jin0);
+                jb1 = std::max(jb1, jin1);
+            }
+            for (int jj = jb0; jj<=jb1; jj++){
+                if (jj>=jin0 && jj<=jin1){
+                    jj = jin1;
+                    continue;
+                }
+                y0 = miny+jj*dy;
+                y1 = miny+(jj+1)*dy;
+                Piece = Strip;
+                Poly::ClipToHalfPlane(HalfPlane(Point(0,-1), -y0), tolerance, Piece, Buffer);
+                Poly::ClipToHalfPlane(HalfPlane(Point(0,1), y1), tolerance, Piece, Buffer);
+                if (Piece.size()>=3){
+                    IntegrateClippedSquare(Piece, ii, jj, sum, sumx, sumy);
+                }
+            }
+        }
+    }
+    void Density::SumColumnSpan(const int ii, const int j0, const int j1, double &sum, double &sumx, double &sumy) const{
+        int index = Ny*ii;
+        if (Compact_Storage){
+            for (int jj = j0; jj<=j1; jj++){
+                AddSquareIntegrals(ii, jj, sum, sumx, sumy);
+            }
+            return;
+        }
+        sum += Integral.Int_Prefix[index+j1+1]-Integral.Int_Prefix[index+j0];
+        sumx += Integral.Intx_Prefix[index+j1+1]-Integral.Intx_Prefix[index+j0];
+        sumy += Integral.Inty_Prefix[index+j1+1]-Integral.Inty_Prefix[index+j0];
+    }
+    void Density::SumInteriorSquares(const std::vector<Point> &Vertices, double &sum, double &sumx, double &sumy) const{
+        int NVert = (int) Vertices.size(), i0, i1, j0 = 0, j1 = -1, j0_next = 0, j1_next = -1;
+        double minx1 = INFINITY, maxx1 = -INFINITY, tolerance = Point::Robustness_Constant;
+        bool inside, inside_next;
+        if (NVert<3 || Nx<2 || Ny<2){
+            return;
+        }
+        for (int kk = 0; kk<NVert; kk++){
+            minx1 = std::min(minx1, Vertices[kk].x);
+            maxx1 = std::max(maxx1, Vertices[kk].x);
+        }
+        i0 = std::max(0, (int) ceil((minx1-tolerance-minx)/dx));
+        i1 = std::min(Nx-1, (int) floor((maxx1+tolerance-minx)/dx));
+        if (i0>=i1){
+            return;
+        }
+        inside = FindColumnSpan(Vertices, i0, j0, j1);
+        for (int ii = i0; ii<i1; ii++){
+            inside_next = FindColumnSpan(Vertices, ii+1, j0_next, j1_next);
+            if (inside && inside_next && std::max(j0, j0_next)<std::min(j1, j1_next)){
+                SumColumnSpan(ii, std::max(j0, j0_next), std::min(j1, j1_next)-1, sum, sumx, sumy);
+            }
+            inside = inside_next;
+            j0 = j0_next;
+            j1 = j1_next;
+        }
+    }
+    void Density::IntegrateClippedSquare(const std::vector<Point> &Vertices, const int ii, const int jj, double &sum, double &sumx, double &sumy) const{
+        const double gauss_t[3] = {0.5-sqrt(0.15), 0.5, 0.5+sqrt(0.15)}, gauss_w[3] = {5.0/18, 8.0/18, 5.0/18};
+        int NVert = (int) Vertices.size();
+        double x0 = minx+ii*dx, y0 = miny+jj*dy, u, v, du, dv, w;
+        //Moments m_pq of the polygon (integrals of u^p*v^q) in coordinates relative to (x0, y0)
+        double m00 = 0, m10 = 0, m01 = 0, m11 = 0, m20 = 0, m02 = 0, m21 = 0, m12 = 0;
+        for (int kk = 0; kk<NVert; kk++){
+            const Point &p1 = Vertices[kk], &p2 = Vertices[(kk+1)%NVert];
+            du = p2.x-p1.x;
+            dv = p2.y-p1.y;
+            for (int qq = 0; qq<3; qq++){
+                u = p1.x-x0+gauss_t[qq]*du;
+                v = p1.y-y0+gauss_t[qq]*dv;
+                w = gauss_w[qq]*dv;
+                //Green's theorem: the integral of u^p*v^q over the polygon is the contour integral of u^(p+1)*v^q/(p+1) dv
+                m00 += w*u;
+                m10 += w*u*u/2;
+                m01 += w*u*v;
+                m11 += w*u*u*v/2;
+                m20 += w*u*u*u/3;
+                m02 += w*u*v*v;
+                m21 += w*u*u*u*v/3;
+                m12 += w*u*u*v*v/2;
+            }
+        }
+        if (m00<0){
+            m00 = -m00; m10 = -m10; m01 = -m01; m11 = -m11;
+            m20 = -m20; m02 = -m02; m21 = -m21; m12 = -m12;
+        }
+        //The density a*x+b*y+c*x*y+d in relative coordinates: A*u+B*v+C*u*v+D
+        double a = 0, b = 0, c = 0, d = 0;
+        GetSquareCoefficients(ii, jj, a, b, c, d);
+        double A = a+c*y0, B = b+c*x0, C = c, D = a*x0+b*y0+c*x0*y0+d;
+        double result = A*m10+B*m01+C*m11+D*m00;
+        double resultu = A*m20+B*m11+C*m21+D*m10;
+        double resultv = A*m11+B*m02+C*m12+D*m01;
+        sum += result;
+        sumx += x0*result+resultu;
+        sumy += y0*result+resultv;
+    }
+    double Density::CalculateWeightedArea(const Poly &Test) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }
+        double sum = 0, sumx = 0, sumy = 0;
+        if (Test.GetNVertices() == 0){
+            return Volume_Lower_Bound;
+        }else{
+            IntegratePolygon(Test, sum, sumx, sumy);
+            if (sum>=Volume_Lower_Bound){
+                return sum;
+            }else{
+                return Volume_Lower_Bound;
+            }
+        }
+    }
+    Point Density::CalculateCentroid(const Poly &Test, const double &Volume) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }
+        double sum = 0, sumx = 0, sumy = 0;
+        double minx1,maxx1,miny1,maxy1;
+        if (Test.GetNVertices() == 0){
+            return Point();
+        }else{
+            IntegratePolygon(Test, sum, sumx, sumy);
+            Test.GetExtrema(minx1, miny1, maxx1, maxy1);
+            if (Volume<=Volume_Lower_Bound){
                 return Point(minx1,miny1);
             }else{
                 return Point(sumx/Volume, sumy/Volume);
             }
         }
     }
+    void Density::CalculateVolumeAndCentroid(const Poly &Test, double &Volume, Point &Centroid) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }
+        double sum = 0, sumx = 0, sumy = 0;
+        if (Test.GetNVertices() == 0){
+            Volume = Volume_Lower_Bound;
+            Centroid = Point();
+            return;
+        }
+        IntegratePolygon(Test, sum, sumx, sumy);
+        SetVolumeAndCentroid(Test, sum, sumx, sumy, Volume, Centroid);
+    }
+    void Density::SetVolumeAndCentroid(const Poly &Test, const double sum, const double sumx, const double sumy, double &Volume, Point &Centroid) const{
+        double minx1,maxx1,miny1,maxy1;
+        if (Test.GetNVertices() == 0){
+            Volume = Volume_Lower_Bound;
+            Centroid = Point();
+            return;
+        }
+        Volume = (sum>=Volume_Lower_Bound) ? sum : Volume_Lower_Bound;
+        if (Volume<=Volume_Lower_Bound){
+            Test.GetExtrema(minx1, miny1, maxx1, maxy1);
+            Centroid = Point(minx1,miny1);
+        }else{
+            Centroid = Point(sumx/Volume, sumy/Volume);
+        }
+    }
+    void Density::CalculateVolumeAndCentroid(const std::vector<Poly> &Regions, std::vector<double> &Volumes, std::vector<Point> &Centroids) const{
+        Volumes.resize(Regions.size());
+        Centroids.resize(Regions.size());
+        for (int ii = 0; ii<Regions.size(); ii++){
+            CalculateVolumeAndCentroid(Regions[ii], Volumes[ii], Centroids[ii]);
+        }
+    }
+#ifdef AREACON_OFFLOAD
+#pragma omp declare target
+#endif
+    template <class Vertex>
+    bool Density::FindColumnSpan(const Vertex *Vertices, const int NVert, const double x, const double tolerance, const double miny, const double dy, const int Ny, int &j0, int &j1){
+        double ylow = INFINITY, yhigh = -INFINITY, t;
+        for (int kk = 0; kk<NVert; kk++){
+            const Vertex &p1 = Vertices[kk], &p2 = Vertices[(kk+1)%NVert];
+            if (x<std::min(p1.x,p2.x)-tolerance || x>std::max(p1.x,p2.x)+tolerance){
+                continue;
+            }else if (std::abs(p2.x-p1.x)<=tolerance){
+                ylow = std::min(ylow, std::min(p1.y,p2.y));
+                yhigh = std::max(yhigh, std::max(p1.y,p2.y));
+            }else{
+                t = std::min(1.0, std::max(0.0, (x-p1.x)/(p2.x-p1.x)));
+                ylow = std::min(ylow, p1.y+t*(p2.y-p1.y));
+                yhigh = std::max(yhigh, p1.y+t*(p2.y-p1.y));
+            }
+        }
+        if (ylow>yhigh){
+            return false;
+        }
+        j0 = std::max(0, (int) ceil((ylow-tolerance-miny)/dy));
+        j1 = std::min(Ny-1, (int) floor((yhigh+tolerance-miny)/dy));
+        return j0<=j1;
+    }
+    void Density::SumColumnSpans(const int first, const int last, const DeviceTables::Vertex *V, const int *VO, const int *IO, const int *FC, const int NRegions, const double x0, const double y0, const double dx, const double dy, const int Ny, const double tolerance, const double *P, const double *Px, const double *Py, double *IS){
+        for (int item = first; item<last; item++){
+            int lo = 0, hi = NRegions-1, j0 = 0, j1 = -1, j0_next = 0, j1_next = -1;
+            //The polygon of the item is the last one whose first item is not after it
+            while (lo<hi){
+                int mid = (lo+hi+1)/2;
+                if (IO[mid]<=item){
+                    lo = mid;
+                }else{
+                    hi = mid-1;
+                }
+            }
+            const int kk = lo, ii = FC[kk]+item-IO[kk], NVert = VO[kk+1]-VO[kk];
+            double sum = 0, sumx = 0, sumy = 0;
+            if (FindColumnSpan(V+VO[kk], NVert, x0+ii*dx, tolerance, y0, dy, Ny, j0, j1) && FindColumnSpan(V+VO[kk], NVert, x0+(ii+1)*dx, tolerance, y0, dy, Ny, j0_next, j1_next) && std::max(j0, j0_next)<std::min(j1, j1_next)){
+                const int index = Ny*ii, first_square = std::max(j0, j0_next), last_square = std::min(j1, j1_next)-1;
+                sum = P[index+last_square+1]-P[index+first_square];
+                sumx = Px[index+last_square+1]-Px[index+first_square];
+                sumy = Py[index+last_square+1]-Py[index+first_square];
+            }
+            IS[3*item] = sum;
+            IS[3*item+1] = sumx;
+            IS[3*item+2] = sumy;
+        }
+    }
+    void Density::ReduceColumnSpans(const int kk, const int *IO, const double *IS, double *S){
+        double sum = 0, sumx = 0, sumy = 0;
+        for (int item = IO[kk]; item<IO[kk+1]; item++){
+            sum += IS[3*item];
+            sumx += IS[3*item+1];
+            sumy += IS[3*item+2];
+        }
+        S[3*kk] = sum;
+        S[3*kk+1] = sumx;
+        S[3*kk+2] = sumy;
+    }
+#ifdef AREACON_OFFLOAD
+#pragma omp end declare target
+#endif
+    bool Density::FindColumnSpan(const std::vector<Point> &Vertices, const int ii, int &j0, int &j1) const{
+        return FindColumnSpan(Vertices.data(), (int) Vertices.size(), minx+ii*dx, Point::Robustness_Constant, miny, dy, Ny, j0, j1);
+    }
+    void Density::CalculateCoveringIntegrals(const std::vector<Poly> &Covering, std::vector<double> &Volumes, std::vector<Point> &Centroids, std::vector<int> &Owner) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }
+        int NRegions = (int) Covering.size(), sizex = Ny-1, i0, i1, j0, j1, j0_next, j1_next;
+        double minx1,maxx1,miny1,maxy1, tolerance = Point::Robustness_Constant;
+        bool inside, inside_next;
+        std::vector<double> sumx(NRegions, 0), sumy(NRegions, 0);
+        Volumes.assign(NRegions, 0);
+        Centroids.assign(NRegions, Point());
+        Owner.assign((Nx-1)*(Ny-1), -1);
+        //Label every grid square with the polygon that contains all four of its corners
+        for (int kk = 0; kk<NRegions; kk++){
+            if (Covering[kk].GetNVertices() == 0){
+                continue;
+            }
+            const std::vector<Point> &Vertices = Covering[kk].GetVertices();
+            Covering[kk].GetExtrema(minx1, miny1, maxx1, maxy1);
+            i0 = std::max(0, (int) ceil((minx1-tolerance-minx)/dx));
+            i1 = std::min(Nx-1, (int) floor((maxx1+tolerance-minx)/dx));
+            if (i0>=i1){
+                continue;
+            }
+            inside = FindColumnSpan(Vertices, i0, j0, j1);
+            for (int ii = i0; ii<i1; ii++){
+                inside_next = FindColumnSpan(Vertices, ii+1, j0_next, j1_next);
+                if (inside && inside_next){
+                    for (int jj = std::max(j0, j0_next); jj<std::min(j1, j1_next); jj++){
+                        Owner[sizex*ii+jj] = kk;
+                    }
+                }
+                inside = inside_next;
+                j0 = j0_next;
+                j1 = j1_next;
+            }
+        }
+        //Accumulate the integrals of all polygons in a single pass
+        for (int ii = 0, index = 0; ii<Nx-1; ii++){
+            for (int jj = 0; jj<Ny-1; jj++, index++){
+                if (Owner[index]>=0){
+                    AddSquareIntegrals(ii, jj, Volumes[Owner[index]], sumx[Owner[index]], sumy[Owner[index]]);
+                }
+            }
+        }
+        const double scale = GetVolumeScale();
+        for (int kk = 0; kk<NRegions; kk++){
+            if (Exact_Integration && Covering[kk].GetNVertices() != 0){
+                IntegratePolygonExact(Covering[kk].GetVertices(), false, Volumes[kk], sumx[kk], sumy[kk]);
+            }
+            Volumes[kk] /= scale;
+            sumx[kk] /= scale;
+            sumy[kk] /= scale;
+        }
+        for (int kk = 0; kk<NRegions; kk++){
+            SetVolumeAndCentroid(Covering[kk], Volumes[kk], sumx[kk], sumy[kk], Volumes[kk], Centroids[kk]);
+        }
+    }
+    void Density::CalculateSpanIntegrals(const std::vector<Poly> &Regions, std::vector<double> &Volumes, std::vector<Point> &Centroids) const{
+        Volumes.resize(Regions.size());
+        Centroids.resize(Regions.size());
+        for (int kk = 0; kk<Regions.size(); kk++){
+            CalculateSpanIntegrals(Regions[kk], Volumes[kk], Centroids[kk]);
+        }
+    }
+    void Density::CalculateSpanIntegrals(const Poly &Region, double &Volume, Point &Centroid) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }
+        const double scale = GetVolumeScale();
+        double sum = 0, sumx = 0, sumy = 0;
+        if (Exact_Integration){
+            IntegratePolygonExact(Region.GetVertices(), true, sum, sumx, sumy);
+        }else{
+            SumInteriorSquares(Region.GetVertices(), sum, sumx, sumy);
+        }
+        SetVolumeAndCentroid(Region, sum/scale, sumx/scale, sumy/scale, Volume, Centroid);
+    }
+    void Density::CalculateDeviceIntegrals(const std::vector<Poly> &Regions, std::vector<double> &Volumes, std::vector<Point> &Centroids) const{
+        if (Values.empty()){
+            throw std::runtime_error("Values have not been set!");
+        }else if (Compact_Storage){
+            CalculateSpanIntegrals(Regions, Volumes, Centroids);
+            return;
+        }
+        const int NRegions = (int) Regions.size(), ny = Ny;
+        const double tolerance = Point::Robustness_Constant, x0 = minx, y0 = miny, ddx = dx, ddy = dy;
+        std::vector<DeviceTables::Vertex> Vertices;
+        std::vector<int> Vertex_Offsets(NRegions+1, 0), Item_Offsets(NRegions+1, 0), First_Column(NRegions, 0);
+        std::vector<double> Sums(3*NRegions, 0);
+        //Every polygon gets one work item for each of the columns of grid squares i0,...,i1-1 that it may cover (see SumInteriorSquares)
+        for (int kk = 0; kk<NRegions; kk++){
+            const std::vector<Point> &Polygon = Regions[kk].GetVertices();
+            double minx1 = INFINITY, maxx1 = -INFINITY;
+            int i0 = 0, i1 = 0;
+            for (int vv = 0; vv<Polygon.size(); vv++){
+                minx1 = std::min(minx1, Polygon[vv].x);
+                maxx1 = std::max(maxx1, Polygon[vv].x);
+            }
+            if (Polygon.size()>=3 && Nx>=2 && Ny>=2){
+                i0 = std::max(0, (int) ceil((minx1-tolerance-minx)/dx));
+                i1 = std::min(Nx-1, (int) floor((maxx1+tolerance-minx)/dx));
+            }
+            for (int vv = 0; vv<Polygon.size(); vv++){
+                DeviceTables::Vertex Corner = {Polygon[vv].x, Polygon[vv].y};
+                Vertices.push_back(Corner);
+            }
+            Vertex_Offsets[kk+1] = (int) Vertices.size();
+            First_Column[kk] = i0;
+            Item_Offsets[kk+1] = Item_Offsets[kk]+std::max(i1-i0, 0);
+        }
+        const std::shared_ptr<const DeviceTables> Tables = Device.Get(Integral);
+        const int NItems = Item_Offsets[NRegions];
+        const double *P = Tables->Int_Prefix, *Px = Tables->Intx_Prefix, *Py = Tables->Inty_Prefix;
+        const DeviceTables::Vertex *V = Vertices.data();
+        const int *VO = Vertex_Offsets.data(), *IO = Item_Offsets.data(), *FC = First_Column.data();
+        std::vector<double> Item_Sums(3*std::max(NItems, 1), 0);
+        double *IS = Item_Sums.data(), *S = Sums.data();
+#ifdef AREACON_OFFLOAD
+        const int NVertices = (int) Vertices.size(), NPrefix = (int) Tables->Size;
+#pragma omp target data map(to: V[0:NVertices], VO[0:NRegions+1], IO[0:NRegions+1], FC[0:NRegions]) map(alloc: IS[0:3*NItems]) map(from: S[0:3*NRegions])
+        {
+            //Rasterization: every work item sums the span of grid squares of one column whose four corners lie inside one polygon
+#pragma omp target teams distribute parallel for map(to: P[0:NPrefix], Px[0:NPrefix], Py[0:NPrefix])
+            for (int item = 0; item<NItems; item++){
+                SumColumnSpans(item, item+1, V, VO, IO, FC, NRegions, x0, y0, ddx, ddy, ny, tolerance, P, Px, Py, IS);
+            }
+            //Reduction: the sums of every polygon are added in column order, as in SumInteriorSquares
+#pragma omp target teams distribute parallel for
+            for (int kk = 0; kk<NRegions; kk++){
+                ReduceColumnSpans(kk, IO, IS, S);
+            }
+        }
+#else
+        //On the host, the work items are summed in blocks, and every polygon is reduced by a single thread in column order, so that the results do not depend on the number of threads
+        const int block = 256;
+        ParallelFor((NItems+block-1)/block, [&](const int bb, const int worker){SumColumnSpans(bb*block, std::min(NItems, (bb+1)*block), V, VO, IO, FC, NRegions, x0, y0, ddx, ddy, ny, tolerance, P, Px, Py, IS);});
+        ParallelFor(NRegions, [&](const int kk, const int worker){ReduceColumnSpans(kk, IO, IS, S);});
+#endif
+        const double scale = GetVolumeScale();
+        Volumes.resize(NRegions);
+        Centroids.resize(NRegions);
+        for (int kk = 0; kk<NRegions; kk++){
+            if (Exact_Integration && Regions[kk].GetNVertices() != 0){
+                IntegratePolygonExact(Regions[kk].GetVertices(), false, Sums[3*kk], Sums[3*kk+1], Sums[3*kk+2]);
+            }
+            SetVolumeAndCentroid(Regions[kk], Sums[3*kk]/scale, Sums[3*kk+1]/scale, Sums[3*kk+2]/scale, Volumes[kk], Centroids[kk]);
+        }
+    }
     
     void Density::WriteToFile(const std::string filename)const{
         std::ofstream file1;
@@ -652,14 +1847,632 @@ namespace AreaCon {
         file1.close();
         
     }
+    void Density::WriteBinaryFile(const std::string filename, const bool single_precision, const bool include_integrals) const{
+        std::ofstream File(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!File.is_open()){
+            throw std::runtime_error("Output file could not be opened");
+        }
+        const bool integrals = include_integrals && !Values.empty() && !Compact_Storage;
+        //The integrals stored with float32 values must belong to the values that are read back, so they are computed for a copy of the grid with the rounded values
+        Density Rounded;
+        const Density *Tables = this;
+        if (integrals && single_precision){
+            std::vector<double> Rounded_Values(Values.size());
+            for (size_t kk = 0; kk<Values.size(); kk++){
+                Rounded_Values[kk] = (float) Values[kk];
+            }
+            Rounded.Pool = Pool;
+            Rounded.SetNewRegion(Region, Nx, Ny, std::move(Rounded_Values));
+            Tables = &Rounded;
+        }
+        const Int_Params &Stored = Tables->Integral;
+        const std::vector<Point> &Vertices = Region.GetVertices();
+        std::int32_t header[6] = {0x01020304, Nx, Ny, single_precision ? 4 : 8, integrals ? 1 : 0, (std::int32_t) Vertices.size()};
+        double extents[4] = {minx, maxx, miny, maxy};
+        auto WriteArray = [&](const std::vector<double> &Array){
+            File.write(reinterpret_cast<const char*>(Array.data()), Array.size()*sizeof(double));
+        };
+        File.write("ACDENS02", 8);
+        File.write(reinterpret_cast<const char*>(header), sizeof(header));
+        File.write(reinterpret_cast<const char*>(extents), sizeof(extents));
+        for (int kk = 0; kk<Vertices.size(); kk++){
+            double vertex[2] = {Vertices[kk].x, Vertices[kk].y};
+            File.write(reinterpret_cast<const char*>(vertex), sizeof(vertex));
+        }
+        if (single_precision){
+            //The values are converted in blocks to keep the memory overhead small
+            std::vector<float> Block;
+            for (size_t first = 0; first<Values.size(); first += 4096){
+                Block.assign(Values.begin()+first, Values.begin()+std::min(first+4096, Values.size()));
+                File.write(reinterpret_cast<const char*>(Block.data()), Block.size()*sizeof(float));
+            }
+        }else{
+            WriteArray(Values);
+        }
+        if (integrals){
+            double scalars[3] = {Tables->Normalization, Tables->Region_Volume, Stored.Unweighted_Area};
+            File.write(reinterpret_cast<const char*>(scalars), sizeof(scalars));
+            WriteArray(Stored.Coefficient_a);
+            WriteArray(Stored.Coefficient_b);
+            WriteArray(Stored.Coefficient_c);
+            WriteArray(Stored.Coefficient_d);
+            WriteArray(Stored.Int);
+            WriteArray(Stored.Intx);
+            WriteArray(Stored.Inty);
+            WriteArray(Stored.Int_Prefix);
+            WriteArray(Stored.Intx_Prefix);
+            WriteArray(Stored.Inty_Prefix);
+            WriteArray(Tables->Column_Totals);
+            File.write(reinterpret_cast<const char*>(Region_Bits.data()), Region_Bits.size()*sizeof(std::uint64_t));
+        }
+        if (!File){
+            throw std::runtime_error("Output file could not be written");
+        }
+    }
+    size_t Density::ReadBinaryHeader(const MappedFile &File, int &Nx, int &Ny, int &value_size, bool &integrals, std::vector<Point> &Vertices, double *extents){
+        const char *Data = File.GetData();
+        size_t offset = 0;
+        auto Read = [&](void *destination, const size_t size){
+            if (size>File.GetSize()-offset){
+                throw std::runtime_error("Density file is truncated");
+            }
+            if (size>0){
+                std::memcpy(destination, Data+offset, size);
+            }
+            offset += size;
+        };
+        char magic[8];
+        std::int32_t header[6];
+        Read(magic, sizeof(magic));
+        const bool version1 = (std::memcmp(magic, "ACDENS01", 8) == 0);
+        if (!version1 && std::memcmp(magic, "ACDENS02", 8) != 0){
+            throw std::runtime_error("File is not a density file");
+        }
+        Read(header, sizeof(header));
+        if (header[0] != 0x01020304){
+            throw std::runtime_error("Density file has a different byte order");
+        }else if (header[1]<0 || header[2]<0 || (header[3] != 4 && header[3] != 8) || (header[4] != 0 && header[4] != 1) || header[5]<0){
+            throw std::runtime_error("Density file has an invalid header");
+        }
+        Nx = header[1];
+        Ny = header[2];
+        value_size = header[3];
+        //The integrals of version 1 files are normalized, so their densities are pre-processed again
+        integrals = (header[4] == 1 && !version1);
+        Read(extents, 4*sizeof(double));
+        Vertices.resize(header[5]);
+        for (int kk = 0; kk<header[5]; kk++){
+            double vertex[2];
+            Read(vertex, sizeof(vertex));
+            Vertices[kk] = Point(vertex[0], vertex[1]);
+        }
+        if ((size_t) Nx*Ny*value_size>File.GetSize()-offset){
+            throw std::runtime_error("Density file is truncated");
+        }
+        return offset;
+    }
+    void Density::ReadBinaryFile(const std::string filename){
+        MappedFile File(filename);
+        const char *Data = File.GetData();
+        size_t offset = 0;
+        //Copies the next bytes of the file, checking that the file is long enough
+        auto Read = [&](void *destination, const size_t size){
+            if (size>File.GetSize()-offset){
+                throw std::runtime_error("Density file is truncated");
+            }
+            if (size>0){
+                std::memcpy(destination, Data+offset, size);
+            }
+            offset += size;
+        };
+        auto ReadArray = [&](std::vector<double> &Array, const size_t size){
+            Array.resize(size);
+            Read(Array.data(), size*sizeof(double));
+        };
+        int nx = 0, ny = 0, value_size = 0;
+        bool integrals = false;
+        double extents[4];
+        std::vector<Point> Vertices;
+        offset = ReadBinaryHeader(File, nx, ny, value_size, integrals, Vertices, extents);
+        const size_t NValues = (size_t) nx*ny;
+        std::vector<double> New_Values(NValues);
+        if (value_size == 4){
+            for (size_t ii = 0; ii<NValues; ii++, offset += sizeof(float)){
+                float value;
+                std::memcpy(&value, Data+offset, sizeof(float));
+                New_Values[ii] = value;
+            }
+        }else{
+            Read(New_Values.data(), NValues*sizeof(double));
+        }
+        //Everything is read into temporaries first, so that a truncated or inconsistent file leaves the density unchanged
+        Poly New_Region(std::move(Vertices));
+        double new_minx, new_miny, new_maxx, new_maxy;
+        New_Region.GetExtrema(new_minx, new_miny, new_maxx, new_maxy);
+        if (extents[0] != new_minx || extents[1] != new_maxx || extents[2] != new_miny || extents[3] != new_maxy){
+            throw std::runtime_error("Density file has inconsistent extents");
+        }
+        if (!integrals || NValues == 0 || Compact_Storage){
+            SetNewRegion(std::move(New_Region), nx, ny, std::move(New_Values));
+            return;
+        }
+        const size_t NSquares = (size_t) std::max(nx-1, 0)*std::max(ny-1, 0), NPrefix = (size_t) std::max(nx-1, 0)*ny;
+        const int bit_stride = (ny+63)/64;
+        double scalars[3];
+        Int_Params New_Integral;
+        std::vector<double> New_Totals;
+        std::vector<std::uint64_t> New_Bits((size_t) nx*bit_stride);
+        Read(scalars, sizeof(scalars));
+        New_Integral.Unweighted_Area = scalars[2];
+        ReadArray(New_Integral.Coefficient_a, NSquares);
+        ReadArray(New_Integral.Coefficient_b, NSquares);
+        ReadArray(New_Integral.Coefficient_c, NSquares);
+        ReadArray(New_Integral.Coefficient_d, NSquares);
+        ReadArray(New_Integral.Int, NSquares);
+        ReadArray(New_Integral.Intx, NSquares);
+        ReadArray(New_Integral.Inty, NSquares);
+        ReadArray(New_Integral.Int_Prefix, NPrefix);
+        ReadArray(New_Integral.Intx_Prefix, NPrefix);
+        ReadArray(New_Integral.Inty_Prefix, NPrefix);
+        ReadArray(New_Totals, std::max(nx-1, 0));
+        Read(New_Bits.data(), New_Bits.size()*sizeof(std::uint64_t));
+        Device.Reset();
+        Region = std::move(New_Region);
+        SetExtrema();
+        Nx = nx;
+        Ny = ny;
+        Values = std::move(New_Values);
+        CheckParameterSizes();
+        Setdxy();
+        Normalization = scalars[0];
+        Region_Volume = scalars[1];
+        Integral = std::move(New_Integral);
+        Column_Totals = std::move(New_Totals);
+        Bit_Stride = bit_stride;
+        Region_Bits = std::move(New_Bits);
+    }
 
+    // TiledDensity Class-----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    TiledDensity::TiledDensity(const std::string filename, const int tile_size, const int max_tiles):File(filename), Values_Offset(0), Value_Size(8), Nx(0), Ny(0), dx(0), dy(0), Inv_dx(0), Inv_dy(0), Volume_Lower_Bound(0), Normalization(0), Tile_Size(tile_size), NTiles_x(0), NTiles_y(0), Max_Tiles(max_tiles), Tile_Loads(0){
+        if (tile_size<1){
+            throw std::runtime_error("tile_size must be greater than 0");
+        }else if (max_tiles<1){
+            throw std::runtime_error("max_tiles must be greater than 0");
+        }
+        bool integrals = false;
+        double extents[4];
+        std::vector<Point> Vertices;
+        Values_Offset = Density::ReadBinaryHeader(File, Nx, Ny, Value_Size, integrals, Vertices, extents);
+        if (Vertices.empty() || Nx<2 || Ny<2){
+            throw std::runtime_error("A tiled density requires a region and at least 2 by 2 grid points");
+        }
+        Region = Poly(std::move(Vertices));
+        Region.GetExtrema(minx, miny, maxx, maxy);
+        if (extents[0] != minx || extents[1] != maxx || extents[2] != miny || extents[3] != maxy){
+            throw std::runtime_error("Density file has inconsistent extents");
+        }
+        dx = (maxx-minx)/(Nx-1);
+        dy = (maxy-miny)/(Ny-1);
+        Inv_dx = 1/dx;
+        Inv_dy = 1/dy;
+        X.assign(Nx, minx);
+        Y.assign(Ny, miny);
+        for (int ii = 1; ii<Nx; ii++){
+            X[ii] = X[ii-1]+dx;
+        }
+        for (int jj = 1; jj<Ny; jj++){
+            Y[jj] = Y[jj-1]+dy;
+        }
+        NTiles_x = (Nx-2)/Tile_Size+1;
+        NTiles_y = (Ny-2)/Tile_Size+1;
+        Normalization = CreateNormalization();
+        if (Normalization == 0){
+            throw std::runtime_error("Density values do not have sufficient support");
+        }
+    }
+    int TiledDensity::GetNCachedTiles(void) const{
+        std::lock_guard<std::mutex> lock(Cache_Mutex);
+        return (int) Cache.size();
+    }
+    long TiledDensity::GetTileLoads(void) const{
+        std::lock_guard<std::mutex> lock(Cache_Mutex);
+        return Tile_Loads;
+    }
+    void TiledDensity::SetVolumeLowerBound(const double VolumeLowerBound){
+        this->Volume_Lower_Bound = VolumeLowerBound;
+    }
+    double TiledDensity::ReadValue(const int ii, const int jj) const{
+        const char *Address = File.GetData()+Values_Offset+((size_t) Ny*ii+jj)*Value_Size;
+        if (Value_Size == 4){
+            float value;
+            std::memcpy(&value, Address, sizeof(float));
+            return value;
+        }
+        double value;
+        std::memcpy(&value, Address, sizeof(double));
+        return value;
+    }
+    std::shared_ptr<TiledDensity::Tile> TiledDensity::LoadTile(const int ti, const int tj) const{
+        std::shared_ptr<Tile> New = std::make_shared<Tile>();
+        Tile &T = *New;
+        T.i0 = ti*Tile_Size;
+        T.j0 = tj*Tile_Size;
+        T.nx = std::min(Tile_Size, Nx-1-T.i0);
+        T.ny = std::min(Tile_Size, Ny-1-T.j0);
+        const int ny = T.ny+1;
+        T.Values.resize((size_t) (T.nx+1)*ny);
+        for (int ii = 0; ii<=T.nx; ii++){
+            for (int jj = 0; jj<=T.ny; jj++){
+                T.Values[(size_t) ny*ii+jj] = ReadValue(T.i0+ii, T.j0+jj);
+            }
+        }
+        if (Normalization == 0){
+            return New;
+        }
+        T.Int_Prefix.assign((size_t) T.nx*ny, 0);
+        T.Intx_Prefix.assign((size_t) T.nx*ny, 0);
+        T.Inty_Prefix.assign((size_t) T.nx*ny, 0);
+        for (int ii = 0; ii<T.nx; ii++){
+            const double *corner = &T.Values[(size_t) ny*ii];
+            const int gi = T.i0+ii;
+            size_t index = (size_t) ny*ii;
+            for (int jj = 0; jj<T.ny; jj++, index++){
+                double a = 0, b = 0, c = 0, d = 0, result = 0, resultx = 0, resulty = 0;
+                const int gj = T.j0+jj;
+                Density::BilinearCoefficients(corner[jj], corner[jj+1], corner[ny+jj], corner[ny+jj+1], X[gi], Y[gj], dx, dy, a, b, c, d);
+                Density::BilinearIntegrals(a, b, c, d, X[gi], X[gi+1], Y[gj], Y[gj+1], dx, dy, result, resultx, resulty);
+                T.Int_Prefix[index+1] = T.Int_Prefix[index]+result/Normalization;
+                T.Intx_Prefix[index+1] = T.Intx_Prefix[index]+resultx/Normalization;
+                T.Inty_Prefix[index+1] = T.Inty_Prefix[index]+resulty/Normalization;
+            }
+        }
+        return New;
+    }
+    std::shared_ptr<const TiledDensity::Tile> TiledDensity::GetTile(const int ti, const int tj) const{
+        const int key = NTiles_y*ti+tj;
+        std::promise<std::shared_ptr<const Tile>> Promise;
+        std::list<std::pair<int, std::shared_future<std::shared_ptr<const Tile>>>>::iterator entry;
+        {
+            std::unique_lock<std::mutex> lock(Cache_Mutex);
+            auto found = Cache_Index.find(key);
+            if (found != Cache_Index.end()){
+                Cache.splice(Cache.begin(), Cache, found->second);
+                std::shared_future<std::shared_ptr<const Tile>> Pending = Cache.front().second;
+                lock.unlock();
+                return Pending.get();
+            }
+            //The entry is created before the tile is computed, so that a tile is never computed twice
+            Tile_Loads++;
+            Cache.emplace_front(key, Promise.get_future().share());
+            entry = Cache.begin();
+            Cache_Index[key] = entry;
+            if ((int) Cache.size()>Max_Tiles){
+                Cache_Index.erase(Cache.back().first);
+                Cache.pop_back();
+            }
+        }
+        std::shared_ptr<const Tile> New;
+        try{
+            New = LoadTile(ti, tj);
+        }catch (...){
+            //The waiting threads receive the exception, and the next request computes the tile again
+            Promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(Cache_Mutex);
+            auto found = Cache_Index.find(key);
+            if (found != Cache_Index.end() && found->second == entry){
+                Cache.erase(entry);
+                Cache_Index.erase(found);
+            }
+            throw;
+        }
+        Promise.set_value(New);
+        return New;
+    }
+    double TiledDensity::CreateNormalization(void) const{
+        double total = 0;
+        std::vector<double> Column_Total(Nx-1, 0);
+        std::vector<std::vector<int>> Spans(Tile_Size+1);
+        auto IsInSpans = [](const std::vector<int> &Spans, const int jj){
+            for (int kk = 0; kk+1<Spans.size(); kk+=2){
+                if (jj>=Spans[kk] && jj<=Spans[kk+1]){
+                    return true;
+                }
+            }
+            return false;
+        };
+        //Every column of grid squares is summed in the same order as in Density::CreateIntegralVector, i.e., with increasing jj
+        for (int ti = 0; ti<NTiles_x; ti++){
+            const int i0 = ti*Tile_Size, nx = std::min(Tile_Size, Nx-1-i0);
+            for (int ii = 0; ii<=nx; ii++){
+                Region.Scanline(Point(minx+(i0+ii)*dx, miny), Point(0, dy), Ny, Spans[ii]);
+            }
+            for (int tj = 0; tj<NTiles_y; tj++){
+                std::shared_ptr<const Tile> T = LoadTile(ti, tj);
+                const int ny = T->ny+1;
+                {
+                    std::lock_guard<std::mutex> lock(Cache_Mutex);
+                    Tile_Loads++;
+                }
+                for (int ii = 0; ii<T->nx; ii++){
+                    const double *corner = &T->Values[(size_t) ny*ii];
+                    const int gi = T->i0+ii;
+                    for (int jj = 0; jj<T->ny; jj++){
+                        const int gj = T->j0+jj;
+                        if (!IsInSpans(Spans[ii], gj) || !IsInSpans(Spans[ii], gj+1) || !IsInSpans(Spans[ii+1], gj) || !IsInSpans(Spans[ii+1], gj+1)){
+                            continue;
+                        }
+                        double a = 0, b = 0, c = 0, d = 0, result = 0, resultx = 0, resulty = 0;
+                        Density::BilinearCoefficients(corner[jj], corner[jj+1], corner[ny+jj], corner[ny+jj+1], X[gi], Y[gj], dx, dy, a, b, c, d);
+                        Density::BilinearIntegrals(a, b, c, d, X[gi], X[gi+1], Y[gj], Y[gj+1], dx, dy, result, resultx, resulty);
+                        Column_Total[gi] += result;
+                    }
+                }
+            }
+        }
+        for (int ii = 0; ii<Nx-1; ii++){
+            total += Column_Total[ii];
+        }
+        return total;
+    }
+    double TiledDensity::InterpolateValue(const Point &Test) const{
+        std::shared_ptr<const Tile> T;
+        return InterpolateValue(Test, T);
+    }
+    double TiledDensity::InterpolateValue(const Point &Test, std::shared_ptr<const Tile> &T) const{
+        double u = (Test.x-minx)*Inv_dx, v = (Test.y-miny)*Inv_dy;
+        int i = std::min(std::max((int) u, 0), Nx-2), j = std::min(std::max((int) v, 0), Ny-2);
+        double xr = u-i, ys = v-j;
+        if (!T || i/Tile_Size != T->i0/Tile_Size || j/Tile_Size != T->j0/Tile_Size){
+            T = GetTile(i/Tile_Size, j/Tile_Size);
+        }
+        const int ny = T->ny+1;
+        const double *corner = &T->Values[(size_t) ny*(i-T->i0)+j-T->j0];
+        double val00 = corner[0], val01 = corner[1], val10 = corner[ny], val11 = corner[ny+1];
+        return val00+(val10-val00)*xr+(val01-val00)*ys+(val00+val11-val01-val10)*xr*ys;
+    }
+    double TiledDensity::LineIntegral(double spacing, const Point &p1, const Point &p2) const{
+        if(spacing <= 0 || spacing >1){
+            throw std::runtime_error("Spacing cannot be less than or equal to 0 or greater than 1");
+        }
+        double sum = 0, previous = 0, previous2 = 0;
+        Point Test;
+        //Consecutive samples mostly lie in the same tile, which is only looked up again once the line leaves it
+        std::shared_ptr<const Tile> T;
+        previous = InterpolateValue(p1, T);
+        for (double ii = 0;ii<1-spacing;ii+=spacing){
+            Test.x = p1.x+(p2.x-p1.x)*(ii+spacing);
+            Test.y = p1.y + (p2.y-p1.y)*(ii+spacing);
+            previous2 = InterpolateValue(Test, T);
+            sum += (previous+previous2);
+            previous = previous2;
+        }
+        sum = sum*spacing*Point::Distance(p1,p2)/2;
+        return sum;
+    }
+    void TiledDensity::SweepPolygon(const Poly &Test, double &sum, double &sumx, double &sumy) const{
+        double minx1, maxx1, miny1, maxy1;
+        std::vector<int> Spans, Previous;
+        std::vector<std::shared_ptr<const Tile>> Tiles(NTiles_y);
+        sum = 0;
+        sumx = 0;
+        sumy = 0;
+        Test.GetExtrema(minx1, miny1, maxx1, maxy1);
+        if (maxx1<minx || minx1>maxx || maxy1<miny || miny1>maxy){
+            return;
+        }
+        //Only the grid points in the bounding box of Test can lie inside it, up to the robustness constant
+        const int i0 = std::max(0, (int) floor((minx1-minx)*Inv_dx)-1), i1 = std::min(Nx-1, (int) ceil((maxx1-minx)*Inv_dx)+1);
+        int ti = -1;
+        for (int ii = i0; ii<=i1; ii++){
+            double x0 = minx+ii*dx;
+            Spans.swap(Previous);
+            Spans.clear();
+            if (x0>=minx1 && x0<=maxx1){
+                Test.Scanline(Point(x0, miny), Point(0, dy), Ny, Spans);
+            }
+            if (ii == i0 || Previous.empty() || Spans.empty()){
+                continue;
+            }
+            //The tiles of a column of tiles are held until the sweep moves to the next one
+            if ((ii-1)/Tile_Size != ti){
+                ti = (ii-1)/Tile_Size;
+                std::fill(Tiles.begin(), Tiles.end(), nullptr);
+            }
+            //A grid square is inside Test if its left and right sides are, i.e., on the intersection of the spans of the two columns
+            for (int kk = 0; kk+1<Previous.size(); kk+=2){
+                for (int ll = 0; ll+1<Spans.size(); ll+=2){
+                    const int j0 = std::max(Previous[kk], Spans[ll]), j1 = std::min(Previous[kk+1], Spans[ll+1])-1;
+                    for (int tj = j0/Tile_Size; j0<=j1 && tj<=j1/Tile_Size; tj++){
+                        if (!Tiles[tj]){
+                            Tiles[tj] = GetTile(ti, tj);
+                        }
+                        const Tile &T = *Tiles[tj];
+                        const size_t index = (size_t) (T.ny+1)*(ii-1-T.i0);
+                        const int first = std::max(j0, T.j0)-T.j0, last = std::min(j1, T.j0+T.ny-1)-T.j0;
+                        sum += T.Int_Prefix[index+last+1]-T.Int_Prefix[index+first];
+                        sumx += T.Intx_Prefix[index+last+1]-T.Intx_Prefix[index+first];
+                        sumy += T.Inty_Prefix[index+last+1]-T.Inty_Prefix[index+first];
+                    }
+                }
+            }
+        }
+    }
+    double TiledDensity::CalculateWeightedArea(const Poly &Test) const{
+        double Volume = 0;
+        Point Centroid;
+        CalculateVolumeAndCentroid(Test, Volume, Centroid);
+        return Volume;
+    }
+    Point TiledDensity::CalculateCentroid(const Poly &Test, const double &Volume) const{
+        double sum = 0, sumx = 0, sumy = 0;
+        double minx1,maxx1,miny1,maxy1;
+        if (Test.GetNVertices() == 0){
+            return Point();
+        }
+        SweepPolygon(Test, sum, sumx, sumy);
+        if (Volume<=Volume_Lower_Bound){
+            Test.GetExtrema(minx1, miny1, maxx1, maxy1);
+            return Point(minx1,miny1);
+        }
+        return Point(sumx/Volume, sumy/Volume);
+    }
+    void TiledDensity::CalculateVolumeAndCentroid(const Poly &Test, double &Volume, Point &Centroid) const{
+        double sum = 0, sumx = 0, sumy = 0;
+        double minx1,maxx1,miny1,maxy1;
+        if (Test.GetNVertices() == 0){
+            Volume = Volume_Lower_Bound;
+            Centroid = Point();
+            return;
+        }
+        SweepPolygon(Test, sum, sumx, sumy);
+        Volume = (sum>=Volume_Lower_Bound) ? sum : Volume_Lower_Bound;
+        if (Volume<=Volume_Lower_Bound){
+            Test.GetExtrema(minx1, miny1, maxx1, maxy1);
+            Centroid = Point(minx1,miny1);
+        }else{
+            Centroid = Point(sumx/Volume, sumy/Volume);
+        }
+    }
+
+    // PartitionStats Class---------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    PartitionStats::PartitionStats(void):total_time(0), diagram_time(0), clean_covering_time(0), adjacency_time(0), volumes_time(0), weights_time(0), centers_time(0), diagram_calls(0), diagram_retries(0), incremental_updates(0), bisector_clips(0), volume_calls(0), weight_steps(0), center_steps(0), line_integrals(0), line_search_steps(0){}
+    // IterationSink Class----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    IterationSink::IterationSink(const int interval):Interval(interval){
+        if (interval<0){
+            throw std::runtime_error("interval must be greater than or equal to 0");
+        }
+    }
+    void IterationSink::Record(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering){
+        if (final || (Interval>0 && iteration%Interval == 0)){
+            Write(iteration, final, Centers, Weights, Covering);
+        }
+    }
+    // CSVIterationSink Class-------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    CSVIterationSink::CSVIterationSink(const std::string filename_partition, const std::string filename_centers, const int interval):IterationSink(interval){
+        File_Partition.open(filename_partition);
+        File_Centers.open(filename_centers);
+        if (!File_Partition.is_open() || !File_Centers.is_open()){
+            throw std::runtime_error("Output files could not be opened");
+        }
+    }
+    void CSVIterationSink::Flush(void){
+        File_Partition.flush();
+        File_Centers.flush();
+    }
+    void CSVIterationSink::Write(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering){
+        for (int ii = 0; ii<Centers.size(); ii++){
+            File_Centers<<Centers[ii].x<<","<<Centers[ii].y<<'\n';
+            const std::vector<Point> &Vert = Covering[ii].GetVertices();
+            for (int jj = 0; jj<Vert.size(); jj++){
+                File_Partition<<Vert[jj].x<<","<<Vert[jj].y<<" ";
+            }
+            File_Partition<<'\n';
+        }
+        File_Centers<<'\n';
+        File_Partition<<'\n';
+    }
+    // BinaryIterationSink Class----------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    BinaryIterationSink::BinaryIterationSink(const std::string filename, const int interval, const size_t buffer_size):IterationSink(interval), Buffer_Size(std::max(buffer_size, (size_t) 1)), NRegions(-1){
+        File.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!File.is_open()){
+            throw std::runtime_error("Output file could not be opened");
+        }
+        Buffer.reserve(Buffer_Size);
+    }
+    BinaryIterationSink::~BinaryIterationSink(void){
+        Flush();
+    }
+    void BinaryIterationSink::Flush(void){
+        if (!Buffer.empty()){
+            File.write(Buffer.data(), Buffer.size());
+            Buffer.clear();
+        }
+        File.flush();
+    }
+    void BinaryIterationSink::Append(const void *data, const size_t size){
+        const char *bytes = static_cast<const char*>(data);
+        Buffer.insert(Buffer.end(), bytes, bytes+size);
+        if (Buffer.size()>=Buffer_Size){
+            File.write(Buffer.data(), Buffer.size());
+            Buffer.clear();
+        }
+    }
+    void BinaryIterationSink::Write(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering){
+        std::int32_t header[3] = {iteration, final, 0}, count = 0;
+        double values[3];
+        if (NRegions<0){
+            NRegions = (int) Centers.size();
+            std::int32_t N = NRegions;
+            Append("ACTRAJ01", 8);
+            Append(&N, sizeof(N));
+        }else if (NRegions != Centers.size()){
+            throw std::runtime_error("The number of regions cannot change within a trajectory");
+        }
+        for (int ii = 0; ii<NRegions; ii++){
+            header[2] += Covering[ii].GetNVertices();
+        }
+        Append(header, sizeof(header));
+        for (int ii = 0; ii<NRegions; ii++){
+            values[0] = Centers[ii].x;
+            values[1] = Centers[ii].y;
+            values[2] = Weights[ii];
+            Append(values, sizeof(values));
+        }
+        for (int ii = 0; ii<NRegions; ii++){
+            count = Covering[ii].GetNVertices();
+            Append(&count, sizeof(count));
+        }
+        for (int ii = 0; ii<NRegions; ii++){
+            const std::vector<Point> &Vert = Covering[ii].GetVertices();
+            for (int jj = 0; jj<Vert.size(); jj++){
+                values[0] = Vert[jj].x;
+                values[1] = Vert[jj].y;
+                Append(values, 2*sizeof(double));
+            }
+        }
+    }
     // Partition Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
-    Partition::Partition(int NRegions, Density Prior, std::vector<double> desired_area, Parameters Alg_Params):NRegions(NRegions), Prior(Prior), desired_area(desired_area), Alg_Params(Alg_Params){Point::Robustness_Constant = Alg_Params.Robustness_Constant; CheckParams();}
-    void Partition::SetPartitionVariables(int NRegions, Density Prior, std::vector<double> desired_area){this->NRegions = NRegions;this->Prior = Prior;this->desired_area = desired_area;CheckParams();}
+    Partition::Partition(int NRegions, Density Prior, std::vector<double> desired_area, Parameters Alg_Params):NRegions(NRegions), Prior(std::move(Prior)), desired_area(std::move(desired_area)), Alg_Params(Alg_Params){if (Alg_Params.num_threads != 1){Pool = std::make_shared<ThreadPool>(Alg_Params.num_threads);} CheckParams();}
+    Partition::Partition(int NRegions, std::shared_ptr<DensityFunction> Prior, std::vector<double> desired_area, Parameters Alg_Params):NRegions(NRegions), Shared_Prior(std::move(Prior)), desired_area(std::move(desired_area)), Alg_Params(Alg_Params){if (Alg_Params.num_threads != 1){Pool = std::make_shared<ThreadPool>(Alg_Params.num_threads);} CheckParams();}
+    void Partition::SetPartitionVariables(int NRegions, Density Prior, std::vector<double> desired_area){this->NRegions = NRegions;this->Prior = std::move(Prior);Shared_Prior.reset();this->desired_area = std::move(desired_area);CheckParams();}
+    void Partition::SetPartitionVariables(int NRegions, std::shared_ptr<DensityFunction> Prior, std::vector<double> desired_area){this->NRegions = NRegions;this->Prior = Density();Shared_Prior = std::move(Prior);this->desired_area = std::move(desired_area);CheckParams();}
+    void Partition::UpdateDensity(const int i0, const int j0, const int i1, const int j1, const std::vector<double> &Block){
+        if (Shared_Prior){
+            throw std::runtime_error("The values of a shared prior cannot be updated by the partition");
+        }
+        RobustnessScope Scope(Alg_Params.Robustness_Constant);
+        Prior.UpdateValues(i0, j0, i1, j1, Block);
+    }
+    void Partition::UpdateDensity(const std::vector<double> &Values){
+        if (Shared_Prior){
+            throw std::runtime_error("The values of a shared prior cannot be updated by the partition");
+        }
+        RobustnessScope Scope(Alg_Params.Robustness_Constant);
+        Prior.UpdateValues(Values);
+    }
     
     void Partition::CheckParams(){
-        Prior.SetVolumeLowerBound(Alg_Params.Volume_Lower_Bound);
+        if (Shared_Prior){
+            //Only the DensityFunction interface is available for a shared prior
+            if (Alg_Params.integration_method != Per_Region || Alg_Params.exact_integration || Alg_Params.exact_line_integral || Alg_Params.pyramid_levels>1){
+                throw std::runtime_error("A shared prior requires integration_method Per_Region, without exact_integration, exact_line_integral or pyramid_levels");
+            }
+            Shared_Prior->SetVolumeLowerBound(Alg_Params.Volume_Lower_Bound);
+        }else{
+            Prior.SetVolumeLowerBound(Alg_Params.Volume_Lower_Bound);
+            Prior.SetExactIntegration(Alg_Params.exact_integration);
+        }
         double sum = 0;
         if (NRegions!=0 && desired_area.empty()){
             if (Alg_Params.Volume_Lower_Bound<=1.0/NRegions){
@@ -679,7 +2492,9 @@ namespace AreaCon {
                 }
             }
             if (sum!=1){
-                std::cout<<"Warning: desired_areas not normalized; will be normalized automatically"<<std::endl;
+                if (Alg_Params.verbosity>=1){
+                    std::cout<<"Warning: desired_areas not normalized; will be normalized automatically"<<std::endl;
+                }
                 for (int ii = 0; ii<NRegions; ii++){
                     desired_area[ii]/=sum;
                     if (desired_area[ii]<Alg_Params.Volume_Lower_Bound){
@@ -691,9 +2506,9 @@ namespace AreaCon {
         }
         
     }
-    bool Partition::CreateDefaultCenters(const Poly Region, const double multiplier){
+    bool Partition::CreateDefaultCenters(const Poly &Region, const double multiplier){
         Centers.clear();
-        std::vector<Point> Vertices = Region.GetVertices();
+        const std::vector<Point> &Vertices = Region.GetVertices();
         Point p1(Vertices[0]), p2(Vertices[1]), perp = Point::FindPerpDirection(p1, p2, multiplier);
         double spacing = 1.0/(NRegions+1);
         if (!Region.pnpoly(Point::FindPointAlongLine(p1, p2, 0.5).AddPoint(perp))){
@@ -708,7 +2523,7 @@ namespace AreaCon {
         return true;
         
     }
-    void Partition::CreateDefaultCenters(const Poly Region, const double initial_multiplier, const int max_steps){
+    void Partition::CreateDefaultCenters(const Poly &Region, const double initial_multiplier, const int max_steps){
         double multiplier = initial_multiplier;
         for (int ii = 0;ii<max_steps+1;ii++){
             if (CreateDefaultCenters(Region, multiplier)){
@@ -722,217 +2537,469 @@ namespace AreaCon {
             }
         }
     }
-    void Partition::InitializePartition(std::vector<Point> Centers, std::vector<double> Weights){
-        Poly Region = Prior.GetRegion();
-        std::vector<Poly> temp(NRegions);
-        
-        if (NRegions!=0 && Centers.empty()){
-            int max_steps = 10;
-            double initial_multiplier = 10e-3;
-            CreateDefaultCenters(Region, initial_multiplier, max_steps);
-        }else if(Centers.size() != NRegions){
-            throw std::runtime_error("Centers must be the same size as NRegions!");
-        }else{
-            for(std::vector<Point>::iterator it = Centers.begin(); it!=Centers.end(); it++){
-                if (!Region.pnpoly(*it)){
-                    throw std::runtime_error("Centers must be located inside the region of interest");
+    void Partition::InitializePartition(std::vector<Point> Centers, std::vector<double> Weights){
+        RobustnessScope Scope(Alg_Params.Robustness_Constant);
+        const Poly &Region = GetPrior().GetRegion();
+        std::vector<Poly> temp(NRegions);
+        
+        if (NRegions!=0 && Region.GetNVertices() == 0){
+            throw std::runtime_error("Prior has not been initialized");
+        }else if (NRegions!=0 && Centers.empty()){
+            int max_steps = 10;
+            double initial_multiplier = 10e-3;
+            CreateDefaultCenters(Region, initial_multiplier, max_steps);
+        }else if(Centers.size() != NRegions){
+            throw std::runtime_error("Centers must be the same size as NRegions!");
+        }else{
+            for(std::vector<Point>::iterator it = Centers.begin(); it!=Centers.end(); it++){
+                if (!Region.pnpoly(*it)){
+                    throw std::runtime_error("Centers must be located inside the region of interest");
+                }
+            }
+            this->Centers = std::move(Centers);
+        }
+        
+        if (NRegions!=0 && Weights.empty()){
+            
+            for (int ii = 0; ii<NRegions;ii++){
+                this->Weights.push_back(0);
+            }
+        }else if (Weights.size()!= NRegions){
+            throw std::runtime_error("Weights must be the same size as NRegions");
+        }else{
+            this->Weights = std::move(Weights);
+        }
+        Covering = std::move(temp);
+    }
+    bool Partition::CreatePowerDiagram(void){
+        ScopedTimer Timer(Stats.diagram_time);
+        bool success = false;
+        Stats.diagram_calls++;
+        Centroids.clear();
+        if (Alg_Params.diagram_method == Nearest_Neighbors){
+            if (Alg_Params.incremental_diagram && UpdatePowerDiagram()){
+                Stats.incremental_updates++;
+                return true;
+            }
+            success = CreatePowerDiagramNeighbors();
+        }else{
+            Diagram_Centers.clear();
+            success = CreatePowerDiagramAllPairs();
+        }
+        if (!success){
+            Stats.diagram_retries++;
+        }
+        return success;
+    }
+    void Partition::CollectClipCalls(std::vector<CellWorkspace> &Work){
+        for (int ww = 0; ww<Work.size(); ww++){
+            Stats.bisector_clips += Work[ww].Clip_Calls;
+            Work[ww].Clip_Calls = 0;
+        }
+    }
+    bool Partition::CreatePowerDiagramAllPairs(void){
+        const Poly &Region = GetPrior().GetRegion();
+        int NPoly = Region.GetNVertices();
+        const std::vector<Point> &Vertices = Region.GetVertices();
+        long int mult = (int) 1/Alg_Params.Robustness_Constant;
+        ClipperLib::Paths subj, temp2(1);
+        std::vector<ClipperLib::Clipper> c(GetNWorkers());
+        std::vector<int> success(NRegions, 1);
+        std::vector<long> clip_calls(NRegions, 0);
+        //Convert the base region into a format sutible for clipping
+        for (int ii = 0;ii<NPoly;++ii){
+            temp2[0].push_back(ClipperLib::IntPoint((long int)(Vertices[ii].x*mult),(long int)(Vertices[ii].y*mult)));
+        }
+        subj.push_back(temp2[0]);
+        
+        ParallelFor(NRegions, [&](const int ii, const int worker){success[ii] = CreateCellAllPairs(ii, subj, mult, c[worker], clip_calls[ii]);});
+        for (int ii = 0; ii<NRegions; ii++){
+            Stats.bisector_clips += clip_calls[ii];
+        }
+        //Centers are only perturbed once all threads are done. Perturbing the first failed region matches the serial order of construction.
+        for (int ii = 0; ii<NRegions; ii++){
+            if (!success[ii]){
+                PerturbCenter(ii);
+                return false;
+            }
+        }
+        CleanCovering((double) 1.0/mult, mult);
+        Cell_Neighbors.resize(NRegions);
+        Edge_Labels.resize(NRegions);
+        ParallelFor(NRegions, [&](const int ii, const int worker){LabelEdges(ii, Edge_Labels[ii]); ExtractNeighbors(Edge_Labels[ii], Cell_Neighbors[ii]);});
+        CreateSharedEdges();
+        return true;
+        
+    }
+    bool Partition::CreateCellAllPairs(const int ii, const ClipperLib::Paths &subj, const long int mult, ClipperLib::Clipper &c, long &clip_calls){
+        std::vector <Point> temp;
+        ClipperLib::Paths solution = subj;
+        clip_calls = 0;
+        for (int jj = 0; jj<NRegions;++jj){
+            if (jj == ii){
+            }else{
+                clip_calls++;
+                if (!ClipToPowerBisector(ii, jj, mult, solution, c)){
+                    return false;
+                }
+                if (solution.empty()){
+                    break;
+                }
+            }
+            
+        }
+        //Convert solution to a Poly structure
+        if (!solution.empty()){
+            for (int pp = 0; pp<solution[0].size();++pp){
+                temp.push_back(Point((double) solution[0][pp].X/(double)mult,(double) solution[0][pp].Y/(double)mult));
+            }
+        }
+        Covering[ii] = Poly(temp);
+        return true;
+    }
+    bool Partition::CreatePowerDiagramNeighbors(void){
+        double minx, maxx,miny, maxy = 0, weight_max = -INFINITY;
+        GetPrior().GetExtrema(minx, miny, maxx, maxy);
+        std::vector<CellWorkspace> &Work = Workspace.Cells;
+        std::vector<int> success(NRegions, 1);
+        for (int ii = 0; ii<NRegions; ii++){
+            weight_max = std::max(weight_max, Weights[ii]);
+        }
+        Work.resize(GetNWorkers());
+        CenterGrid Grid(Centers, minx, miny, maxx, maxy);
+        Cell_Neighbors.resize(NRegions);
+        Edge_Labels.resize(NRegions);
+        Diagram_Centers.clear();
+        
+        ParallelFor(NRegions, [&](const int ii, const int worker){success[ii] = CreateCellNeighbors(ii, Grid, weight_max, Work[worker], Cell_Neighbors[ii]);});
+        CollectClipCalls(Work);
+        for (int ii = 0; ii<NRegions; ii++){
+            if (!success[ii]){
+                PerturbCenter(ii);
+                return false;
+            }
+        }
+        Diagram_Centers = Centers;
+        CreateSharedEdges();
+        return true;
+    }
+    bool Partition::CreateCellNeighbors(const int ii, const CenterGrid &Grid, const double weight_max, CellWorkspace &Work, std::vector<int> &Neighbors){
+        int NVert = 0, ring = 0, max_ring = Grid.GetMaxRing();
+        double radius = 0, lower_bound = 0, h = Grid.GetBucketSize();
+        bool done = false, clipped = false;
+        std::vector<Point> &temp = Work.Vertices;
+        temp = GetPrior().GetRegion().GetVertices();
+        NVert = (int) temp.size();
+        Work.Labels.assign(NVert, -1);
+        for (ring = 0; ring<=max_ring && !done; ring++){
+            //Every center that has not been visited lies at least lower_bound away from Centers[ii]. Stop once none of them can reach into the current region.
+            radius = 0;
+            for (int kk = 0; kk<NVert; kk++){
+                radius = std::max(radius, Point::Distance(Centers[ii], temp[kk]));
+            }
+            lower_bound = (ring-1)*h;
+            if (ring>0 && lower_bound>=radius && (lower_bound-radius)*(lower_bound-radius)-weight_max >= radius*radius-Weights[ii]){
+                break;
+            }
+            Work.Candidates.clear();
+            Grid.GetRing(ii, ring, Work.Candidates);
+            for (int qq = 0; qq<Work.Candidates.size(); qq++){
+                int jj = Work.Candidates[qq];
+                if (jj == ii){
+                    continue;
+                }
+                if (!ClipCellToBisector(ii, jj, Work, clipped)){
+                    return false;
+                }else if (!clipped){
+                    continue;
+                }
+                NVert = (int) temp.size();
+                if (NVert<3){
+                    done = true;
+                    break;
+                }
+            }
+        }
+        if (NVert<3){
+            temp.clear();
+            Work.Labels.clear();
+        }
+        ExtractNeighbors(Work.Labels, Neighbors);
+        Edge_Labels[ii] = Work.Labels;
+        Covering[ii] = Poly(temp);
+        return true;
+    }
+    bool Partition::ClipCellToBisector(const int ii, const int jj, CellWorkspace &Work, bool &clipped) const{
+        Work.Clip_Calls++;
+        std::vector<Point> &temp = Work.Vertices;
+        int NVert = (int) temp.size();
+        double tolerance = Alg_Params.Robustness_Constant, value = 0, min_value = INFINITY, max_value = -INFINITY, norm = 0;
+        HalfPlane Bisector = HalfPlane::PowerBisector(Centers[ii], Weights[ii], Centers[jj], Weights[jj]);
+        clipped = false;
+        norm = Bisector.Normal.Norm();
+        if (norm == 0){
+            return false;
+        }
+        //Checking the vertices determines which side of the bisector the (convex) region lies on
+        for (int kk = 0; kk<NVert; kk++){
+            value = Bisector.Evaluate(temp[kk])/norm;
+            min_value = std::min(min_value, value);
+            max_value = std::max(max_value, value);
+        }
+        if (max_value<=tolerance){
+            return true;
+        }else if (min_value>tolerance){
+            temp.clear();
+            Work.Labels.clear();
+        }else{
+            Poly::ClipToHalfPlane(Bisector, tolerance, temp, Work.Buffer, &Work.Labels, &Work.LabelBuffer, jj);
+        }
+        clipped = true;
+        return true;
+    }
+    void Partition::ExtractNeighbors(const std::vector<int> &Labels, std::vector<int> &Neighbors) const{
+        Neighbors.clear();
+        for (int kk = 0; kk<Labels.size(); kk++){
+            if (Labels[kk]>=0 && std::find(Neighbors.begin(), Neighbors.end(), Labels[kk]) == Neighbors.end()){
+                Neighbors.push_back(Labels[kk]);
+            }
+        }
+    }
+    void Partition::LabelEdges(const int ii, std::vector<int> &Labels) const{
+        const std::vector<Point> &Vertices = Covering[ii].GetVertices();
+        int NVert = (int) Vertices.size(), best = -1;
+        double tolerance = 100*Alg_Params.Robustness_Constant, value = 0, best_value = INFINITY;
+        Point p;
+        HalfPlane Bisector;
+        Labels.assign(NVert, -1);
+        for (int kk = 0; kk<NVert; kk++){
+            p = Point((Vertices[kk].x+Vertices[(kk+1)%NVert].x)/2, (Vertices[kk].y+Vertices[(kk+1)%NVert].y)/2);
+            best = -1;
+            best_value = INFINITY;
+            for (int jj = 0; jj<NRegions; jj++){
+                value = (p.x-Centers[jj].x)*(p.x-Centers[jj].x)+(p.y-Centers[jj].y)*(p.y-Centers[jj].y)-Weights[jj];
+                if (jj != ii && value<best_value){
+                    best = jj;
+                    best_value = value;
+                }
+            }
+            if (best<0){
+                continue;
+            }
+            Bisector = HalfPlane::PowerBisector(Centers[ii], Weights[ii], Centers[best], Weights[best]);
+            if (std::abs(Bisector.Evaluate(p))<=tolerance*Bisector.Normal.Norm()){
+                Labels[kk] = best;
+            }
+        }
+    }
+    void Partition::CreateSharedEdges(void){
+        ScopedTimer Timer(Stats.adjacency_time);
+        int NVert = 0, jj = 0;
+        Adjacency.Clear(NRegions);
+        for (int ii = 0; ii<NRegions; ii++){
+            const std::vector<int> &Labels = Edge_Labels[ii];
+            const std::vector<Point> &Vertices = Covering[ii].GetVertices();
+            NVert = (int) Vertices.size();
+            for (int kk = 0; kk<Labels.size() && kk<NVert; kk++){
+                jj = Labels[kk];
+                //Every edge is collected once, from the region with the smaller index unless that region does not see it (which can happen for edges of negligible length)
+                if (jj<0 || (jj<ii && std::find(Edge_Labels[jj].begin(), Edge_Labels[jj].end(), ii) != Edge_Labels[jj].end())){
+                    continue;
+                }
+                Adjacency.AddEdge(jj, Vertices[kk], Vertices[(kk+1)%NVert]);
+            }
+            Adjacency.EndRow();
+        }
+    }
+    bool Partition::UpdatePowerDiagram(void){
+        if (NRegions<2 || Diagram_Centers.size() != NRegions || Cell_Neighbors.size() != NRegions || Covering.size() != NRegions){
+            return false;
+        }
+        for (int ii = 0; ii<NRegions; ii++){
+            if (Diagram_Centers[ii].x != Centers[ii].x || Diagram_Centers[ii].y != Centers[ii].y){
+                return false;
+            }
+        }
+        double minx, maxx, miny, maxy, weight_max = -INFINITY, area = 0, region_area = GetPrior().GetRegion().GetArea();
+        std::vector<CellWorkspace> &Work = Workspace.Cells;
+        std::vector<int> success(NRegions, 1), Failed;
+        std::vector<char> Rebuilt(NRegions, 0);
+        std::shared_ptr<CenterGrid> Grid;
+        Work.resize(GetNWorkers());
+        Updated_Neighbors.resize(NRegions);
+        
+        ParallelFor(NRegions, [&](const int ii, const int worker){success[ii] = UpdateCellNeighbors(ii, Updated_Neighbors[ii], Work[worker]);});
+        CollectClipCalls(Work);
+        for (int ii = 0; ii<NRegions; ii++){
+            if (!success[ii]){
+                Failed.push_back(ii);
+            }
+        }
+        //Regions whose topology has changed are rebuilt with a full neighbor search. The neighbors of the rebuilt regions are then checked for consistency (adjacency is symmetric), which may require further regions to be rebuilt.
+        while (!Failed.empty()){
+            if (!Grid){
+                GetPrior().GetExtrema(minx, miny, maxx, maxy);
+                for (int ii = 0; ii<NRegions; ii++){
+                    weight_max = std::max(weight_max, Weights[ii]);
+                }
+                Grid = std::make_shared<CenterGrid>(Centers, minx, miny, maxx, maxy);
+            }
+            ParallelFor((int) Failed.size(), [&](const int qq, const int worker){success[Failed[qq]] = CreateCellNeighbors(Failed[qq], *Grid, weight_max, Work[worker], Updated_Neighbors[Failed[qq]]);});
+            CollectClipCalls(Work);
+            for (int qq = 0; qq<Failed.size(); qq++){
+                if (!success[Failed[qq]]){
+                    return false;
+                }
+                Rebuilt[Failed[qq]] = 1;
+            }
+            Failed.clear();
+            for (int ii = 0; ii<NRegions; ii++){
+                for (int qq = 0; qq<Updated_Neighbors[ii].size(); qq++){
+                    int jj = Updated_Neighbors[ii][qq];
+                    if (std::find(Updated_Neighbors[jj].begin(), Updated_Neighbors[jj].end(), ii) == Updated_Neighbors[jj].end()){
+                        if (!Rebuilt[ii]){
+                            Failed.push_back(ii);
+                        }
+                        if (!Rebuilt[jj]){
+                            Failed.push_back(jj);
+                        }
+                    }
+                }
+            }
+            std::sort(Failed.begin(), Failed.end());
+            Failed.erase(std::unique(Failed.begin(), Failed.end()), Failed.end());
+        }
+        for (int ii = 0; ii<NRegions; ii++){
+            area += Covering[ii].GetArea();
+        }
+        //Every updated region contains the true region, so the updated regions overlap unless they tile the region of interest
+        if (area-region_area>Alg_Params.Robustness_Constant*region_area){
+            return false;
+        }
+        Cell_Neighbors.swap(Updated_Neighbors);
+        CreateSharedEdges();
+        return true;
+    }
+    bool Partition::UpdateCellNeighbors(const int ii, std::vector<int> &Neighbors, CellWorkspace &Work){
+        double tolerance = Alg_Params.Robustness_Constant, norm = 0;
+        bool clipped = false;
+        HalfPlane Bisector;
+        const std::vector<int> &Previous = Cell_Neighbors[ii];
+        std::vector<Point> &temp = Work.Vertices;
+        std::vector<int> &Ring = Work.Candidates;
+        //Empty regions have no neighbors that could be used to bring them back
+        if (Covering[ii].GetNVertices() == 0){
+            return false;
+        }
+        temp = GetPrior().GetRegion().GetVertices();
+        Work.Labels.assign(temp.size(), -1);
+        for (int qq = 0; qq<Previous.size(); qq++){
+            if (!ClipCellToBisector(ii, Previous[qq], Work, clipped)){
+                return false;
+            }
+            if (temp.size()<3){
+                return false;
+            }
+        }
+        //A change of topology brings in a new neighbor, which is a neighbor of one of the previous neighbors
+        Ring.clear();
+        for (int qq = 0; qq<Previous.size(); qq++){
+            const std::vector<int> &Next = Cell_Neighbors[Previous[qq]];
+            for (int rr = 0; rr<Next.size(); rr++){
+                if (Next[rr] != ii && std::find(Previous.begin(), Previous.end(), Next[rr]) == Previous.end()){
+                    Ring.push_back(Next[rr]);
                 }
             }
-            this->Centers = Centers;
         }
-        
-        if (NRegions!=0 && Weights.empty()){
-            
-            for (int ii = 0; ii<NRegions;ii++){
-                this->Weights.push_back(0);
+        std::sort(Ring.begin(), Ring.end());
+        Ring.erase(std::unique(Ring.begin(), Ring.end()), Ring.end());
+        for (int qq = 0; qq<Ring.size(); qq++){
+            Bisector = HalfPlane::PowerBisector(Centers[ii], Weights[ii], Centers[Ring[qq]], Weights[Ring[qq]]);
+            norm = Bisector.Normal.Norm();
+            if (norm == 0){
+                return false;
+            }
+            for (int kk = 0; kk<temp.size(); kk++){
+                if (Bisector.Evaluate(temp[kk])>tolerance*norm){
+                    return false;
+                }
             }
-        }else if (Weights.size()!= NRegions){
-            throw std::runtime_error("Weights must be the same size as NRegions");
-        }else{
-            this->Weights = Weights;
         }
-        Covering = temp;
+        ExtractNeighbors(Work.Labels, Neighbors);
+        Edge_Labels[ii] = Work.Labels;
+        Covering[ii] = Poly(temp);
+        return true;
     }
-    bool Partition::CreatePowerDiagram(void){
+    bool Partition::ClipToPowerBisector(const int ii, const int jj, const long int mult, ClipperLib::Paths &solution, ClipperLib::Clipper &c){
         double minx, maxx,miny, maxy = 0;
-        Prior.GetExtrema(minx, miny, maxx, maxy);
-        Poly Region = Prior.GetRegion();
-        int NPoly = Region.GetNVertices(), count = 0;
-        std::vector<Point> Vertices = Region.GetVertices();
-        Point Test, p1, p2, p3, p4, p5, p6;
-        double value1,previousvalue1 = 0, value2,previousvalue2 = 0, error, distance = 0;
-        double tolerance = Alg_Params.Robustness_Constant, testvalue;
-        long double increment;
-        bool flag2 = false, whichpoly = false;
-        long int mult = (int) 1/Alg_Params.Robustness_Constant;
-        std::vector <Point> temp;
-        Poly temp1;
-        ClipperLib::Paths subj, clip(1), solution, temp2(1);
-        ClipperLib::Clipper c;
-        //Convert the base region into a format sutible for clipping
-        for (int ii = 0;ii<NPoly;++ii){
-            temp2[0].push_back(ClipperLib::IntPoint((long int)(Vertices[ii].x*mult),(long int)(Vertices[ii].y*mult)));
+        GetPrior().GetExtrema(minx, miny, maxx, maxy);
+        std::vector<Point> temp;
+        ClipperLib::Paths clip(1);
+        
+        if (solution.empty()){
+            return true;
+        }
+        HalfPlane Bisector = HalfPlane::PowerBisector(Centers[ii], Weights[ii], Centers[jj], Weights[jj]);
+        //Coincident centers have no bisector, so one of them has to be perturbed
+        if (Bisector.Normal.x == 0 && Bisector.Normal.y == 0){
+            return false;
+        }
+        //Construct a polygon for clipping by cutting a box slightly larger than the region with the bisector
+        temp = Bisector.ClipBox(minx-1, miny-1, maxx+1, maxy+1);
+        if (temp.size()<3){
+            solution.clear();
+            return true;
+        }else if (temp.size() == 4 && Bisector.Contains(Point(minx-1,miny-1)) && Bisector.Contains(Point(maxx+1,maxy+1)) && Bisector.Contains(Point(minx-1,maxy+1)) && Bisector.Contains(Point(maxx+1,miny-1))){
+            return true;
+        }
+        for (int kk = 0; kk<temp.size(); kk++){
+            clip[0]<<ClipperLib::IntPoint((long int)(temp[kk].x*mult),(long int)(temp[kk].y*mult));
         }
-        subj.push_back(temp2[0]);
         
-        for (int ii = 0; ii<NRegions;++ii){
-            solution = subj;
-            for (int jj = 0; jj<NRegions;++jj){
-                if (jj == ii){
-                }else{
-                    count = 0;
-                    clip[0].clear();
-                    value1 = 0;
-                    testvalue = 0.50;
-                    increment = 1;
-                    flag2 = false;
-                    error = INFINITY;
-                    while (count<100){
-                        Test = Point::FindPointAlongLine(Centers[ii], Centers[jj], testvalue);
-                        value1 = pow(Point::Distance(Centers[ii], Test),2) - Weights[ii];
-                        value2 = pow(Point::Distance(Centers[jj], Test),2) - Weights[jj];
-                        if (!flag2){
-                            error = std::abs(value2-value1);
-                            flag2 = true;
-                            if (error<tolerance){
-                                break;
-                            }
-                            previousvalue1 =value1;
-                            previousvalue2 = value2;
-                            if (value1>value2){
-                                testvalue -=increment;
-                            }else{
-                                testvalue += increment;
-                            }
-                        }else{
-                            error = std::abs(value2-value1);
-                            if (error<tolerance){
-                                break;
-                            }
-                            if ((value2>value1)&& (previousvalue2> previousvalue1)){
-                                testvalue +=increment;
-                                previousvalue1 = value1;
-                                previousvalue2 = value2;
-                            }else if ((value1>value2)&& (previousvalue1>previousvalue2)){
-                                testvalue -=increment;
-                                previousvalue1 = value1;
-                                previousvalue2 = value2;
-                            }else if (value2>value1 && previousvalue1>previousvalue2){
-                                increment /= 2;
-                                testvalue += increment;
-                            }else {
-                                increment /= 2;
-                                testvalue -= increment;
-                            }
-                            count++;
-                            
-                        }
-                    }
-                    //Split the polygon into two sections
-                    increment = 1;
-                    count = 0;
-                    distance = Point::Distance(Test, Centers[ii]);
-                    while (distance == 0){
-                        p1 = Centers[ii].AddPoint(Point(0,100*Alg_Params.Robustness_Constant));
-                        if(!Prior.GetRegion().pnpoly(p1)){
-                            p1 = Centers[ii].AddPoint(Point(100,-2*Alg_Params.Robustness_Constant));
-                            if(!Prior.GetRegion().pnpoly(p1)){
-                                p1 = Centers[ii].AddPoint(Point(100*Alg_Params.Robustness_Constant,0));
-                                if(!Prior.GetRegion().pnpoly(p1)){
-                                    p1 = Centers[ii].AddPoint(Point(-100*Alg_Params.Robustness_Constant,0));
-                                    if(!Prior.GetRegion().pnpoly(p1)){
-                                        throw std::runtime_error("Error: Try decreasing Parameters::weights_step");
-                                    }
-                                }
-                            }
-                        }
-                        Centers[ii] = p1;
-                        std::cout<<"Warning:May be numerically unstable. Suggest using smaller stepsizes or a finer grid."<<std::endl;
-                        return false;
-                    }
-                    while (true){
-                        
-                        p1 = Test.AddPoint(Point::FindPerpDirection(Test, Centers[ii], distance*increment));
-                        p2 =Test.AddPoint(Point::FindPerpDirection(Test, Centers[ii], distance*-increment));
-                        if ((p1.x<minx && p2.x>maxx)||(p1.x>maxx && p2.x<minx)){
-                            p3.x = p1.x;
-                            p4.x = p2.x;
-                            p5.x = p2.x;
-                            p6.x = p1.x;
-                            p3.y = std::min(miny,p1.y);
-                            p3.y = std::min(p3.y,p2.y)-1;
-                            p5.y = std::max(maxy,p1.y);
-                            p5.y = std::max(p5.y,p2.y)+1;
-                            p4.y = p3.y;
-                            p6.y = p5.y;
-                            break;
-                        }else if ((p1.y<miny && p2.y>maxy)||(p1.y>maxy && p2.y<miny)){
-                            p3.y = p1.y;
-                            p4.y = p2.y;
-                            p5.y = p2.y;
-                            p6.y = p1.y;
-                            p3.x = std::min(minx,p1.x);
-                            p3.x = std::min(p3.x,p2.x)-1;
-                            p5.x = std::max(maxx,p1.x);
-                            p5.x = std::max(p5.x,p2.x)+1;
-                            p4.x = p3.x;
-                            p6.x = p5.x;
-                            break;
-                        }else {
-                            increment = increment*2;
-                        }
-                        if (count >100){
-                            increment = increment * 500;
-                        }
-                        count++;
-                    }
-                    //Test to see which polygon is of relevance
-                    temp = {p3, p4, p2, p1};
-                    temp1.SetVertices(temp, false);
-                    whichpoly = temp1.pnpoly(Centers[ii]);
-                    if (whichpoly && (-Weights[ii]>pow(Point::Distance(Centers[ii],Centers[jj]),2)-Weights[jj])){
-                        whichpoly = false;
-                    }else if(!whichpoly && (-Weights[ii]>pow(Point::Distance(Centers[ii],Centers[jj]),2)-Weights[jj])){
-                        whichpoly = true;
-                    }
-                    //Construct a polygon for clipping
-                    if (whichpoly){
-                        clip[0]<<ClipperLib::IntPoint((int)(p3.x*mult),(int)(p3.y*mult)) << ClipperLib::IntPoint((long int)(p4.x*mult),(long int)(p4.y*mult))<<ClipperLib::IntPoint((long int)(p2.x*mult),(long int)(p2.y*mult))<<ClipperLib::IntPoint((long int)(p1.x*mult),(long int)(p1.y*mult));
-                        if (!ClipperLib::Orientation(clip[0])){
-                            ClipperLib::ReversePath(clip[0]);
-                        }
-                    }else {
-                        clip[0]<<ClipperLib::IntPoint((long int)(p5.x*mult),(long int)(p5.y*mult)) << ClipperLib::IntPoint((long int)(p6.x*mult),(long int)(p6.y*mult))<<ClipperLib::IntPoint((long int)(p1.x*mult),(long int)(p1.y*mult))<<ClipperLib::IntPoint((long int)(p2.x*mult),(long int)(p2.y*mult));
-                        if (!ClipperLib::Orientation(clip[0])){
-                            ClipperLib::ReversePath(clip[0]);
-                        }
-                    }
-                    
-                    //Clip the polygons
-                    c.Clear();
-                    c.AddPaths(solution,ClipperLib::ptSubject, true);
-                    c.AddPaths(clip,ClipperLib::ptClip, true);
-                    c.Execute(ClipperLib::ctIntersection, solution, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
-                    for (int kk = 0;kk<solution.size();kk++){
-                        ClipperLib::CleanPolygon(solution[0],1);
+        //Clip the polygons
+        c.Clear();
+        c.AddPaths(solution,ClipperLib::ptSubject, true);
+        c.AddPaths(clip,ClipperLib::ptClip, true);
+        c.Execute(ClipperLib::ctIntersection, solution, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+        if (!solution.empty()){
+            ClipperLib::CleanPolygon(solution[0],1);
+        }
+        return true;
+    }
+    
+    void Partition::PerturbCenter(const int ii){
+        Point p1;
+        p1 = Centers[ii].AddPoint(Point(0,100*Alg_Params.Robustness_Constant));
+        if(!GetPrior().GetRegion().pnpoly(p1)){
+            p1 = Centers[ii].AddPoint(Point(100,-2*Alg_Params.Robustness_Constant));
+            if(!GetPrior().GetRegion().pnpoly(p1)){
+                p1 = Centers[ii].AddPoint(Point(100*Alg_Params.Robustness_Constant,0));
+                if(!GetPrior().GetRegion().pnpoly(p1)){
+                    p1 = Centers[ii].AddPoint(Point(-100*Alg_Params.Robustness_Constant,0));
+                    if(!GetPrior().GetRegion().pnpoly(p1)){
+                        throw std::runtime_error("Error: Try decreasing Parameters::weights_step");
                     }
                 }
-                
             }
-            //Convert solution to a Poly structure
-            temp.clear();
-            for (int pp = 0; pp<solution[0].size();++pp){
-                temp.push_back(Point((double) solution[0][pp].X/(double)mult,(double) solution[0][pp].Y/(double)mult));
+        }
+        Centers[ii] = p1;
+        if (Alg_Params.verbosity>=1){
+            std::cout<<"Warning:May be numerically unstable. Suggest using smaller stepsizes or a finer grid."<<std::endl;
+        }
+    }
+    void Partition::ParallelFor(const int N, const std::function<void(const int index, const int worker)> &Task) const{
+        if (Pool){
+            //The workers use the robustness constant of the calling thread
+            const double tolerance = Point::Robustness_Constant;
+            Pool->ParallelFor(N, [&](const int index, const int worker){RobustnessScope Scope(tolerance); Task(index, worker);});
+        }else{
+            for (int ii = 0; ii<N; ii++){
+                Task(ii, 0);
             }
-            Covering[ii] = Poly(temp);
-            
         }
-        CleanCovering((double) 1.0/mult, mult);
-        return true;
-        
     }
-    
     void Partition::CleanCovering(const double tolerance, const long int &mult){
+        ScopedTimer Timer(Stats.clean_covering_time);
         double distance = 0;
         Poly temp;
         ClipperLib::Paths c(NRegions);
@@ -969,139 +3036,246 @@ namespace AreaCon {
             Covering[ii].SetVertices(Vert_ii);
         }
     }
-    void Partition::CreateDelaunayGraph(DelaunayGraph &Delaunay) const{
-        if (Delaunay.NRegions!=NRegions){
-            throw std::runtime_error("DelaunayGraph has inconsistent sizes");
-        }
-        //DelaunayGraph Delaunay(NRegions);
-        int NPoly_ii, NPoly_jj;
-        std::vector<Point> Vert_ii, Vert_jj, temp;
-        Point pi1, pi2, pj1, pj2, p;
-        
-        //Initialize Multi-Dimensional Array;
-        bool flag = false;
-        for (int ii = 0; ii<NRegions;ii++){
-            NPoly_ii = Covering[ii].GetNVertices();
-            Vert_ii = Covering[ii].GetVertices();
-            for (int jj = ii+1;jj<NRegions;jj++){
-                NPoly_jj = Covering[jj].GetNVertices();
-                Vert_jj = Covering[jj].GetVertices();
-                flag = false;
-                for (int kk = 0;kk<NPoly_ii;kk++){
-                    pi1 = Point(Vert_ii[kk].x,Vert_ii[kk].y);
-                    if(flag){
-                        break;
-                    }
-                    if (kk<NPoly_ii-1){
-                        pi2 = Point(Vert_ii[kk+1].x,Vert_ii[kk+1].y);
-                    }else{
-                        pi2 = Point(Vert_ii[0].x,Vert_ii[0].y);
-                    }
-                    for (int pp = 0;pp<NPoly_jj;pp++){
-                        pj1 = Point(Vert_jj[pp].x,Vert_jj[pp].y);
-                        if (pp<NPoly_jj-1){
-                            pj2 = Point(Vert_jj[pp+1].x,Vert_jj[pp+1].y);
-                        }else{
-                            pj2 = Point(Vert_jj[0].x,Vert_jj[0].y);
-                        }
-                        
-                        if (Point::AreCollinear(pi1, pi2, pj1) && Point::AreCollinear(pi1, pi2, pj2)){
-                            temp = Point::FindCollinearIntersection(pi1, pi2, pj1, pj2);
-                            if (temp.empty()){
-                                Delaunay.Graph[ii][jj][0] = p;
-                                Delaunay.Graph[ii][jj][1] = p;
-                                Delaunay.Graph[jj][ii][0] = Delaunay.Graph[ii][jj][0];
-                                Delaunay.Graph[jj][ii][1] = Delaunay.Graph[ii][jj][1];
-                            }else if (temp.size() == 1){
-                                Delaunay.Graph[ii][jj][0] = temp[0];
-                                Delaunay.Graph[ii][jj][1] = p;
-                                Delaunay.Graph[jj][ii][0] = Delaunay.Graph[ii][jj][0];
-                                Delaunay.Graph[jj][ii][1] = Delaunay.Graph[ii][jj][1];
-                                
-                            }else{
-                                Delaunay.Graph[ii][jj][0] = temp[0];
-                                Delaunay.Graph[ii][jj][1] = temp[1];
-                                Delaunay.Graph[jj][ii][0] = Delaunay.Graph[ii][jj][0];
-                                Delaunay.Graph[jj][ii][1] = Delaunay.Graph[ii][jj][1];
-                                
-                                flag = true;
-                                break;
-                            }
-                            
-                        }
-                    }
-                }
-            }
-        }
-    }
     double Partition::GradientStepCenter(const std::vector<double> &volumes){
-        Point Center, Center_ii, Errorxy;
+        ScopedTimer Timer(Stats.centers_time);
+        Stats.center_steps++;
+        std::vector<double> &errors = Workspace.Center_Errors;
         double Error = 0;
-        for (int ii = 0; ii<NRegions;ii++){
+        errors.resize(NRegions);
+        ParallelFor(NRegions, [&](const int ii, const int worker){
+            Point Center, Center_ii, Errorxy;
             if (Covering[ii].GetNVertices() == 0){
                 Errorxy = INFINITY;
-                Error+=Errorxy.Norm();
+                errors[ii] = Errorxy.Norm();
             }else{
                 Center_ii = Centers[ii];
                 Center_ii.FlipDirection();
-                Center = Prior.CalculateCentroid(Covering[ii], volumes[ii]);
+                Center = GetCentroid(ii, volumes);
                 Errorxy = Point::AddPoints(Center, Center_ii);
-                Error+=Errorxy.Norm();
+                errors[ii] = Errorxy.Norm();
                 Errorxy.Mult(Alg_Params.centers_step);
                 Centers[ii] = Centers[ii].AddPoint(Errorxy);
             }
-            
+        });
+        //The errors are added in a fixed order, so that the result does not depend on the number of threads
+        for (int ii = 0; ii<NRegions;ii++){
+            Error += errors[ii];
         }
         
         return Error;
     }
     void Partition::GradientStepCenter(const double &temp_step, const std::vector<double> &volumes){
+        ScopedTimer Timer(Stats.centers_time);
+        Stats.center_steps++;
         if (temp_step <=0 || temp_step>1){
             throw std::runtime_error("temp_step must be between 0 and 1 (can be equal to 1, but not zero)");
         }
-        Point Center;
-        for (int ii = 0; ii<NRegions;ii++){
+        ParallelFor(NRegions, [&](const int ii, const int worker){
             if (Covering[ii].GetNVertices() > 0){
-            Center = Prior.CalculateCentroid(Covering[ii], volumes[ii]);
+            Point Center = GetCentroid(ii, volumes);
             Centers[ii]=Point::FindPointAlongLine(Centers[ii], Center, temp_step);
             }
+        });
+    }
+    void Partition::GradientStepWeights(const std::vector<double> &volumes, const SparseAdjacency &Graph){
+        ScopedTimer Timer(Stats.weights_time);
+        std::vector<double> &totals = Workspace.Weight_Totals, &values = Workspace.Edge_Values;
+        for (int ii = 0; ii<NRegions; ii++){
+            if(Covering[ii].GetNVertices() == 0){
+                Weights = std::vector<double>(NRegions,0);
+                return;
+            }
+        }
+        if (Graph.GetNRows() != NRegions){
+            throw std::runtime_error("Incompatible Dimensions");
+        }
+        Stats.weight_steps++;
+        //Only adjacent regions contribute, since the line integral vanishes for all other pairs.
+        CalculateEdgeIntegrals(Graph, values);
+        ParallelFor(NRegions, [&](const int ii, const int worker){
+            for (int kk = Graph.Offsets[ii]; kk<Graph.Offsets[ii+1]; kk++){
+                int jj = Graph.Neighbors[kk];
+                values[kk] *= ((desired_area[jj]/volumes[jj])-(desired_area[ii]/volumes[ii]))*(1/Point::Distance(Centers[ii], Centers[jj]));
+            }
+        });
+        AccumulateEdgeValues(Graph, values, totals);
+        for (int ii = 0; ii<NRegions; ii++){
+            Weights[ii] += - totals[ii]*Alg_Params.weights_step;
         }
     }
-    void Partition::GradientStepWeights(const std::vector<double> &volumes, const DelaunayGraph &SharedEdges){
-        std::vector<double> totals(NRegions);
-        Mult_Array integrals(NRegions), dist(NRegions), InvAreaDist(NRegions);
-        
-        for (int ii = 0; ii<NRegions;ii++){
-            totals[ii] = 0;
-            integrals.Array[ii][ii] = 0;
-            dist.Array[ii][ii] = 0;
-            InvAreaDist.Array[ii][ii] = 0;
-            for (int jj = ii+1;jj<NRegions;jj++){
-                dist.Array[ii][jj] = Point::Distance(Centers[ii], Centers[jj]);
-                dist.Array[jj][ii] = dist.Array[ii][jj];
-                InvAreaDist.Array[ii][jj] = (desired_area[jj]/volumes[jj])-(desired_area[ii]/volumes[ii]);
-                InvAreaDist.Array[jj][ii] = -InvAreaDist.Array[ii][jj];
-                if (!isinf(SharedEdges.Graph[ii][jj][1].x)){
-                    integrals.Array[ii][jj] = Prior.LineIntegral(Alg_Params.line_int_step, SharedEdges.Graph[ii][jj][0], SharedEdges.Graph[ii][jj][1]);
-                }else{
-                    integrals.Array[ii][jj] = 0;
-                }
-                integrals.Array[jj][ii] = integrals.Array[ii][jj];
-                totals[ii] = totals[ii]+InvAreaDist.Array[ii][jj]*(1/dist.Array[ii][jj])*integrals.Array[ii][jj];
+    void Partition::NewtonStepWeights(std::vector<double> &volumes, double &error_vol, const SparseAdjacency &Graph){
+        std::vector<double> &values = Workspace.Edge_Values, &residual = Workspace.Weight_Totals, &direction = Workspace.Newton_Direction, &start = Workspace.Newton_Weights;
+        const int max_halvings = 4;
+        const double sufficient_decrease = 1e-4;
+        double diagonal = 0, shift = 0, alpha = 1, mismatch = 0, trial = 0;
+        bool empty = false;
+        //The volumes can only be redistributed among the regions, so the targets are the desired fractions of the current total volume (which coincide with desired_area for normalized densities)
+        auto Mismatch = [&](const std::vector<double> &volumes, std::vector<double> &residual){
+            double total = 0, sum = 0;
+            residual.resize(NRegions);
+            for (int ii = 0; ii<NRegions; ii++){
+                total += volumes[ii];
             }
-            for (int jj=0;jj<ii;jj++){
-                totals[ii] = totals[ii]+InvAreaDist.Array[ii][jj]*(1/dist.Array[ii][jj])*integrals.Array[ii][jj];
-                
+            for (int ii = 0; ii<NRegions; ii++){
+                residual[ii] = desired_area[ii]*total-volumes[ii];
+                sum += residual[ii]*residual[ii];
             }
-            
+            return sum;
+        };
+        for (int ii = 0; ii<NRegions; ii++){
             if(Covering[ii].GetNVertices() == 0){
-                Weights = std::vector<double>(NRegions,0);
+                GradientStepWeights(volumes, Graph);
+                RebuildPowerDiagram();
+                volumes = CalculateVolumes();
+                error_vol = CalculateError(volumes);
+                return;
+            }
+        }
+        if (Graph.GetNRows() != NRegions){
+            throw std::runtime_error("Incompatible Dimensions");
+        }
+        {
+            ScopedTimer Timer(Stats.weights_time);
+            Stats.weight_steps++;
+            CalculateEdgeIntegrals(Graph, values);
+            //The line integrals are taken over the raw density values, whereas the volumes are normalized
+            const double scale = GetPrior().GetVolumeScale();
+            for (int ii = 0; ii<NRegions; ii++){
+                for (int kk = Graph.Offsets[ii]; kk<Graph.Offsets[ii+1]; kk++){
+                    values[kk] /= 2*scale*Point::Distance(Centers[ii], Centers[Graph.Neighbors[kk]]);
+                    diagonal += 2*values[kk];
+                }
+            }
+            //The Laplacian is singular (adding a constant to all weights leaves the diagram unchanged), but the residual sums to zero and therefore lies in its range. A tiny shift keeps the system definite if the graph is disconnected.
+            mismatch = Mismatch(volumes, residual);
+            shift = 1e-10*diagonal/NRegions;
+            SolveLaplacian(Graph, values, shift, residual, direction);
+        }
+        start = Weights;
+        for (int halvings = 0; ; halvings++){
+            for (int ii = 0; ii<NRegions; ii++){
+                Weights[ii] = start[ii]+alpha*direction[ii];
+            }
+            RebuildPowerDiagram();
+            volumes = CalculateVolumes();
+            trial = Mismatch(volumes, residual);
+            empty = false;
+            for (int ii = 0; ii<NRegions; ii++){
+                empty = empty || Covering[ii].GetNVertices() == 0;
+            }
+            //The directional derivative of the squared residual along the Newton step is -2 times the squared residual
+            if ((!empty && trial<=(1-2*sufficient_decrease*alpha)*mismatch) || halvings == max_halvings){
+                error_vol = CalculateError(volumes);
                 return;
+            }
+            alpha /= 2;
+            Stats.line_search_steps++;
+        }
+    }
+    void Partition::CalculateEdgeIntegrals(const SparseAdjacency &Graph, std::vector<double> &values){
+        Stats.line_integrals += Graph.GetNEdges();
+        values.resize(Graph.GetNEdges());
+        //The line integrals of all edges are evaluated in parallel, in blocks that are interpolated in one batch each.
+        const int NEdges = Graph.GetNEdges(), block = 256;
+        ParallelFor((NEdges+block-1)/block, [&](const int bb, const int worker){
+            int first = bb*block, count = std::min(block, NEdges-first);
+            if (Alg_Params.exact_line_integral){
+                for (int kk = first; kk<first+count; kk++){
+                    values[kk] = Prior.ExactLineIntegral(Graph.Starts[kk], Graph.Ends[kk]);
+                }
+            }else if (Shared_Prior){
+                for (int kk = first; kk<first+count; kk++){
+                    values[kk] = Shared_Prior->LineIntegral(Alg_Params.line_int_step, Graph.Starts[kk], Graph.Ends[kk]);
+                }
             }else{
-                Weights[ii] += - totals[ii]*Alg_Params.weights_step;
+                Prior.LineIntegrals(Alg_Params.line_int_step, count, &Graph.Starts[first], &Graph.Ends[first], &values[first]);
+            }
+        });
+    }
+    void Partition::AccumulateEdgeValues(const SparseAdjacency &Graph, const std::vector<double> &values, std::vector<double> &totals){
+        std::vector<int> &offsets = Workspace.Incidence_Offsets, &incidence = Workspace.Incidence;
+        const int NEdges = Graph.GetNEdges();
+        //The edges of every node are listed by counting sort, in increasing order of the edge index
+        offsets.assign(NRegions+1, 0);
+        for (int ii = 0; ii<NRegions; ii++){
+            for (int kk = Graph.Offsets[ii]; kk<Graph.Offsets[ii+1]; kk++){
+                offsets[ii+1]++;
+                offsets[Graph.Neighbors[kk]+1]++;
             }
         }
-        
+        for (int ii = 0; ii<NRegions; ii++){
+            offsets[ii+1] += offsets[ii];
+        }
+        incidence.resize(2*NEdges);
+        totals.assign(NRegions, 0);
+        for (int ii = 0, kk = 0; ii<NRegions; ii++){
+            for (; kk<Graph.Offsets[ii+1]; kk++){
+                incidence[offsets[ii]++] = kk;
+                incidence[offsets[Graph.Neighbors[kk]]++] = kk;
+            }
+        }
+        for (int ii = NRegions; ii>0; ii--){
+            offsets[ii] = offsets[ii-1];
+        }
+        offsets[0] = 0;
+        ParallelFor(NRegions, [&](const int ii, const int worker){
+            double total = 0;
+            for (int qq = offsets[ii]; qq<offsets[ii+1]; qq++){
+                int kk = incidence[qq];
+                if (Graph.Neighbors[kk] == ii){
+                    total -= values[kk];
+                }else{
+                    total += values[kk];
+                }
+            }
+            totals[ii] = total;
+        });
+    }
+    void Partition::SolveLaplacian(const SparseAdjacency &Graph, const std::vector<double> &coefficients, const double shift, const std::vector<double> &b, std::vector<double> &x) const{
+        std::vector<double> r = b, p = b, Ap(NRegions);
+        double rr = 0, rr_new = 0, pAp = 0, step = 0, tolerance = 0;
+        x.assign(NRegions, 0);
+        for (int ii = 0; ii<NRegions; ii++){
+            rr += r[ii]*r[ii];
+        }
+        tolerance = 1e-20*rr;
+        for (int iteration = 0; iteration<NRegions && rr>tolerance && rr>0; iteration++){
+            for (int ii = 0; ii<NRegions; ii++){
+                Ap[ii] = shift*p[ii];
+            }
+            for (int ii = 0; ii<NRegions; ii++){
+                for (int kk = Graph.Offsets[ii]; kk<Graph.Offsets[ii+1]; kk++){
+                    int jj = Graph.Neighbors[kk];
+                    double flux = coefficients[kk]*(p[ii]-p[jj]);
+                    Ap[ii] += flux;
+                    Ap[jj] -= flux;
+                }
+            }
+            pAp = 0;
+            for (int ii = 0; ii<NRegions; ii++){
+                pAp += p[ii]*Ap[ii];
+            }
+            if (pAp<=0){
+                break;
+            }
+            step = rr/pAp;
+            rr_new = 0;
+            for (int ii = 0; ii<NRegions; ii++){
+                x[ii] += step*p[ii];
+                r[ii] -= step*Ap[ii];
+                rr_new += r[ii]*r[ii];
+            }
+            for (int ii = 0; ii<NRegions; ii++){
+                p[ii] = r[ii]+(rr_new/rr)*p[ii];
+            }
+            rr = rr_new;
+        }
+    }
+    void Partition::RebuildPowerDiagram(void){
+        bool success = CreatePowerDiagram();
+        while (!success){
+            success = CreatePowerDiagram();
+        }
     }
     double Partition::CalculateError(const std::vector<double> &volumes){
         double sum = 0;
@@ -1112,157 +3286,257 @@ namespace AreaCon {
     }
     
     std::vector<double> Partition::CalculateVolumes(void){
+        ScopedTimer Timer(Stats.volumes_time);
+        Stats.volume_calls++;
         std::vector<double> result(NRegions);
-        for (int jj = 0;jj<NRegions;jj++){
-            result[jj] = Prior.CalculateWeightedArea(Covering[jj]);
+        if (Alg_Params.integration_method == Ownership_Map){
+            Prior.CalculateCoveringIntegrals(Covering, result, Centroids, Owner);
+            return result;
+        }else if (Alg_Params.integration_method == Device_Spans){
+            Prior.CalculateDeviceIntegrals(Covering, result, Centroids);
+            return result;
+        }
+        //Every region is integrated separately, so that the results do not depend on the number of threads
+        Centroids.resize(NRegions);
+        if (Alg_Params.integration_method == Column_Spans){
+            ParallelFor(NRegions, [&](const int ii, const int worker){Prior.CalculateSpanIntegrals(Covering[ii], result[ii], Centroids[ii]);});
+        }else{
+            const DensityFunction &Function = GetPrior();
+            ParallelFor(NRegions, [&](const int ii, const int worker){Function.CalculateVolumeAndCentroid(Covering[ii], result[ii], Centroids[ii]);});
         }
         return result;
     }
+    Point Partition::GetCentroid(const int ii, const std::vector<double> &volumes) const{
+        if (Centroids.size() == NRegions){
+            return Centroids[ii];
+        }
+        return GetPrior().CalculateCentroid(Covering[ii], volumes[ii]);
+    }
     void Partition::CalculatePartition(bool WriteToFile, std::string filename_partition, std::string filename_centers){
-        if (Prior.GetRegion().GetNVertices() == 0){
+        if (WriteToFile){
+            CSVIterationSink Sink(filename_partition, filename_centers);
+            RunPartition(&Sink);
+        }else{
+            RunPartition(NULL);
+        }
+    }
+    void Partition::CalculatePartition(IterationSink &Sink){
+        RunPartition(&Sink);
+    }
+    void Partition::RecordSnapshot(IterationSink *Sink, int &iteration, const bool final) const{
+        if (Sink){
+            Sink->Record(iteration, final, Centers, Weights, Covering);
+        }
+        iteration++;
+    }
+    void Partition::RunPartition(IterationSink *Sink){
+        RobustnessScope Scope(Alg_Params.Robustness_Constant);
+        if (GetPrior().GetRegion().GetNVertices() == 0){
             throw std::runtime_error("Prior has not been initialized");
         }else if (Centers.empty()){
             throw std::runtime_error("Centers and Weights have not been initialized");
         }
-        bool success;
-        std::ofstream file1, file2;
-        int count1, count2;
-        std::vector<double> volumes(NRegions);
-        std::vector<Point> Vert;
-        DelaunayGraph Delaunay(NRegions);
-        double initial_step = 1, error = INFINITY, error_vol = INFINITY;
-        if (WriteToFile){
-            file1.open(filename_centers);
-            file2.open(filename_partition);
-        }
-        if (WriteToFile){
-            for (int ii = 0; ii<NRegions;ii++){
-                file1<<Centers[ii].x<<","<<Centers[ii].y<<std::endl;
-                Vert = Covering[ii].GetVertices();
-                for (int jj = 0; jj<Covering[ii].GetNVertices();jj++){
-                    file2<<Vert[jj].x<<","<<Vert[jj].y<<" ";
+        ResetStats();
+        ScopedTimer Timer(Stats.total_time);
+        int snapshot = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        RecordSnapshot(Sink, snapshot);
+        if (Alg_Params.pyramid_levels>1){
+            //The levels are solved from the coarsest to the finest, each one starting from the centers and weights of the previous one
+            std::vector<Density> Pyramid;
+            CreatePyramid(Pyramid);
+            for (int level = (int) Pyramid.size(); level>0; level--){
+                std::swap(Prior, Pyramid[level-1]);
+                try{
+                    SolveLevel(Sink, snapshot, level, start);
+                }catch (...){
+                    std::swap(Prior, Pyramid[level-1]);
+                    throw;
                 }
-                file2<<std::endl;
+                std::swap(Prior, Pyramid[level-1]);
             }
-            file1<<std::endl;
-            file2<<std::endl;
         }
-        
-        success = CreatePowerDiagram();
-        while (!success){
-            success = CreatePowerDiagram();
+        SolveLevel(Sink, snapshot, 0, start);
+        RecordSnapshot(Sink, snapshot, true);
+        if (Sink){
+            Sink->Flush();
         }
-        if (WriteToFile){
-            for (int ii = 0; ii<NRegions;ii++){
-                file1<<Centers[ii].x<<","<<Centers[ii].y<<std::endl;
-                Vert = Covering[ii].GetVertices();
-                for (int jj = 0; jj<Covering[ii].GetNVertices();jj++){
-                    file2<<Vert[jj].x<<","<<Vert[jj].y<<" ";
-                }
-                file2<<std::endl;
+    }
+    void Partition::CreatePyramid(std::vector<Density> &Pyramid) const{
+        const int min_points = 8;
+        Pyramid.clear();
+        Pyramid.reserve(Alg_Params.pyramid_levels);
+        const Density *Finer = &Prior;
+        for (int level = 1; level<Alg_Params.pyramid_levels; level++){
+            if ((Finer->GetNx()+1)/2<min_points || (Finer->GetNy()+1)/2<min_points){
+                break;
             }
-            file1<<std::endl;
-            file2<<std::endl;
+            Pyramid.push_back(Finer->Downsample());
+            Finer = &Pyramid.back();
         }
+    }
+    void Partition::SolveLevel(IterationSink *Sink, int &snapshot, const int level, const std::chrono::steady_clock::time_point start){
+        int count1, count2;
+        std::vector<double> volumes(NRegions);
+        double initial_step = 1, error = INFINITY, error_vol = INFINITY;
+        const int verbosity = Alg_Params.verbosity;
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point step_start = Clock::now();
+        ProgressInfo Info;
+        //Reports a completed step to the progress callback
+        auto Report = [&](const bool center_step, const int volume_iteration){
+            Clock::time_point now = Clock::now();
+            if (Progress_Callback){
+                Info.center_step = center_step;
+                Info.level = level;
+                Info.center_iteration = count2;
+                Info.volume_iteration = volume_iteration;
+                Info.volume_error = error_vol;
+                Info.center_error = error;
+                Info.step_time = std::chrono::duration<double>(now-step_start).count();
+                Info.elapsed_time = std::chrono::duration<double>(now-start).count();
+                Progress_Callback(Info);
+            }
+            step_start = now;
+        };
+        RebuildPowerDiagram();
+        RecordSnapshot(Sink, snapshot);
         volumes = CalculateVolumes();
         GradientStepCenter(initial_step, volumes);
-        success = CreatePowerDiagram();
-        while (!success){
-            success = CreatePowerDiagram();
-        }
-        if (WriteToFile){
-            for (int ii = 0; ii<NRegions;ii++){
-                file1<<Centers[ii].x<<","<<Centers[ii].y<<std::endl;
-                Vert = Covering[ii].GetVertices();
-                for (int jj = 0; jj<Covering[ii].GetNVertices();jj++){
-                    file2<<Vert[jj].x<<","<<Vert[jj].y<<" ";
-                }
-                file2<<std::endl;
-            }
-            file1<<std::endl;
-            file2<<std::endl;
-        }
+        RebuildPowerDiagram();
+        RecordSnapshot(Sink, snapshot);
         count2 = 0;
         while (error>Alg_Params.convergence_criterion && count2<Alg_Params.max_iterations_centers){
             volumes = CalculateVolumes();
             error_vol = CalculateError(volumes);
-            std::cout<<error_vol<<std::endl;
+            if (verbosity>=1){
+                std::cout<<error_vol<<'\n';
+            }
             count1 = 0;
             while (error_vol >Alg_Params.volume_tolerance &&count1<Alg_Params.max_iterations_volume){
-                CreateDelaunayGraph(Delaunay);
-                GradientStepWeights(volumes, Delaunay);
-                success = CreatePowerDiagram();
-                while (!success){
-                    success = CreatePowerDiagram();
+                if (Alg_Params.weights_method == Newton){
+                    NewtonStepWeights(volumes, error_vol, Adjacency);
+                    RecordSnapshot(Sink, snapshot);
+                }else{
+                    GradientStepWeights(volumes, Adjacency);
+                    RebuildPowerDiagram();
+                    RecordSnapshot(Sink, snapshot);
+                    volumes = CalculateVolumes();
+                    error_vol = CalculateError(volumes);
                 }
-                if (WriteToFile){
-                    for (int ii = 0; ii<NRegions;ii++){
-                        file1<<Centers[ii].x<<","<<Centers[ii].y<<std::endl;
-                        Vert = Covering[ii].GetVertices();
-                        for (int jj = 0; jj<Covering[ii].GetNVertices();jj++){
-                            file2<<Vert[jj].x<<","<<Vert[jj].y<<" ";
-                        }
-                        file2<<std::endl;
+                if (verbosity>=3){
+                    for (int ii = 0;ii<NRegions;ii++){
+                        std::cout<<Weights[ii]<<'\n';
                     }
-                    file1<<std::endl;
-                    file2<<std::endl;
                 }
-                volumes = CalculateVolumes();
-                error_vol = CalculateError(volumes);
-                for (int ii = 0;ii<NRegions;ii++){
-                    std::cout<<Weights[ii]<<std::endl;
+                if (verbosity>=2){
+                    std::cout<<count1<<'\n';
+                    std::cout<<error_vol<<'\n';
                 }
-
-                std::cout<<count1<<std::endl;
-                std::cout<<error_vol<<std::endl;
+                Report(false, count1);
                 count1++;
             }
             error = GradientStepCenter(volumes);
             
-            std::cout<<count2<<std::endl;
-            std::cout<<error<<std::endl;
+            if (verbosity>=1){
+                std::cout<<count2<<'\n';
+                std::cout<<error<<std::endl;
+            }
             
             
-            if (isinf(error)){
+            if (std::isinf(error)){
                 Weights = std::vector<double>(NRegions,0);
             }
             
             
             
-            success = CreatePowerDiagram();
-            while (!success){
-                success = CreatePowerDiagram();
-                
+            RebuildPowerDiagram();
+            RecordSnapshot(Sink, snapshot);
+            Report(true, -1);
+            count2++;
+        }
+    } 
+    // BatchJob Class---------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    BatchJob::BatchJob(int NRegions, Density Prior, std::vector<double> desired_area, Parameters Alg_Params, std::vector<Point> Centers, std::vector<double> Weights):NRegions(NRegions), Prior(std::move(Prior)), desired_area(std::move(desired_area)), Alg_Params(Alg_Params), Centers(std::move(Centers)), Weights(std::move(Weights)){}
+    // BatchSolver Class------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    
+    BatchSolver::BatchSolver(const int num_threads){
+        if (num_threads<0){
+            throw std::runtime_error("num_threads must be greater than or equal to 0");
+        }else if (num_threads != 1){
+            Pool = std::make_shared<ThreadPool>(num_threads);
+        }
+    }
+    std::vector<BatchResult> BatchSolver::Solve(std::vector<BatchJob> Jobs){
+        const int NJobs = (int) Jobs.size(), NWorkers = GetNThreads();
+        std::vector<BatchResult> Results(NJobs);
+        std::vector<WorkQueue> Queues(NWorkers);
+        std::vector<int> Order(NJobs);
+        for (int kk = 0; kk<NJobs; kk++){
+            Order[kk] = kk;
+        }
+        //The largest jobs are started first, so that they do not end up running alone at the end of the batch
+        std::stable_sort(Order.begin(), Order.end(), [&](const int a, const int b){return Jobs[a].NRegions>Jobs[b].NRegions;});
+        for (int kk = 0; kk<NJobs; kk++){
+            Queues[kk%NWorkers].Jobs.push_back(Order[kk]);
+        }
+        Workspaces.resize(NWorkers);
+        auto Work = [&](const int queue, const int worker){
+            int job = 0;
+            while (NextJob(Queues, queue, job)){
+                SolveJob(Jobs[job], Workspaces[worker], Results[job]);
             }
-            if (WriteToFile){
-                for (int ii = 0; ii<NRegions;ii++){
-                    file1<<Centers[ii].x<<","<<Centers[ii].y<<std::endl;
-                    Vert = Covering[ii].GetVertices();
-                    for (int jj = 0; jj<Covering[ii].GetNVertices();jj++){
-                        file2<<Vert[jj].x<<","<<Vert[jj].y<<" ";
-                    }
-                    file2<<std::endl;
-                }
-                file1<<std::endl;
-                file2<<std::endl;
+        };
+        if (Pool){
+            Pool->ParallelFor(NWorkers, Work);
+        }else{
+            Work(0, 0);
+        }
+        return Results;
+    }
+    bool BatchSolver::NextJob(std::vector<WorkQueue> &Queues, const int queue, int &job) const{
+        const int NQueues = (int) Queues.size();
+        for (int kk = 0; kk<NQueues; kk++){
+            WorkQueue &Queue = Queues[(queue+kk)%NQueues];
+            std::lock_guard<std::mutex> lock(Queue.Mutex);
+            if (Queue.Jobs.empty()){
+                continue;
             }
-            count2++;
+            //The owner takes jobs from the front and thieves from the back, so that they rarely compete for the same jobs
+            if (kk == 0){
+                job = Queue.Jobs.front();
+                Queue.Jobs.pop_front();
+            }else{
+                job = Queue.Jobs.back();
+                Queue.Jobs.pop_back();
+            }
+            return true;
         }
-        
-        
-        
-        if (WriteToFile){
-            for (int ii = 0; ii<NRegions;ii++){
-                file1<<Centers[ii].x<<","<<Centers[ii].y<<std::endl;
-                Vert = Covering[ii].GetVertices();
-                for (int jj = 0; jj<Covering[ii].GetNVertices();jj++){
-                    file2<<Vert[jj].x<<","<<Vert[jj].y<<" ";
-                }
-                file2<<std::endl;
+        return false;
+    }
+    void BatchSolver::SolveJob(BatchJob &Job, PartitionWorkspace &Workspace, BatchResult &Result) const{
+        std::unique_ptr<Partition> Solver;
+        try{
+            //A job with a thread pool of its own would oversubscribe the threads of the solver
+            if (Job.Alg_Params.num_threads != 1){
+                throw std::runtime_error("The num_threads of a BatchJob must be 1");
             }
-            file1<<std::endl;
-            file2<<std::endl;
+            Solver.reset(new Partition(Job.NRegions, std::move(Job.Prior), std::move(Job.desired_area), Job.Alg_Params));
+            Solver->SwapWorkspace(Workspace);
+            Solver->InitializePartition(std::move(Job.Centers), std::move(Job.Weights));
+            Solver->CalculatePartition(false);
+            Result.Covering = Solver->GetCovering();
+            Result.Centers = Solver->GetCenters();
+            Result.Weights = Solver->GetWeights();
+            Result.Stats = Solver->GetStats();
+        }catch(...){
+            Result.Error = std::current_exception();
         }
-        
-    } 
+        if (Solver){
+            Solver->SwapWorkspace(Workspace);
+        }
+    }
 }
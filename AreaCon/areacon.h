@@ -36,6 +36,22 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <exception>
+#include <cstring>
+#include <string>
+#include <list>
+#include <future>
+#include <deque>
+#include <unordered_map>
 #include "clipper.hpp"
 
 
@@ -55,7 +71,7 @@ namespace AreaCon {
         double x;
         double y;
         //@}
-        static double Robustness_Constant;/**<A constant used to enhance numerical robustness. Loosely, when a Euclidean distance is less than the robustness constant, the distance is considered to be 0.*/
+        static thread_local double Robustness_Constant;/**<A constant used to enhance numerical robustness. Loosely, when a Euclidean distance is less than the robustness constant, the distance is considered to be 0. The constant is thread-local, so that problems with different constants can be solved concurrently; a Partition installs Parameters::Robustness_Constant for the duration of each of its public calls, including in its worker threads (see RobustnessScope). Outside of these calls every thread uses the default of Parameters::Robustness_Constant (10e-8).*/
         //@{
         /**
          * Default Constructor
@@ -194,6 +210,89 @@ namespace AreaCon {
         static std::vector<Point> FindCollinearIntersection(const Point p1, const Point p2, const Point p3, const Point p4);
         
     };
+    // RobustnessScope Class---------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Sets Point::Robustness_Constant of the calling thread for its lifetime and restores the previous value on destruction, so that scopes may be nested.
+     */
+    class RobustnessScope
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Installs the constant.
+         * @param[in] Robustness_Constant The constant used by the calling thread within the scope
+         */
+        RobustnessScope(const double Robustness_Constant):Previous(Point::Robustness_Constant){Point::Robustness_Constant = Robustness_Constant;};
+        /**
+         * Destructor. Restores the previous constant.
+         */
+        ~RobustnessScope(void){Point::Robustness_Constant = Previous;};
+        RobustnessScope(const RobustnessScope &Other) = delete;
+        RobustnessScope &operator=(const RobustnessScope &Other) = delete;
+        //@}
+    private:
+        double Previous;/**<The constant at construction*/
+    };
+    // HalfPlane Class--------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * A closed half-plane in the two-dimensional plane, i.e., the set of points p satisfying Normal.x*p.x + Normal.y*p.y <= Offset.
+     */
+    class HalfPlane
+    {
+    public:
+        //@{
+        Point Normal;/**<The outward normal of the half-plane (not necessarily of unit length)*/
+        double Offset;/**<The offset of the boundary line*/
+        //@}
+        //@{
+        /**
+         * Default Constructor
+         * @param[in] Normal The outward normal of the half-plane
+         * @param[in] Offset The offset of the boundary line
+         */
+        HalfPlane(const Point Normal = Point(0,0), const double Offset = 0);
+        //@}
+        //@{
+        /**
+         * Evaluates the affine function defining the half-plane. The value is non-positive inside the half-plane and, when divided by the norm of Normal, equals the signed distance of Test to the boundary line.
+         * @param[in] Test The test point
+         * @return Normal.x*Test.x + Normal.y*Test.y - Offset
+         */
+        double Evaluate(const Point &Test) const {return Normal.x*Test.x+Normal.y*Test.y-Offset;};
+        /**
+         * Tests to see if Test lies in the half-plane.
+         * @param[in] Test The test point
+         * @return Indicator of whether Test lies in the half-plane
+         */
+        bool Contains(const Point &Test) const {return Evaluate(Test)<=0;};
+        /**
+         * Finds the point at which the line connecting Test1, Test2 crosses the boundary of the half-plane. Test1 and Test2 should lie on opposite sides of the boundary.
+         * @param[in] Test1 The first end-point of the line
+         * @param[in] Test2 The second end-point of the line
+         * @return The intersection point
+         */
+        Point FindIntersection(const Point &Test1, const Point &Test2) const;
+        /**
+         * Clips the axis-aligned box [minx,maxx]x[miny,maxy] to the half-plane.
+         * @param[in] minx, miny, maxx, maxy The extrema of the box
+         * @return The vertices of the clipped box in counter-clockwise order (empty if the box lies entirely outside of the half-plane)
+         */
+        std::vector<Point> ClipBox(const double minx, const double miny, const double maxx, const double maxy) const;
+        //@}
+        //@{
+        /**
+         * Creates the half-plane of points whose power distance to Center1 is less than or equal to the power distance to Center2, where the power distance of a point p to a center c with weight w is |p-c|^2-w. The boundary of the half-plane is the power bisector of the two centers.
+         * @param[in] Center1 The first center
+         * @param[in] Weight1 The weight of the first center
+         * @param[in] Center2 The second center
+         * @param[in] Weight2 The weight of the second center
+         * @return The half-plane. If the centers coincide, the normal is zero.
+         */
+        static HalfPlane PowerBisector(const Point &Center1, const double Weight1, const Point &Center2, const double Weight2);
+        //@}
+    };
     // Poly Class-------------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     /**
@@ -215,26 +314,60 @@ namespace AreaCon {
          * @param[in] Vertices The points defining the vertices of the polygon in counter-clockwise order (the first vertex is not repeated).
          * @param[in] GetExtrema Flag that determines whether the extrema should be calculated and re-set
          */
-        void SetVertices(const std::vector<Point> Vertices, const bool GetExtrema = true);
+        void SetVertices(std::vector<Point> Vertices, const bool GetExtrema = true);
         /**
          @return The list of Vertices
          */
-        std::vector<Point> GetVertices(void) const;
+        const std::vector<Point> &GetVertices(void) const;
         /**
          * @return The number of vertices.
          */
         int GetNVertices(void) const;
+        /**
+         * @return The (unweighted) area of the polygon.
+         */
+        double GetArea(void) const;
         /**
          *  Determines if the point Test lies within the polygon.
          * @param[in] Test The test point
          * @return Indicator of whether or not Test is inside the polygon
          */
         bool pnpoly(const Point Test) const;
+        /**
+         * Determines which of the evenly spaced points Start+k*Step, k = 0,...,NPoints-1, lie within the polygon, with the same result as pnpoly. For convex polygons the points inside form a single run whose ends are found by intersecting the line with the edge half-planes, so that only a handful of points are tested individually.
+         * @param[in] Start The first point
+         * @param[in] Step The offset between consecutive points
+         * @param[in] NPoints The number of points
+         * @param[out] Spans Receives consecutive pairs (first, last) of indices, where the points first,...,last lie within the polygon and their neighbors do not. Empty if no point lies within the polygon.
+         */
+        void Scanline(const Point &Start, const Point &Step, const int NPoints, std::vector<int> &Spans) const;
+        /**
+         * @return Indicator of whether the polygon is convex, in which case pnpoly and Scanline use the edge half-planes
+         */
+        bool IsConvex(void) const {return Convex;};
         /**
          * Returns the extreme x and y values.
          * @param[out] minx, miny, maxx, maxy
          */
         void GetExtrema(double &minx, double &miny, double &maxx, double &maxy) const;
+        /**
+         * Clips the polygon to the half-plane Plane.
+         * @param[in] Plane The clipping half-plane
+         * @param[in] tolerance Vertices whose distance to the boundary of Plane is smaller than tolerance are treated as lying on the boundary
+         * @return The clipped polygon (empty if nothing remains)
+         */
+        Poly ClipToHalfPlane(const HalfPlane &Plane, const double tolerance = 0) const;
+        /**
+         * Clips the convex polygon whose vertices (in counter-clockwise order) are stored in Vertices to the half-plane Plane, in double precision (Sutherland-Hodgman). Vertices is overwritten by the result and Buffer is used as scratch space. Both vectors keep their capacity, so that repeated clipping does not allocate once the buffers are large enough.
+         * @param[in] Plane The clipping half-plane
+         * @param[in] tolerance Vertices whose distance to the boundary of Plane is smaller than tolerance are treated as lying on the boundary, and consecutive vertices closer than tolerance are merged
+         * @param[in,out] Vertices The vertices of the polygon. Fewer than 3 vertices remain if the polygon has been clipped away.
+         * @param[in,out] Buffer Scratch space
+         * @param[in,out] Labels Optional labels of the edges of the polygon, where the ii-th entry labels the edge from the ii-th vertex to the next one. If given (with the same size as Vertices), the labels are carried over to the edges of the clipped polygon, and edges created along the boundary of Plane are labelled with label.
+         * @param[in,out] LabelBuffer Scratch space for the labels (required if Labels is given)
+         * @param[in] label The label of the boundary of Plane
+         */
+        static void ClipToHalfPlane(const HalfPlane &Plane, const double tolerance, std::vector<Point> &Vertices, std::vector<Point> &Buffer, std::vector<int> *Labels = NULL, std::vector<int> *LabelBuffer = NULL, const int label = -1);
         
     private:
         double minx;/**< The minimum x coordinate of the polygon*/
@@ -243,15 +376,28 @@ namespace AreaCon {
         double maxy;/**< The maximum y coordinate of the polygon*/
         std::vector<Point> Vertices;/**< The Vertices of the polygon*/
         int NPoly;/**< The number of vertices that the polygon has*/
+        bool Convex;/**< Flag indicating whether the polygon is convex (see CreateEdgePlanes)*/
+        std::vector<HalfPlane> Edge_Planes;/**< The outward half-planes of the edges, with unit normals, where the ii-th entry belongs to the edge from the ii-th vertex to the next one. Only used if Convex is true.*/
+        std::vector<double> Edge_Lengths;/**< The lengths of the edges, which scale the tolerance of the boundary test*/
         /**
          * A function used to initialize the polygon by calculating extrema and running checks for dimensional consistency.
          */
         void InitializePoly(void);
+        /**
+         * Determines whether the polygon is convex and, if so, stores the half-planes of its edges in Edge_Planes.
+         */
+        void CreateEdgePlanes(void);
+        /**
+         * The point-in-polygon test for convex polygons. Points whose distance to an edge is small relative to the length of the edge (see Point::Robustness_Constant) are treated as lying on the edge, as in pnpoly.
+         * @param[in] Test The test point
+         * @return Indicator of whether or not Test is inside the polygon
+         */
+        bool ContainsConvex(const Point &Test) const;
     };
     // Mult_Array Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     /**
-     * Container for storing two-dimensional arrays of size NxN.
+     * Container for storing two-dimensional arrays of size NxN. The entries are kept in a single row-major allocation.
      * @author Jeffrey R. Peters
      */
     class Mult_Array
@@ -261,28 +407,60 @@ namespace AreaCon {
         /**
          * Constructor
          * @param[in] N The size of the array
+         * @param[in] value The initial value of every entry
          */
-        Mult_Array(const int N);
+        Mult_Array(const int N = 0, const double value = 0);
         /** Copy Constructor
          * @param[in] obj Element to by copied
          */
-        Mult_Array(const Mult_Array &obj);
+        Mult_Array(const Mult_Array &obj) = default;
+        /** Move Constructor. Leaves obj as an empty array.
+         * @param[in] obj Element to be moved
+         */
+        Mult_Array(Mult_Array &&obj);
         /** Copy Assignment Operator
          * @param[in] obj Element to by copied
          */
-        Mult_Array& operator=(const Mult_Array &obj);
+        Mult_Array& operator=(const Mult_Array &obj) = default;
+        /** Move Assignment Operator. Leaves obj as an empty array.
+         * @param[in] obj Element to be moved
+         */
+        Mult_Array& operator=(Mult_Array &&obj);
+        //@}
+        /**
+         * Resizes the array, keeping the allocated storage whenever possible. All entries are set to value.
+         * @param[in] N The new size of the array
+         * @param[in] value The value of every entry
+         */
+        void Assign(const int N, const double value = 0);
+        /**
+         * @return The size of the array
+         */
+        int GetN(void) const{return N;}
+        //@{
+        /**
+         * @param[in] ii, jj The row and column of the entry
+         * @return The (ii,jj)-th entry
+         */
+        double& operator()(const int ii, const int jj){return Array[(size_t) N*ii+jj];}
+        const double& operator()(const int ii, const int jj) const{return Array[(size_t) N*ii+jj];}
+        //@}
+        //@{
         /**
-         * Destructor. Cleans up dynamically allocated memory.
+         * @param[in] ii The row
+         * @return A pointer to the first entry of row ii, so that A[ii][jj] is the (ii,jj)-th entry
          */
-        ~Mult_Array(void);
+        double* operator[](const int ii){return &Array[(size_t) N*ii];}
+        const double* operator[](const int ii) const{return &Array[(size_t) N*ii];}
         //@}
-        double **Array;/**<A two-dimensional array*/
-        const int N;/**<The size of the array.*/
+    private:
+        int N;/**<The size of the array.*/
+        std::vector<double> Array;/**<The entries of the array in row-major order*/
     };
     // Delaunay Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     /**
-     * Container for storing Delaunay (duel) graphs.
+     * Container for storing Delaunay (duel) graphs as a dense NRegions x NRegions array of line segments, kept in a single row-major allocation. The sparse SparseAdjacency is preferable for all but the smallest partitions.
      * @author Jeffrey R. Peters
      */
     class DelaunayGraph
@@ -290,26 +468,173 @@ namespace AreaCon {
     public:
         //@{
         /**
-         * Constructor.
+         * Constructor. Every entry is initialized to a pair of infinite points, i.e., no regions share an edge.
          * @param[in] NRegions The number of regions in the partition or the number of nodes in the Delaunay graph
          */
-        DelaunayGraph(const int NRegions);
+        DelaunayGraph(const int NRegions = 0);
         /** Copy Constructor
          * @param[in] obj Element to by copied
          */
-        DelaunayGraph(const DelaunayGraph &obj);
+        DelaunayGraph(const DelaunayGraph &obj) = default;
+        /** Move Constructor. Leaves obj as an empty graph.
+         * @param[in] obj Element to be moved
+         */
+        DelaunayGraph(DelaunayGraph &&obj);
         /** Copy Assignment Operator
          * @param[in] obj Element to by copied
          */
-        DelaunayGraph& operator=(const DelaunayGraph &obj);
+        DelaunayGraph& operator=(const DelaunayGraph &obj) = default;
+        /** Move Assignment Operator. Leaves obj as an empty graph.
+         * @param[in] obj Element to be moved
+         */
+        DelaunayGraph& operator=(DelaunayGraph &&obj);
+        //@}
+        /**
+         * Resizes the graph, keeping the allocated storage whenever possible, and removes all edges.
+         * @param[in] NRegions The new number of nodes
+         */
+        void Clear(const int NRegions);
+        /**
+         * @return The number of nodes
+         */
+        int GetNRegions(void) const{return NRegions;}
+        //@{
+        /**
+         * @param[in] ii, jj The indices of the two regions
+         * @return A pointer to the two endpoints of the line segment that is shared by region ii and region jj. If the two regions do not share a common edge, then at least 1 index of one of the endpoints will equal INFINITY.
+         */
+        Point* operator()(const int ii, const int jj){return &Graph[2*((size_t) NRegions*ii+jj)];}
+        const Point* operator()(const int ii, const int jj) const{return &Graph[2*((size_t) NRegions*ii+jj)];}
+        //@}
+    private:
+        int NRegions;/**<The number of regions under consideration.*/
+        std::vector<Point> Graph;/**<The endpoints of all line segments, two per pair of regions, in row-major order*/
+    };
+    // SparseAdjacency Class--------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Container for storing Delaunay (dual) graphs in compressed sparse row form. The edges of row i are stored contiguously at the positions Offsets[i],...,Offsets[i+1]-1 of Neighbors, Starts and Ends, and every edge of the graph appears in exactly one row. Rows are filled in order with AddEdge and EndRow; Clear keeps the allocated storage so that the container can be refilled every iteration.
+     */
+    class SparseAdjacency
+    {
+    public:
+        //@{
         /**
-         * Destructor. Cleans up dynamically allocated memory.
+         * Constructor. Creates an empty graph without rows.
          */
-        ~DelaunayGraph();
+        SparseAdjacency(void);
         //@}
+        /**
+         * Removes all rows and edges, keeping the allocated storage.
+         * @param[in] NRows The number of rows that will be added
+         */
+        void Clear(const int NRows = 0);
+        /**
+         * Adds an edge to the row that is currently being filled.
+         * @param[in] Neighbor The index of the other node of the edge
+         * @param[in] Start, End The endpoints of the line segment shared by the two nodes
+         */
+        void AddEdge(const int Neighbor, const Point &Start, const Point &End);
+        /**
+         * Closes the row that is currently being filled. Later calls to AddEdge add edges to the next row.
+         */
+        void EndRow(void);
+        /**
+         * @return The number of completed rows
+         */
+        int GetNRows(void) const{return (int) Offsets.size()-1;}
+        /**
+         * @return The total number of edges
+         */
+        int GetNEdges(void) const{return (int) Neighbors.size();}
         
-        Point ***Graph;/**<A multi-dimensional array whose (i,j)-th entry holds the endpoints of the line segment that is shared by region i and region j. If the two regions do not share a common edge, then at least 1 index of the (i,j)-th entry will equal INFINITY.*/
-        const int NRegions;/**<The number of regions under consideration.*/
+        std::vector<int> Offsets;/**<The start of every row in Neighbors, Starts and Ends, followed by the total number of edges*/
+        std::vector<int> Neighbors;/**<The index of the other node of every edge*/
+        std::vector<Point> Starts;/**<The first endpoint of the shared line segment of every edge*/
+        std::vector<Point> Ends;/**<The second endpoint of the shared line segment of every edge*/
+    };
+    // CenterGrid Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * A uniform bucket grid over a set of points, used for visiting the centers of a partition in order of increasing distance when constructing power diagrams.
+     */
+    class CenterGrid
+    {
+    public:
+        //@{
+        /**
+         * Constructor.
+         * @param[in] Points The points to be stored in the grid.
+         * @param[in] minx, miny, maxx, maxy The extrema of the area covered by the grid. Points outside of these bounds are stored in the nearest bucket.
+         */
+        CenterGrid(const std::vector<Point> &Points, const double minx, const double miny, const double maxx, const double maxy);
+        //@}
+        /**
+         * Finds the indices of the points stored in the buckets that lie exactly ring buckets away (in the infinity norm) from the bucket containing the ii-th point. Every point that is not contained in rings 0,...,ring lies at least a distance ring*GetBucketSize() away from the ii-th point.
+         * @param[in] ii The index of the point at the middle of the ring
+         * @param[in] ring The ring number (ring = 0 is the bucket containing the ii-th point)
+         * @param[out] Indices The indices of the points in the ring (appended)
+         */
+        void GetRing(const int ii, const int ring, std::vector<int> &Indices) const;
+        /**
+         * @return The side length of the (square) buckets
+         */
+        double GetBucketSize(void) const {return h;};
+        /**
+         * @return The largest ring number that contains buckets for any point in the grid
+         */
+        int GetMaxRing(void) const {return std::max(Nx,Ny);};
+    private:
+        double minx;/**< The minimum x coordinate covered by the grid*/
+        double miny;/**< The minimum y coordinate covered by the grid*/
+        double h;/**< The side length of each bucket*/
+        int Nx;/**< The number of buckets in the x direction*/
+        int Ny;/**< The number of buckets in the y direction*/
+        std::vector<int> BucketStart;/**< The (Ny*i+j)-th entry holds the position in BucketPoints at which the points of the (i,j)-th bucket begin. The last entry is the total number of points.*/
+        std::vector<int> BucketPoints;/**< The indices of the stored points, ordered by bucket*/
+        std::vector<int> PointBucket;/**< The index of the bucket containing each point*/
+    };
+    // CellWorkspace Class----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Scratch space used for constructing the regions of a power diagram one at a time. Every worker thread owns one workspace, so that repeated constructions do not allocate once the buffers are large enough.
+     */
+    class CellWorkspace
+    {
+    public:
+        //@{
+        /**
+         * Constructor.
+         */
+        CellWorkspace(void):Clip_Calls(0){};
+        //@}
+        //@{
+        std::vector<Point> Vertices;/**<The vertices of the region under construction*/
+        std::vector<int> Labels;/**<The labels of the edges of the region under construction (see Poly::ClipToHalfPlane)*/
+        std::vector<Point> Buffer;/**<Scratch space for clipping*/
+        std::vector<int> LabelBuffer;/**<Scratch space for clipping*/
+        std::vector<int> Candidates;/**<Scratch space for center indices*/
+        long Clip_Calls;/**<The number of power bisectors tested against the region since the counter was last reset (see PartitionStats)*/
+        //@}
+    };
+    // PartitionWorkspace Class------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The scratch space of a Partition, i.e., the buffers whose contents do not outlive a single step of the algorithm. The workspace can be exchanged between partitions (see Partition::SwapWorkspace), so that problems solved one after another re-use the same buffers (see BatchSolver).
+     */
+    class PartitionWorkspace
+    {
+    public:
+        //@{
+        std::vector<CellWorkspace> Cells;/**<The workspaces used by the worker threads for constructing regions of power diagrams*/
+        std::vector<double> Weight_Totals; /**<Scratch space for the weight gradient accumulated by Partition::GradientStepWeights.*/
+        std::vector<double> Edge_Values; /**<Scratch space for the contribution of every edge of the Delaunay graph to the weight gradient.*/
+        std::vector<double> Newton_Direction; /**<Scratch space for the Newton step computed by Partition::NewtonStepWeights.*/
+        std::vector<double> Newton_Weights; /**<Scratch space for the weights at the start of the line search in Partition::NewtonStepWeights.*/
+        std::vector<double> Center_Errors; /**<Scratch space for the distance of every center to its centroid in Partition::GradientStepCenter.*/
+        std::vector<int> Incidence_Offsets; /**<The start of the edges of every node in Incidence (see Partition::AccumulateEdgeValues).*/
+        std::vector<int> Incidence; /**<The indices of the edges of the Delaunay graph incident to every node, in increasing order.*/
+        //@}
     };
     // Int_Params Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
@@ -322,8 +647,10 @@ namespace AreaCon {
     public:
         //@{
         std::vector<double> Coefficient_a, Coefficient_b, Coefficient_c, Coefficient_d;/**<Coefficients used in quickly calculating area integrals. Usually populated as a part of the function Density.FindIntegralCoefficients.*/
-        std::vector<double> Int, Intx, Inty;/**<Parameters representing area integrals over grid squares. Int represents the total integral, Intx represents the integral of x*f(x,y), and Inty represents the integral of y*f(x,y). Usually populated as a part of the function Density.FindIntegralVector.*/
+        std::vector<double> Int, Intx, Inty;/**<Parameters representing area integrals over grid squares. Int represents the total integral, Intx represents the integral of x*f(x,y), and Inty represents the integral of y*f(x,y), where f are the values of the density before normalization (see Density::GetVolumeScale). Usually populated as a part of the function Density.FindIntegralVector.*/
+        std::vector<double> Int_Prefix, Intx_Prefix, Inty_Prefix;/**<Prefix sums of Int, Intx and Inty along the columns of grid squares. The (Ny*i+j)-th entry holds the sum over the grid squares with lower-left grid points (i,0),...,(i,j-1), so that the sum over any contiguous span of a column is the difference of two entries. Usually populated as a part of the function Density.CreatePrefixSums.*/
         double Unweighted_Area; /**<The overall area of some polygonal region of interest*/
+        std::vector<float> Compact;/**<The integrals over the grid squares in compact storage mode (see Density::SetCompactStorage), in which Coefficient_a,...,Inty_Prefix are empty. The (3*k)-th, (3*k+1)-th and (3*k+2)-th entries hold the integrals of f, (x-x0)*f and (y-y0)*f over the k-th grid square, where (x0,y0) is its lower-left grid point.*/
         //@}
         
         //@{
@@ -345,6 +672,120 @@ namespace AreaCon {
          */
         void CheckParameters(void) const;
     };
+    // ThreadPool Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * A fixed-size pool of worker threads used for carrying out independent per-region computations in parallel.
+     */
+    class ThreadPool
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Starts NThreads-1 worker threads; the thread calling ParallelFor acts as the remaining worker.
+         * @param[in] NThreads The total number of threads used by ParallelFor (0 uses the number of hardware threads)
+         */
+        ThreadPool(const int NThreads);
+        /**
+         * Destructor. Stops and joins the worker threads.
+         */
+        ~ThreadPool(void);
+        //@}
+        /**
+         * @return The total number of threads used by ParallelFor
+         */
+        int GetNThreads(void) const {return NThreads;};
+        /**
+         * Calls Task(index, worker) for every index = 0,...,N-1 and waits for all calls to complete. The tasks are distributed dynamically, and worker (0 <= worker < GetNThreads()) identifies the calling thread, so that tasks can use per-thread scratch space. If a task throws, the first exception is re-thrown once all tasks have finished.
+         * @param[in] N The number of tasks
+         * @param[in] Task The task to be carried out
+         */
+        void ParallelFor(const int N, const std::function<void(const int index, const int worker)> &Task);
+    private:
+        ThreadPool(const ThreadPool &obj);/**<Not copyable*/
+        ThreadPool& operator=(const ThreadPool &obj);/**<Not copyable*/
+        /**
+         * The loop carried out by each worker thread.
+         * @param[in] worker The index of the worker
+         */
+        void WorkerLoop(const int worker);
+        /**
+         * Carries out tasks of the current job until none are left.
+         * @param[in] worker The index of the worker
+         */
+        void RunTasks(const int worker);
+        int NThreads;/**<The total number of threads*/
+        std::vector<std::thread> Workers;/**<The worker threads*/
+        std::mutex Mutex;/**<Protects the job state*/
+        std::mutex CallMutex;/**<Serializes calls to ParallelFor*/
+        std::condition_variable JobStarted;/**<Signals the workers that a job is available*/
+        std::condition_variable JobFinished;/**<Signals the caller that all workers are done*/
+        const std::function<void(const int, const int)> *Task;/**<The current job*/
+        int NTasks;/**<The number of tasks in the current job*/
+        std::atomic<int> NextTask;/**<The next task to be handed out*/
+        int NBusy;/**<The number of workers still working on the current job*/
+        long Generation;/**<Incremented for every job*/
+        bool Stop;/**<Flag used to stop the workers*/
+        std::exception_ptr Error;/**<The first exception thrown by a task*/
+    };
+    /**
+     * The methods available for constructing power diagrams (see Partition::CreatePowerDiagram).
+     */
+    enum PowerDiagramMethod {
+        All_Pairs,/**<Every region is clipped against the power bisector of every other center, i.e., O(N^2) clipping operations per diagram.*/
+        Nearest_Neighbors/**<Every region is clipped only against nearby centers, which are visited in order of increasing distance until no remaining center can contribute to the boundary of the region.*/
+    };
+    /**
+     * The methods available for integrating the density over the regions of a partition (see Partition::CalculateVolumes).
+     */
+    enum IntegrationMethod {
+        Per_Region,/**<Each region is integrated separately (see Density::CalculateWeightedArea and Density::CalculateCentroid).*/
+        Ownership_Map,/**<All regions are integrated at once by labelling every grid square with the region that contains it (see Density::CalculateCoveringIntegrals).*/
+        Column_Spans,/**<Each region is integrated separately by summing the spans of grid squares it covers in every column from pre-computed prefix sums, so that the cost scales with the number of grid columns spanned by the region rather than its area (see Density::CalculateSpanIntegrals).*/
+        Device_Spans/**<The regions are integrated as in Column_Spans, but all column spans of all regions are found and reduced at once by data-parallel kernels (see Density::CalculateDeviceIntegrals). If the library is compiled with AREACON_OFFLOAD and OpenMP offloading, the kernels run on the default accelerator and the prefix sums stay in device memory between calls.*/
+    };
+    /**
+     * The methods available for updating the weights in the volumetric iterations of Partition::CalculatePartition.
+     */
+    enum WeightUpdateMethod {
+        Gradient_Descent,/**<The weights take a step of fixed size weights_step along the negative gradient (see Partition::GradientStepWeights), i.e., every step requires one power diagram.*/
+        Newton/**<The weights take a Newton step for the volume equations, whose Jacobian is the graph Laplacian of the Delaunay graph weighted by the boundary line integrals (see Partition::NewtonStepWeights). The step is damped by a backtracking line search, so that each step requires one or (rarely) a few power diagrams, but far fewer steps are needed. Newton steps rely on volumes that vary smoothly with the weights, so exact_integration is recommended.*/
+    };
+    // MappedFile Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Read-only view of the contents of a file. On POSIX systems the file is memory-mapped, so that its pages are only read from disk when they are accessed; elsewhere it is read into memory.
+     */
+    class MappedFile
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Maps the file.
+         * @param[in] filename The file
+         */
+        MappedFile(const std::string filename);
+        /**
+         * Destructor. Unmaps the file.
+         */
+        ~MappedFile(void);
+        MappedFile(const MappedFile &Other) = delete;
+        MappedFile &operator=(const MappedFile &Other) = delete;
+        //@}
+        /**
+         * @return The contents of the file
+         */
+        const char *GetData(void) const {return Data;};
+        /**
+         * @return The size of the file in bytes
+         */
+        size_t GetSize(void) const {return Size;};
+    private:
+        const char *Data;/**<The contents of the file*/
+        size_t Size;/**<The size of the file in bytes*/
+        bool Mapped;/**<Flag indicating whether Data is a memory mapping (otherwise it points into Buffer)*/
+        std::vector<char> Buffer;/**<The contents of the file if it could not be mapped*/
+    };
     // Parameters Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     class Parameters
@@ -361,9 +802,18 @@ namespace AreaCon {
          * @param[in] max_iterations_volume Upper bound on the number of volumetric iterations
          * @param[in] max_iterations_centers Upper bound on the number of centroidal movement iterations
          * @param[in] Volume_Lower_Bound A lower bound on the weighted area of each region
-         * @param[in] Robustness_Constant A constant used to enhace numerical robustness (see Point class)
-         */
-        Parameters(const double line_int_step = 0.1,const double weights_step = 0.1, const double centers_step = 1,const double volume_tolerance = 0.002, const double convergence_criterion = 0.02, const int max_iterations_volume = 200, const int max_iterations_centers = 500, const double Volume_Lower_Bound = 10e-6, const double Robustness_Constant = 10e-8);
+         * @param[in] Robustness_Constant A constant used to enhace numerical robustness (see Point class). It is installed for the calling thread only during the calls of the Partition that owns the parameters (see RobustnessScope).
+         * @param[in] diagram_method The method used to construct power diagrams
+         * @param[in] num_threads The number of threads used for parallel computations (1 = serial, 0 = the number of hardware threads)
+         * @param[in] integration_method The method used to integrate the density over the regions
+         * @param[in] exact_integration Flag indicating whether grid squares straddling region boundaries are integrated exactly (see Density::SetExactIntegration)
+         * @param[in] incremental_diagram Flag indicating whether power diagrams are updated incrementally when only the weights have changed (Nearest_Neighbors only, see Partition::UpdatePowerDiagram)
+         * @param[in] exact_line_integral Flag indicating whether line integrals are evaluated exactly (see Density::ExactLineIntegral) instead of sampled with line_int_step
+         * @param[in] verbosity The amount of progress information printed to std::cout by Partition (0 = nothing, 1 = warnings and center iterations, 2 = also volume iterations, 3 = also all weights)
+         * @param[in] weights_method The method used to update the weights (weights_step is only used by Gradient_Descent)
+         * @param[in] pyramid_levels The number of levels of the density pyramid used by Partition::CalculatePartition (1 = the full resolution only). Each coarser level halves the resolution of the grid (see Density::Downsample) and is solved before the next finer one, starting from its centers and weights. Coarse levels only pay off if the volumes can be resolved on the coarse grids, i.e., with exact_integration.
+         */
+        Parameters(const double line_int_step = 0.1,const double weights_step = 0.1, const double centers_step = 1,const double volume_tolerance = 0.002, const double convergence_criterion = 0.02, const int max_iterations_volume = 200, const int max_iterations_centers = 500, const double Volume_Lower_Bound = 10e-6, const double Robustness_Constant = 10e-8, const PowerDiagramMethod diagram_method = All_Pairs, const int num_threads = 1, const IntegrationMethod integration_method = Per_Region, const bool exact_integration = false, const bool incremental_diagram = false, const bool exact_line_integral = false, const int verbosity = 0, const WeightUpdateMethod weights_method = Gradient_Descent, const int pyramid_levels = 1);
         //@}
         //@{
         const double line_int_step;/**<Spacing parameter used for calculating line integrals*/
@@ -376,6 +826,15 @@ namespace AreaCon {
         
         const double Volume_Lower_Bound;
         const double Robustness_Constant;
+        const PowerDiagramMethod diagram_method;/**<The method used to construct power diagrams*/
+        const int num_threads;/**<The number of threads used for parallel computations (1 = serial, 0 = the number of hardware threads)*/
+        const IntegrationMethod integration_method;/**<The method used to integrate the density over the regions*/
+        const bool exact_integration;/**<Flag indicating whether grid squares straddling region boundaries are integrated exactly (see Density::SetExactIntegration)*/
+        const bool incremental_diagram;/**<Flag indicating whether power diagrams are updated incrementally when only the weights have changed (Nearest_Neighbors only, see Partition::UpdatePowerDiagram)*/
+        const bool exact_line_integral;/**<Flag indicating whether line integrals are evaluated exactly (see Density::ExactLineIntegral) instead of sampled with line_int_step*/
+        const int verbosity;/**<The amount of progress information printed to std::cout by Partition (0 = nothing, 1 = warnings and center iterations, 2 = also volume iterations, 3 = also all weights)*/
+        const WeightUpdateMethod weights_method;/**<The method used to update the weights*/
+        const int pyramid_levels;/**<The number of levels of the density pyramid used by Partition::CalculatePartition (1 = the full resolution only)*/
         //@}
     private:
         /**
@@ -384,99 +843,397 @@ namespace AreaCon {
         void CheckParameters(void);
     };
     
-    // Density Class--------------------------------------------------------------------------------------------------
+    // DeviceTables Class-----------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     /**
-     * The base class for defining probability density functions.
-     * @author Jeffrey R. Peters
+     * The prefix sums of a Density (see Int_Params) as used by the kernels of Density::CalculateDeviceIntegrals. If the library is compiled with AREACON_OFFLOAD, the arrays are copied to the memory of the default OpenMP device at construction and released at destruction; otherwise the kernels read the host arrays directly.
      */
-    class Density
+    class DeviceTables
     {
     public:
         //@{
         /**
-         * Default Constructor.
+         * Constructor. Copies the prefix sums to the device.
+         * @param[in] Integral The tables of the density (they must outlive the DeviceTables)
          */
-        Density();
+        DeviceTables(const Int_Params &Integral);
         /**
-         * @param[in] Region The (convex) polygonal region of interest.
-         * @param[in] Nx The number of grid points in the x direction.
-         * @param[in] Ny The number of grid points in the y direction.
-         * @param[in] Values A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+         * Destructor. Releases the device memory.
          */
-        Density(const Poly Region, const int Nx = 0, const int Ny = 0, const std::vector<double> Values = {});
+        ~DeviceTables(void);
+        DeviceTables(const DeviceTables &Other) = delete;
+        DeviceTables &operator=(const DeviceTables &Other) = delete;
         //@}
-        /** Function used to set a new polygonal region of interest.
-         * @param[in] Region The (convex) polygonal region of interest.
-         * @param[in] Nx The number of grid points in the x direction.
-         * @param[in] Ny The number of grid points in the y direction.
-         * @param[in] Values A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+        /**
+         * @param[in] Integral The tables of a density
+         * @return Indicator of whether the device copy belongs to the arrays of Integral
          */
-        void SetNewRegion(const Poly Region, const int Nx = 0, const int Ny = 0, const std::vector<double> Values = {});
+        bool IsCurrent(const Int_Params &Integral) const {return Int_Prefix == Integral.Int_Prefix.data() && Size == Integral.Int_Prefix.size();};
+        //@{
+        const double *Int_Prefix;/**<The host address of Int_Params::Int_Prefix (the device copy is found from it)*/
+        const double *Intx_Prefix;/**<The host address of Int_Params::Intx_Prefix*/
+        const double *Inty_Prefix;/**<The host address of Int_Params::Inty_Prefix*/
+        size_t Size;/**<The number of entries of each array*/
+        //@}
         /**
-         * Function used to re-set the values of the grid-parameters.
-         * @param[in] Nx The number of grid points in the x direction.
-         * @param[in] Ny The number of grid points in the y direction.
-         * @param[in] Values A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+         * A vertex of a polygon as sent to the device (Point is not a mappable type because of its static member).
          */
-        void SetParameters(const int Nx,const int Ny,const std::vector<double> Values);
+        struct Vertex
+        {
+            double x, y;/**<The coordinates*/
+        };
+    };
+    // DeviceCache Class------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The DeviceTables of a Density, created on first use by Density::CalculateDeviceIntegrals. The tables belong to the arrays of one density, so a copy of the cache (and of the density) starts out empty. Concurrent first uses are serialized, so that the tables are created only once.
+     */
+    class DeviceCache
+    {
+    public:
+        //@{
         /**
-         * @return Nx
+         * Constructors and assignment. The tables are never copied.
          */
-        int GetNx(void) const {return Nx;};
+        DeviceCache(void){};
+        DeviceCache(const DeviceCache &Other){};
+        DeviceCache &operator=(const DeviceCache &Other){Reset(); return *this;};
+        //@}
         /**
-         * @return Ny
+         * @param[in] Integral The tables of the density
+         * @return The device copy of the prefix sums of Integral, which is created if the cache is empty or belongs to other arrays
          */
-        int GetNy(void) const {return Ny;};;
+        std::shared_ptr<const DeviceTables> Get(const Int_Params &Integral);
         /**
-         * @return Region
+         * Releases the device copy. Must be called whenever the arrays of the density change.
          */
-        Poly GetRegion(void) const {return Region;};;
+        void Reset(void);
+    private:
+        std::mutex Mutex;/**<Protects Tables*/
+        std::shared_ptr<const DeviceTables> Tables;/**<The device copy (null if not created yet)*/
+    };
+    // DensityFunction Class------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The interface through which a Partition integrates a density that it does not own (see Partition::Partition). It is implemented by Density and TiledDensity; the integrals of the implementations are normalized so that the total volume of the region of interest is 1.
+     */
+    class DensityFunction
+    {
+    public:
+        //@{
         /**
-         * @return GridInRegion
+         * Destructor.
          */
-        std::vector<bool> GetGridInRegion(void) const {return GridInRegion;};
+        virtual ~DensityFunction(void){};
+        //@}
         /**
-         * @return Integral
+         * @return The region of interest
          */
-        Int_Params GetIntegral(void) const {return Integral;};
+        virtual const Poly &GetRegion(void) const = 0;
         /**
-         * Returns the extreme x and y values.
+         * Returns the extreme x and y values of the region of interest.
          * @param[out] minx, miny, maxx, maxy
          */
-        void GetExtrema (double &minx, double &miny, double &maxx, double &maxy) const {minx = this->minx; miny = this->miny; maxx = this->maxx; maxy = this->maxy;}
+        virtual void GetExtrema(double &minx, double &miny, double &maxx, double &maxy) const = 0;
+        /**
+         * @return The factor by which line integrals of the density values are divided to obtain derivatives of the volumes
+         */
+        virtual double GetVolumeScale(void) const = 0;
+        /**
+         * Sets the lower volume bound.
+         * @param[in] VolumeLowerBound The new bound value;
+         */
+        virtual void SetVolumeLowerBound(const double VolumeLowerBound) = 0;
         /**
          * Calculates the line integral of the density function over the straight line connecting points p1, p2
          * @param[in] spacing The spacing between evaluation points
          * @param[in] p1, p2 The endpoints of the line in question
          * @return The value of the line integral
          */
-        double LineIntegral(double spacing, const Point &p1, const Point &p2) const;
+        virtual double LineIntegral(double spacing, const Point &p1, const Point &p2) const = 0;
         /**
          * Evaluates the integral of the density over the polygon Region
          * @param[in] Region The polygon over which the integral is evaluated
          * @return The weighted area of the region
          */
-        double CalculateWeightedArea(const Poly Region) const;
+        virtual double CalculateWeightedArea(const Poly &Region) const = 0;
         /**
          * Calculates the centroid of the polygon Region with respect to the density
          * @param[in] Region The polygon of interest
          * @param[in] Volume The total volume of the region in question
          * @return The location of the centroid
          */
-        Point CalculateCentroid(const Poly Region, const double &Volume) const;
+        virtual Point CalculateCentroid(const Poly &Region, const double &Volume) const = 0;
         /**
-         * Sets the lower volume bound (default = 0). This bound is used to avoid numerical instability in partition calculations.
-         * @param[in] VolumeLowerBound The new bound value;
+         * Calculates the weighted area and the centroid of the polygon Region with a single traversal of the grid.
+         * @param[in] Region The polygon of interest
+         * @param[out] Volume The weighted area of the region
+         * @param[out] Centroid The location of the centroid
          */
-        void SetVolumeLowerBound(const double VolumeLowerBound);
+        virtual void CalculateVolumeAndCentroid(const Poly &Region, double &Volume, Point &Centroid) const = 0;
+    };
+    // Density Class--------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The base class for defining probability density functions.
+     * @author Jeffrey R. Peters
+     */
+    class Density : public DensityFunction
+    {
+    public:
+        //@{
         /**
-         * Returns the lower volume bound.
-         * @return Volume_Lower_Bound;
+         * Default Constructor.
          */
-        double GetVolumeLowerBound(void);
-        
-        void WriteToFile(const std::string filename)const;
+        Density();
+        /**
+         * @param[in] Region The (convex) polygonal region of interest.
+         * @param[in] Nx The number of grid points in the x direction.
+         * @param[in] Ny The number of grid points in the y direction.
+         * @param[in] Values A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+         * @param[in] num_threads The number of threads used for pre-processing the grid (see SetNumThreads)
+         * @param[in] compact_storage Flag indicating whether the pre-computed integrals are stored compactly (see SetCompactStorage)
+         */
+        Density(Poly Region, const int Nx = 0, const int Ny = 0, std::vector<double> Values = {}, const int num_threads = 1, const bool compact_storage = false);
+        //@}
+        /** Function used to set a new polygonal region of interest.
+         * @param[in] Region The (convex) polygonal region of interest.
+         * @param[in] Nx The number of grid points in the x direction.
+         * @param[in] Ny The number of grid points in the y direction.
+         * @param[in] Values A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+         */
+        void SetNewRegion(Poly Region, const int Nx = 0, const int Ny = 0, std::vector<double> Values = {});
+        /**
+         * Function used to re-set the values of the grid-parameters.
+         * @param[in] Nx The number of grid points in the x direction.
+         * @param[in] Ny The number of grid points in the y direction.
+         * @param[in] Values A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+         */
+        void SetParameters(const int Nx,const int Ny,std::vector<double> Values);
+        /**
+         * Changes the values of the density at a rectangle of grid points without repeating the full pre-processing of SetParameters. Only the grid squares with a corner in the rectangle and the prefix sums of their columns are re-computed; since the integrals are stored unnormalized, a change of the total integral over the region of interest only changes the normalization. The result is the same as that of SetParameters with the new values.
+         * @param[in] i0, j0 The indices of the first grid point of the rectangle
+         * @param[in] i1, j1 The indices of the last grid point of the rectangle (inclusive)
+         * @param[in] Block The new values at the grid points of the rectangle (the value at the (i,j)-th grid point is stored in the ((j1-j0+1)*(i-i0)+j-j0)-th entry of Block)
+         */
+        void UpdateValues(const int i0, const int j0, const int i1, const int j1, const std::vector<double> &Block);
+        /**
+         * Changes the values of the density at all grid points, re-computing only the grid squares inside the bounding rectangle of the grid points whose values have changed (see UpdateValues(i0, j0, i1, j1, Block)).
+         * @param[in] Values A vector containing the new value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.
+         */
+        void UpdateValues(const std::vector<double> &Values);
+        /**
+         * Creates a density over the same region with half the resolution, i.e., with (Nx+1)/2 by (Ny+1)/2 grid points. Every coarse value is a weighted average of the fine values around it, with the separable tent filter whose support extends to the neighboring coarse grid points (see DownsampleWeights). If Nx and Ny are odd, the coarse grid points are every other grid point and the filter is the full-weighting stencil [1 2 1]/4 in each direction, so that features narrower than the coarse spacing are averaged instead of sampled. The threads and integration settings are shared with the coarse density.
+         * @return The coarse density
+         */
+        Density Downsample(void) const;
+        /**
+         * @return Nx
+         */
+        int GetNx(void) const {return Nx;};
+        /**
+         * @return Ny
+         */
+        int GetNy(void) const {return Ny;};;
+        /**
+         * @return Region
+         */
+        const Poly &GetRegion(void) const {return Region;};
+        /**
+         * @return Values
+         */
+        const std::vector<double> &GetValues(void) const {return Values;};
+        /**
+         * Sets the number of threads used for pre-processing the grid in SetParameters and for the host kernels of CalculateDeviceIntegrals. The threads are shared by all copies of the density. All other integration and interpolation remains serial, so that it can be called from the threads of a Partition.
+         * @param[in] num_threads The number of threads (1 = serial, 0 = the number of hardware threads)
+         */
+        void SetNumThreads(const int num_threads);
+        /**
+         * @return A vector whose entries indicate whether or not grid points lie within Region. If the (i,j)-th grid point lies within the polygonal region of interest, then the (Ny*i+j)-th entry is true, otherwise it is false.
+         */
+        std::vector<bool> GetGridInRegion(void) const;
+        /**
+         * @param[in] ii, jj The indices of a grid point
+         * @return Indicator of whether the (ii,jj)-th grid point lies within Region
+         */
+        bool IsGridPointInRegion(const int ii, const int jj) const {return (Region_Bits[(size_t) ii*Bit_Stride+jj/64] >> (jj%64)) & 1;};
+        /**
+         * @return Integral
+         */
+        const Int_Params &GetIntegral(void) const {return Integral;};
+        /**
+         * @return Region_Bits, the bitset indicating which grid points lie within Region (see IsGridPointInRegion). Unlike GetGridInRegion, no copy is made.
+         */
+        const std::vector<std::uint64_t> &GetRegionBits(void) const {return Region_Bits;};
+        /**
+         * Returns the extreme x and y values.
+         * @param[out] minx, miny, maxx, maxy
+         */
+        void GetExtrema (double &minx, double &miny, double &maxx, double &maxy) const {minx = this->minx; miny = this->miny; maxx = this->maxx; maxy = this->maxy;}
+        /**
+         * Calculates the line integral of the density function over the straight line connecting points p1, p2
+         * @param[in] spacing The spacing between evaluation points
+         * @param[in] p1, p2 The endpoints of the line in question
+         * @return The value of the line integral
+         */
+        double LineIntegral(double spacing, const Point &p1, const Point &p2) const;
+        /**
+         * Calculates the line integral of the density function over the straight line connecting points p1, p2 exactly. The line is traversed through the grid one square at a time, and the bilinear interpolant of each square is integrated in closed form over the piece of the line inside it. The cost is proportional to the number of grid squares crossed.
+         * @param[in] p1, p2 The endpoints of the line in question
+         * @return The value of the line integral
+         */
+        double ExactLineIntegral(const Point &p1, const Point &p2) const;
+        /**
+         * Calculates the line integrals of the density function over several straight lines at once, using the same sampling as LineIntegral. The line parameters of the evaluation points are computed once, and the points of every line are interpolated in a single call to InterpolateValues.
+         * @param[in] spacing The spacing between evaluation points
+         * @param[in] NLines The number of lines
+         * @param[in] Starts, Ends Arrays holding the endpoints of the lines in question
+         * @param[out] Results An array receiving the value of the line integral of every line
+         */
+        void LineIntegrals(double spacing, const int NLines, const Point *Starts, const Point *Ends, double *Results) const;
+        /**
+         * Evaluates the bilinear interpolant of the density at a batch of points given as separate arrays of x and y coordinates. Points outside of the grid use the polynomial of the nearest grid square. If the library is compiled with AVX2 (e.g., with AREACON_NATIVE), four points at a time are evaluated and their corner values are gathered with _mm256_i32gather_pd; on AArch64, two points at a time are evaluated with NEON. Both paths give the same results as the scalar loop, which handles the remaining points.
+         * @param[in] NPoints The number of points
+         * @param[in] x, y Arrays holding the coordinates of the points
+         * @param[out] Result An array receiving the value of the density at every point
+         */
+        void InterpolateValues(const int NPoints, const double *x, const double *y, double *Result) const;
+        /**
+         * Evaluates the integral of the density over the polygon Region
+         * @param[in] Region The polygon over which the integral is evaluated
+         * @return The weighted area of the region
+         */
+        double CalculateWeightedArea(const Poly &Region) const;
+        /**
+         * Calculates the centroid of the polygon Region with respect to the density
+         * @param[in] Region The polygon of interest
+         * @param[in] Volume The total volume of the region in question
+         * @return The location of the centroid
+         */
+        Point CalculateCentroid(const Poly &Region, const double &Volume) const;
+        /**
+         * Calculates the weighted area and the centroid of the polygon Region with a single traversal of the grid. The results are identical to those of CalculateWeightedArea and CalculateCentroid.
+         * @param[in] Region The polygon of interest
+         * @param[out] Volume The weighted area of the region
+         * @param[out] Centroid The location of the centroid
+         */
+        void CalculateVolumeAndCentroid(const Poly &Region, double &Volume, Point &Centroid) const;
+        /**
+         * Calculates the weighted areas and the centroids of the polygons in Regions (see CalculateVolumeAndCentroid). Unlike CalculateCoveringIntegrals, the polygons may overlap.
+         * @param[in] Regions The polygons of interest
+         * @param[out] Volumes The weighted areas of the regions
+         * @param[out] Centroids The locations of the centroids
+         */
+        void CalculateVolumeAndCentroid(const std::vector<Poly> &Regions, std::vector<double> &Volumes, std::vector<Point> &Centroids) const;
+        /**
+         * Calculates the volumes and centroids of all polygons in Covering with a single pass over the grid. The (convex, non-overlapping) polygons are first rasterized column by column into a map that labels every grid square with the polygon containing all four of its corners, after which the integrals of all polygons are accumulated at once. Grid squares are counted in the same way as in CalculateWeightedArea and CalculateCentroid (up to round-off for grid points lying on the boundary of a polygon). If exact integration is enabled (see SetExactIntegration), the grid squares straddling the boundary of each polygon are added with IntegratePolygonExact.
+         * @param[in] Covering The polygons of interest
+         * @param[out] Volumes The weighted areas of the polygons
+         * @param[out] Centroids The centroids of the polygons
+         * @param[out] Owner The ownership map. The ((Ny-1)*i+j)-th entry holds the index of the polygon containing the grid square with lower-left grid point (i,j), or -1 if there is none.
+         */
+        void CalculateCoveringIntegrals(const std::vector<Poly> &Covering, std::vector<double> &Volumes, std::vector<Point> &Centroids, std::vector<int> &Owner) const;
+        /**
+         * Calculates the volumes and centroids of the (convex) polygons in Regions. For every column of grid squares, the span of squares with all four corners inside a polygon is found from the polygon's edges and summed in constant time from the prefix sums in Integral, so that the cost of each polygon scales with the number of grid columns it spans. Grid squares are counted in the same way as in CalculateCoveringIntegrals, and the polygons may overlap. If exact integration is enabled (see SetExactIntegration), the grid squares straddling the boundary of each polygon are added with IntegratePolygonExact.
+         * @param[in] Regions The polygons of interest
+         * @param[out] Volumes The weighted areas of the polygons
+         * @param[out] Centroids The centroids of the polygons
+         */
+        void CalculateSpanIntegrals(const std::vector<Poly> &Regions, std::vector<double> &Volumes, std::vector<Point> &Centroids) const;
+        /**
+         * Calculates the volume and centroid of the (convex) polygon Region in the same way as CalculateSpanIntegrals.
+         * @param[in] Region The polygon of interest
+         * @param[out] Volume The weighted area of the polygon
+         * @param[out] Centroid The centroid of the polygon
+         */
+        void CalculateSpanIntegrals(const Poly &Region, double &Volume, Point &Centroid) const;
+        /**
+         * Calculates the volumes and centroids of the (convex) polygons in Regions with the same results as CalculateSpanIntegrals (up to round-off with exact integration), using two data-parallel kernels. The first kernel has one work item per polygon and grid column spanned by it, which finds the span of grid squares of the column inside the polygon and sums it from the prefix sums; the second one reduces the sums of every polygon in column order, so that the results are deterministic. Only the vertices of the polygons are sent to the kernels, and only the three integrals of every polygon are returned. With AREACON_OFFLOAD, the kernels run on the default OpenMP device and the prefix sums are kept there between calls (see DeviceTables); otherwise they run on the host, on the threads of the density (see SetNumThreads). In compact storage mode, CalculateSpanIntegrals is called instead. If exact integration is enabled (see SetExactIntegration), the grid squares straddling the boundary of each polygon are added on the host with IntegratePolygonExact.
+         * @param[in] Regions The polygons of interest
+         * @param[out] Volumes The weighted areas of the polygons
+         * @param[out] Centroids The centroids of the polygons
+         */
+        void CalculateDeviceIntegrals(const std::vector<Poly> &Regions, std::vector<double> &Volumes, std::vector<Point> &Centroids) const;
+        /**
+         * Sets the lower volume bound (default = 0). This bound is used to avoid numerical instability in partition calculations.
+         * @param[in] VolumeLowerBound The new bound value;
+         */
+        void SetVolumeLowerBound(const double VolumeLowerBound);
+        /**
+         * Returns the lower volume bound.
+         * @return Volume_Lower_Bound;
+         */
+        double GetVolumeLowerBound(void);
+        /**
+         * Selects how grid squares that straddle the boundary of a polygon are treated (default = false). If false, only grid squares whose four corners lie inside a polygon are counted. If true, straddling grid squares are clipped against the polygon and the bilinear interpolant of the density is integrated exactly over the clipped piece, and all results are normalized so that the integral over the region of interest is equal to 1.
+         * @param[in] Exact The new flag value
+         */
+        void SetExactIntegration(const bool Exact);
+        /**
+         * @return Exact_Integration
+         */
+        bool GetExactIntegration(void) const {return Exact_Integration;};
+        /**
+         * @return The factor by which integrals of the raw density values are divided to obtain volumes (see CalculateVolumeAndCentroid): Normalization, multiplied by Region_Volume if Exact_Integration is true
+         */
+        double GetVolumeScale(void) const {return Exact_Integration ? Normalization*Region_Volume : Normalization;};
+        /**
+         * Selects how the pre-computed integrals over the grid squares are stored (default = false). If false, Integral holds the coefficients of the bilinear interpolant, the integrals and their prefix sums in double precision (about 80 bytes per grid square). If true, only the integrals are kept, in float32 and interleaved per grid square (12 bytes per grid square, see Int_Params::Compact); the coefficients are re-computed from Values when they are needed and spans are summed square by square. All sums are accumulated in double precision, and results agree with the default storage to about float32 precision. Changing the flag repeats the pre-processing.
+         * @param[in] Compact The new flag value
+         */
+        void SetCompactStorage(const bool Compact);
+        /**
+         * @return Compact_Storage
+         */
+        bool GetCompactStorage(void) const {return Compact_Storage;};
+        
+        void WriteToFile(const std::string filename)const;
+        /**
+         * Writes the density to a binary file in native byte order, which can be loaded with ReadBinaryFile. The file consists of
+         * - the 8 characters "ACDENS02", the int32 byte-order mark 0x01020304,
+         * - int32 Nx, int32 Ny, int32 value size (4 = float32, 8 = float64), int32 flags (1 = pre-computed integrals included), int32 number of vertices of Region V,
+         * - double minx, maxx, miny, maxy,
+         * - V pairs of doubles (x, y) for the vertices of Region,
+         * - Nx*Ny values in the layout of Values,
+         * - if flags = 1: double Normalization, Region_Volume and Integral.Unweighted_Area, the (Nx-1)*(Ny-1) doubles of each of Integral.Coefficient_a, _b, _c, _d, Int, Intx and Inty, the (Nx-1)*Ny doubles of each of Integral.Int_Prefix, Intx_Prefix and Inty_Prefix, the Nx-1 doubles of the column totals, and the Nx*((Ny+63)/64) uint64 words of the grid-point bitset. The integrals are not normalized.
+         *
+         * @param[in] filename The file
+         * @param[in] single_precision Flag indicating whether the values are stored as float32 (the pre-computed integrals are always stored in double precision; they are computed for the rounded values, which temporarily needs a second copy of the tables)
+         * @param[in] include_integrals Flag indicating whether the pre-computed integrals are stored, so that ReadBinaryFile does not need to repeat the pre-processing (ignored in compact storage mode)
+         */
+        void WriteBinaryFile(const std::string filename, const bool single_precision = false, const bool include_integrals = true) const;
+        /**
+         * Replaces the region and the values of the density with the contents of a file written by WriteBinaryFile. The file is memory-mapped and the arrays are filled directly from the mapping. If the file contains pre-computed integrals and compact storage is off, they are used as they are; otherwise the grid is pre-processed as in SetParameters. Files of version "ACDENS01", whose integrals were normalized, are always pre-processed.
+         * @param[in] filename The file
+         */
+        void ReadBinaryFile(const std::string filename);
+        /**
+         * Reads the header, the extents and the vertices of the region of a file written by WriteBinaryFile, checking them for consistency.
+         * @param[in] File The mapped file
+         * @param[out] Nx, Ny The number of grid points in the x and y directions
+         * @param[out] value_size The size of each value in bytes (4 or 8)
+         * @param[out] integrals Flag indicating whether the file contains pre-computed integrals
+         * @param[out] Vertices The vertices of the region of interest
+         * @param[out] extents The extents of the grid (minx, maxx, miny, maxy)
+         * @return The offset of the values in the file
+         */
+        static size_t ReadBinaryHeader(const MappedFile &File, int &Nx, int &Ny, int &value_size, bool &integrals, std::vector<Point> &Vertices, double *extents);
+        /**
+         * Computes the coefficients of the bilinear interpolant a*x+b*y+c*x*y+d over a grid square from the values at its corners.
+         * @param[in] v00, v01, v10, v11 The values at the lower-left, upper-left, lower-right and upper-right corners
+         * @param[in] xval, yval The coordinates of the lower-left corner
+         * @param[in] dx, dy The size of the grid square
+         * @param[out] a, b, c, d The coefficients
+         */
+        static void BilinearCoefficients(const double v00, const double v01, const double v10, const double v11, const double xval, const double yval, const double dx, const double dy, double &a, double &b, double &c, double &d);
+        /**
+         * Integrates the bilinear interpolant a*x+b*y+c*x*y+d over a grid square.
+         * @param[in] a, b, c, d The coefficients
+         * @param[in] xval, xval1, yval, yval1 The coordinates of the sides of the grid square
+         * @param[in] dx, dy The size of the grid square
+         * @param[out] result, resultx, resulty The integrals of f, x*f and y*f
+         */
+        static void BilinearIntegrals(const double a, const double b, const double c, const double d, const double xval, const double xval1, const double yval, const double yval1, const double dx, const double dy, double &result, double &resultx, double &resulty);
 
     private:
         Poly Region;/**<The region of interest*/
@@ -484,14 +1241,24 @@ namespace AreaCon {
         int Ny;/**<The number of grid points in the y direction*/
         double dx;/**<The grid spacing: dx = maxx-minx/(Nx-1)*/
         double dy;/**<The grid spacing: dy = maxy-miny/(Ny-1)*/
+        double Inv_dx;/**<The reciprocal of dx, used to locate points in the grid without divisions*/
+        double Inv_dy;/**<The reciprocal of dy, used to locate points in the grid without divisions*/
         double minx;/**< The minimum x coordinate of the polygon*/
         double miny;/**< The minimum y coordinate of the polygon*/
         double maxx;/**< The maximum x coordinate of the polygon*/
         double maxy;/**< The maximum y coordinate of the polygon*/
         double Volume_Lower_Bound;/**<A lower bound on any calculated volume (default = 0). This parameter is used to avoid numerical instability in partition calculations.*/
+        bool Exact_Integration;/**<Flag indicating whether grid squares straddling the boundary of a polygon are integrated exactly (see SetExactIntegration)*/
+        bool Compact_Storage;/**<Flag indicating whether the pre-computed integrals are stored compactly (see SetCompactStorage)*/
+        double Normalization;/**<The total integral of the density over the grid squares inside Region (the sum of Column_Totals). The integrals in Integral are not normalized; query results are divided by Normalization (see GetVolumeScale).*/
+        std::vector<double> Column_Totals;/**<The integral of the density over the grid squares inside Region in every column of grid squares, so that UpdateValues only re-sums the columns it changes*/
+        double Region_Volume;/**<The exact integral of the normalized density over Region, used to normalize results when Exact_Integration is true*/
         std::vector<double> Values;/**<A vector containing the value of the density function at the grid-point locations (the value at the (i,j)-th grid point is stored in the (Ny*i+j)-th entry of Values.*/
-        std::vector<bool> GridInRegion;/**<A vector whose entries indicate whether or not grid points lie within Region. If the (i,j)-th grid point lies within the polygonal region of interest, then the (Ny*i+j)-th entry of GridInRegion is true, otherwise it is false.*/
+        std::vector<std::uint64_t> Region_Bits;/**<A bitset indicating which grid points lie within Region. The bits of the ii-th column of grid points start at word ii*Bit_Stride (see IsGridPointInRegion).*/
+        int Bit_Stride;/**<The number of words of Region_Bits per column of grid points*/
+        std::shared_ptr<ThreadPool> Pool;/**<The threads used for pre-processing the grid (null if serial, see SetNumThreads)*/
         Int_Params Integral;/**<Container that holds parameters relevant to quickly calculating area integrals.*/
+        mutable DeviceCache Device;/**<The device copy of the prefix sums in Integral, created by the first call to CalculateDeviceIntegrals and reset whenever Integral changes*/
         
         /**
          * A function that checks consistency of parameter sizes.
@@ -510,33 +1277,561 @@ namespace AreaCon {
          */
         void PreprocessIntegral(void);
         /**
-         * Creates the coefficients that are used in numerically evaluating integrals. Results are stored in the associated Int_Params container Integral
+         * Creates the coefficients that are used in numerically evaluating integrals. Results are stored in the associated Int_Params container Integral. Also determines Region_Bits (see CreateRegionBits).
          */
         void CreateIntegralCoefficients(void);
+        /**
+         * Determines which grid points lie within Region, one column of grid points at a time (see Poly::Scanline). Results are stored in Region_Bits.
+         */
+        void CreateRegionBits(void);
+        /**
+         * Computes the x coordinates of the columns and the y coordinates of the rows of grid points.
+         * @param[out] X, Y The coordinates
+         */
+        void CreateGridCoordinates(std::vector<double> &X, std::vector<double> &Y) const;
+        /**
+         * Calls Task(index, worker) for index = 0,...,N-1, in parallel if a ThreadPool is available (see ThreadPool::ParallelFor).
+         * @param[in] N The number of tasks
+         * @param[in] Task The task
+         */
+        void ParallelFor(const int N, const std::function<void(const int index, const int worker)> &Task) const;
         /**
          * Pre-calculates and stores the value of relevant integrals over individual grid squares. Results are stored in the associated Int_Params container Integral
          * @return The value of the total integral of the density under the region of interest.
          */
         double CreateIntegralVector(void);
         /**
-         * Makes sure that the values stored in the integral vector are normalized so that their sum is equal to 1 over the region of interest.
+         * Re-creates the integrals over the grid squares j0,...,j1 of the ii-th column of grid squares (their coefficients must be current).
+         * @param[in] ii The index of the column
+         * @param[in] j0, j1 The indices of the first and last grid square to be re-created
+         * @param[in] X, Y The coordinates of the grid points (see CreateGridCoordinates)
+         * @return The integral of the density over all grid squares of the column inside the region of interest
+         */
+        double CreateColumnIntegrals(const int ii, const int j0, const int j1, const std::vector<double> &X, const std::vector<double> &Y);
+        /**
+         * Sets Normalization to the total integral of the density under the region of interest, or replaces the density by a uniform one if the total is 0.
          * @param[in] Total The value of the total integral of the density under the region of interest.
          */
-        void NormalizeIntegralVector(const double &Total);
+        void SetNormalization(const double &Total);
+        /**
+         * Computes the weights of the tent filter of Downsample along one axis. The filter of a coarse grid point is centered on it and falls to 0 at the neighboring coarse grid points; its weights are normalized to sum to 1, also at the boundary.
+         * @param[in] N, n The number of fine and coarse grid points
+         * @param[out] First The offset of the first weight of every coarse grid point (n+1 entries)
+         * @param[out] Index, Weight The fine grid points in the filter of the ii-th coarse grid point and their weights, in the entries First[ii],...,First[ii+1]-1
+         */
+        static void DownsampleWeights(const int N, const int n, std::vector<int> &First, std::vector<int> &Index, std::vector<double> &Weight);
+        /**
+         * Creates the prefix sums of the integrals over the columns of grid squares. Results are stored in the associated Int_Params container Integral
+         */
+        void CreatePrefixSums(void);
+        /**
+         * Creates the prefix sums of the integrals over the ii-th column of grid squares (see CreatePrefixSums).
+         * @param[in] ii The index of the column
+         */
+        void CreateColumnPrefixSums(const int ii);
+        /**
+         * Computes the coefficients of the bilinear interpolant over the (ii,jj)-th grid square and stores them in Integral.
+         * @param[in] ii, jj The indices of the grid square
+         * @param[in] xval, yval The coordinates of the (ii,jj)-th grid point
+         */
+        void CreateSquareCoefficients(const int ii, const int jj, const double xval, const double yval);
+        /**
+         * Computes the coefficients of the bilinear interpolant a*x+b*y+c*x*y+d over the (ii,jj)-th grid square from Values.
+         * @param[in] ii, jj The indices of the grid square
+         * @param[in] xval, yval The coordinates of the (ii,jj)-th grid point
+         * @param[out] a, b, c, d The coefficients
+         */
+        void ComputeSquareCoefficients(const int ii, const int jj, const double xval, const double yval, double &a, double &b, double &c, double &d) const;
+        /**
+         * Returns the coefficients of the bilinear interpolant over the (ii,jj)-th grid square, either from Integral or, in compact storage mode, re-computed from Values.
+         * @param[in] ii, jj The indices of the grid square
+         * @param[out] a, b, c, d The coefficients
+         */
+        void GetSquareCoefficients(const int ii, const int jj, double &a, double &b, double &c, double &d) const;
+        /**
+         * Stores the (normalized or un-normalized) integrals over the (ii,jj)-th grid square in Integral, in the layout selected by Compact_Storage.
+         * @param[in] ii, jj The indices of the grid square
+         * @param[in] result, resultx, resulty The integrals of f, x*f and y*f
+         */
+        void StoreSquareIntegrals(const int ii, const int jj, const double result, const double resultx, const double resulty);
+        /**
+         * Adds the stored integrals over the (ii,jj)-th grid square to sum, sumx and sumy.
+         * @param[in] ii, jj The indices of the grid square
+         * @param[in,out] sum, sumx, sumy The integrals of f, x*f and y*f
+         */
+        void AddSquareIntegrals(const int ii, const int jj, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Integrates the bilinear interpolant over the (ii,jj)-th grid square (see GetSquareCoefficients). Results are not normalized.
+         * @param[in] ii, jj The indices of the grid square
+         * @param[in] xval, xval1, yval, yval1 The coordinates of the sides of the grid square
+         * @param[out] result, resultx, resulty The integrals of f, x*f and y*f
+         */
+        void CreateSquareIntegrals(const int ii, const int jj, const double xval, const double xval1, const double yval, const double yval1, double &result, double &resultx, double &resulty) const;
+        /**
+         * @param[in] ii, jj The indices of a grid square
+         * @return Indicator of whether all four corners of the (ii,jj)-th grid square lie within Region
+         */
+        bool IsSquareInRegion(const int ii, const int jj) const;
         
         /**
-         * Uses interpolation to find the value of the density at the point Test, which is not necessarily a grid point.
+         * Uses bilinear interpolation to find the value of the density at the point Test, which is not necessarily a grid point.
          * @param[in] Test The point of interest. 
          * @return The value of the density function at Test
          */
         double InterpolateValue(const Point &Test) const;
         
+        /**
+         * Sums the integrals over the grid squares whose four corners lie inside the polygon Test.
+         * @param[in] Test The polygon of interest (non-empty)
+         * @param[out] sum The integral of the density
+         * @param[out] sumx The integral of x times the density
+         * @param[out] sumy The integral of y times the density
+         */
+        void SweepPolygon(const Poly &Test, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Adds the integrals over the grid squares with lower-left grid points (ii,j0),...,(ii,j1) to sum, sumx and sumy, using the prefix sums in Integral.
+         * @param[in] ii The column index
+         * @param[in] j0, j1 The first and last row index of the span
+         * @param[in,out] sum The integral of the density
+         * @param[in,out] sumx The integral of x times the density
+         * @param[in,out] sumy The integral of y times the density
+         */
+        void SumColumnSpan(const int ii, const int j0, const int j1, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Adds the integrals over the grid squares whose four corners lie inside a convex polygon (see FindColumnSpan) to sum, sumx and sumy, one column span at a time.
+         * @param[in] Vertices The vertices of the convex polygon
+         * @param[in,out] sum The integral of the density
+         * @param[in,out] sumx The integral of x times the density
+         * @param[in,out] sumy The integral of y times the density
+         */
+        void SumInteriorSquares(const std::vector<Point> &Vertices, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Converts the integrals of a polygon into its volume and centroid, applying Volume_Lower_Bound.
+         * @param[in] Test The polygon of interest
+         * @param[in] sum, sumx, sumy The integrals of the density, x times the density and y times the density over Test
+         * @param[out] Volume The weighted area of the polygon
+         * @param[out] Centroid The location of the centroid
+         */
+        void SetVolumeAndCentroid(const Poly &Test, const double sum, const double sumx, const double sumy, double &Volume, Point &Centroid) const;
+        /**
+         * Integrates the density over the polygon Test, using either SweepPolygon or IntegratePolygonExact depending on Exact_Integration.
+         * @param[in] Test The polygon of interest (non-empty)
+         * @param[out] sum The integral of the density
+         * @param[out] sumx The integral of x times the density
+         * @param[out] sumy The integral of y times the density
+         */
+        void IntegratePolygon(const Poly &Test, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Integrates the bilinear interpolant of the density exactly over a convex polygon. The polygon is cut into vertical strips along the grid columns; grid squares whose four corners lie inside the polygon (see FindColumnSpan) contribute their pre-computed integrals, and the remaining grid squares that intersect the polygon are clipped against it and integrated with IntegrateClippedSquare. Results are added to sum, sumx and sumy and are not normalized by Region_Volume.
+         * @param[in] Vertices The vertices of the convex polygon
+         * @param[in] include_interior If false, only the grid squares straddling the boundary of the polygon are integrated
+         * @param[in,out] sum The integral of the density
+         * @param[in,out] sumx The integral of x times the density
+         * @param[in,out] sumy The integral of y times the density
+         */
+        void IntegratePolygonExact(const std::vector<Point> &Vertices, const bool include_interior, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Integrates the bilinear interpolant of the density over a convex polygon that lies inside a single grid square. The moments of the polygon are evaluated with Green's theorem, using 3-point Gauss-Legendre quadrature along the edges (which is exact for the polynomials involved), in coordinates relative to the lower-left corner of the grid square. Results are added to sum, sumx and sumy.
+         * @param[in] Vertices The vertices of the polygon
+         * @param[in] ii, jj The indices of the lower-left grid point of the grid square
+         * @param[in,out] sum The integral of the density
+         * @param[in,out] sumx The integral of x times the density
+         * @param[in,out] sumy The integral of y times the density
+         */
+        void IntegrateClippedSquare(const std::vector<Point> &Vertices, const int ii, const int jj, double &sum, double &sumx, double &sumy) const;
+        /**
+         * Finds the grid points of the ii-th column of grid points (i.e., the points with x-coordinate minx+ii*dx) that lie inside a convex polygon.
+         * @param[in] Vertices The vertices of the convex polygon
+         * @param[in] ii The column index
+         * @param[out] j0, j1 The indices of the first and last grid point of the column inside the polygon
+         * @return False if no grid point of the column lies inside the polygon
+         */
+        bool FindColumnSpan(const std::vector<Point> &Vertices, const int ii, int &j0, int &j1) const;
+        /**
+         * Finds the grid points of a column of grid points that lie inside a convex polygon (see FindColumnSpan). The function only uses its arguments, so that it can be called from the kernels of CalculateDeviceIntegrals.
+         * @tparam Vertex Point or DeviceTables::Vertex
+         * @param[in] Vertices The vertices of the convex polygon
+         * @param[in] NVert The number of vertices
+         * @param[in] x The x coordinate of the column
+         * @param[in] tolerance The robustness constant
+         * @param[in] miny, dy The y coordinate of the first grid point of the column and the grid spacing
+         * @param[in] Ny The number of grid points of the column
+         * @param[out] j0, j1 The indices of the first and last grid point of the column inside the polygon
+         * @return False if no grid point of the column lies inside the polygon
+         */
+        template <class Vertex>
+        static bool FindColumnSpan(const Vertex *Vertices, const int NVert, const double x, const double tolerance, const double miny, const double dy, const int Ny, int &j0, int &j1);
+        /**
+         * The first kernel of CalculateDeviceIntegrals: sums the span of grid squares of one column whose four corners lie inside one polygon, for the work items first,...,last-1. The function only uses its arguments (see FindColumnSpan).
+         * @param[in] first, last The range of work items
+         * @param[in] V, VO The vertices of all polygons and the offset of the first vertex of every polygon (NRegions+1 entries)
+         * @param[in] IO, FC The offset of the first work item and the index of the first grid column of every polygon
+         * @param[in] NRegions The number of polygons
+         * @param[in] x0, y0, dx, dy, Ny The coordinates of the first grid point, the grid spacing and the number of grid points of a column
+         * @param[in] tolerance The robustness constant
+         * @param[in] P, Px, Py The prefix sums (see DeviceTables)
+         * @param[out] IS The three sums of every work item
+         */
+        static void SumColumnSpans(const int first, const int last, const DeviceTables::Vertex *V, const int *VO, const int *IO, const int *FC, const int NRegions, const double x0, const double y0, const double dx, const double dy, const int Ny, const double tolerance, const double *P, const double *Px, const double *Py, double *IS);
+        /**
+         * The second kernel of CalculateDeviceIntegrals: adds the sums of the work items of the kk-th polygon in column order, as in SumInteriorSquares.
+         * @param[in] kk The index of the polygon
+         * @param[in] IO The offset of the first work item of every polygon
+         * @param[in] IS The three sums of every work item
+         * @param[out] S The three sums of every polygon
+         */
+        static void ReduceColumnSpans(const int kk, const int *IO, const double *IS, double *S);
         /**
          * Returns the world coordinates of the grid-point associated with the ii-th entry of the vector Values.
          * @return The world coordinates of the associated grid point.
          */
         Point ConvertIndextoWorld(const int ii) const;
     };
+    // TiledDensity Class-----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * A read-only density for grids that are too large to be pre-processed in memory. The values are memory-mapped from a file written by Density::WriteBinaryFile, and the grid squares are divided into tiles of tile_size by tile_size squares. The integrals and prefix sums of a tile are computed from the mapped values the first time the tile is needed and kept in a cache of at most max_tiles tiles, from which the least recently used tile is evicted. Memory use is therefore bounded by the cache, independently of the size of the grid. Integrals are counted as in Density without exact integration, and agree with those of a Density over the same file up to round-off.
+     *
+     * Queries may be made from several threads at once. Only the bookkeeping of the cache is locked; tiles are computed outside of the lock, and threads that need a tile while it is being computed wait for it instead of computing it again.
+     */
+    class TiledDensity : public DensityFunction
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Maps the file and normalizes the density with a single pass over the tiles, in the same order as Density, so that the normalization constant is identical.
+         * @param[in] filename A file written by Density::WriteBinaryFile (the pre-computed integrals, if present, are not used)
+         * @param[in] tile_size The number of grid squares along each side of a tile
+         * @param[in] max_tiles The maximum number of tiles kept in the cache
+         */
+        TiledDensity(const std::string filename, const int tile_size = 256, const int max_tiles = 64);
+        TiledDensity(const TiledDensity &Other) = delete;
+        TiledDensity &operator=(const TiledDensity &Other) = delete;
+        //@}
+        /**
+         * @return Nx
+         */
+        int GetNx(void) const {return Nx;};
+        /**
+         * @return Ny
+         */
+        int GetNy(void) const {return Ny;};
+        /**
+         * @return Region
+         */
+        const Poly &GetRegion(void) const {return Region;};
+        /**
+         * Returns the extreme x and y values.
+         * @param[out] minx, miny, maxx, maxy
+         */
+        void GetExtrema (double &minx, double &miny, double &maxx, double &maxy) const {minx = this->minx; miny = this->miny; maxx = this->maxx; maxy = this->maxy;}
+        /**
+         * @return The constant by which the integrals have been divided
+         */
+        double GetNormalization(void) const {return Normalization;};
+        /**
+         * @return The factor by which integrals of the raw density values are divided to obtain volumes, i.e., Normalization (see Density::GetVolumeScale)
+         */
+        double GetVolumeScale(void) const {return Normalization;};
+        /**
+         * @return The number of tiles currently in the cache, including tiles that are being computed
+         */
+        int GetNCachedTiles(void) const;
+        /**
+         * @return The number of tiles that have been computed since construction, including the pass of the constructor
+         */
+        long GetTileLoads(void) const;
+        /**
+         * Sets the lower volume bound (default = 0, see Density::SetVolumeLowerBound).
+         * @param[in] VolumeLowerBound The new bound value;
+         */
+        void SetVolumeLowerBound(const double VolumeLowerBound);
+        /**
+         * Uses bilinear interpolation to find the value of the density at the point Test (see Density::InterpolateValues).
+         * @param[in] Test The point of interest
+         * @return The value of the density function at Test
+         */
+        double InterpolateValue(const Point &Test) const;
+        /**
+         * Calculates the line integral of the density function over the straight line connecting points p1, p2, with the same sampling as Density::LineIntegral. Only the tiles crossed by the line are loaded, and each of them is looked up in the cache once.
+         * @param[in] spacing The spacing between evaluation points
+         * @param[in] p1, p2 The endpoints of the line in question
+         * @return The value of the line integral
+         */
+        double LineIntegral(double spacing, const Point &p1, const Point &p2) const;
+        /**
+         * Evaluates the integral of the density over the polygon Region (see Density::CalculateWeightedArea). Only the tiles intersecting the bounding box of the polygon are loaded.
+         * @param[in] Region The polygon over which the integral is evaluated
+         * @return The weighted area of the region
+         */
+        double CalculateWeightedArea(const Poly &Region) const;
+        /**
+         * Calculates the centroid of the polygon Region with respect to the density (see Density::CalculateCentroid).
+         * @param[in] Region The polygon of interest
+         * @param[in] Volume The total volume of the region in question
+         * @return The location of the centroid
+         */
+        Point CalculateCentroid(const Poly &Region, const double &Volume) const;
+        /**
+         * Calculates the weighted area and the centroid of the polygon Region with a single traversal of the tiles.
+         * @param[in] Region The polygon of interest
+         * @param[out] Volume The weighted area of the region
+         * @param[out] Centroid The location of the centroid
+         */
+        void CalculateVolumeAndCentroid(const Poly &Region, double &Volume, Point &Centroid) const;
+    private:
+        /**
+         * The values, integrals and prefix sums of one tile. Grid squares and grid points are indexed relative to the lower-left grid point (i0,j0) of the tile.
+         */
+        struct Tile
+        {
+            int i0, j0;/**<The indices of the lower-left grid point*/
+            int nx, ny;/**<The number of grid squares in the x and y directions*/
+            std::vector<double> Values;/**<The values at the (nx+1) by (ny+1) grid points of the tile, stored as in Density*/
+            std::vector<double> Int_Prefix, Intx_Prefix, Inty_Prefix;/**<The prefix sums of the normalized integrals over every column of grid squares; the sums of the ii-th column start at entry (ny+1)*ii*/
+        };
+        MappedFile File;/**<The mapped file*/
+        size_t Values_Offset;/**<The offset of the values in File*/
+        int Value_Size;/**<The size of each value in File in bytes (4 or 8)*/
+        Poly Region;/**<The region of interest*/
+        int Nx;/**<The number of grid points in the x direction*/
+        int Ny;/**<The number of grid points in the y direction*/
+        double dx;/**<The grid spacing in the x direction*/
+        double dy;/**<The grid spacing in the y direction*/
+        double Inv_dx;/**<The reciprocal of dx*/
+        double Inv_dy;/**<The reciprocal of dy*/
+        double minx;/**< The minimum x coordinate of the polygon*/
+        double miny;/**< The minimum y coordinate of the polygon*/
+        double maxx;/**< The maximum x coordinate of the polygon*/
+        double maxy;/**< The maximum y coordinate of the polygon*/
+        double Volume_Lower_Bound;/**<A lower bound on any calculated volume*/
+        double Normalization;/**<The total integral of the density over the grid squares inside Region, by which all integrals are divided*/
+        std::vector<double> X;/**<The x coordinates of the columns of grid points, accumulated as in Density*/
+        std::vector<double> Y;/**<The y coordinates of the rows of grid points, accumulated as in Density*/
+        int Tile_Size;/**<The number of grid squares along each side of a tile*/
+        int NTiles_x;/**<The number of tiles in the x direction*/
+        int NTiles_y;/**<The number of tiles in the y direction*/
+        int Max_Tiles;/**<The maximum number of tiles in Cache*/
+        mutable std::mutex Cache_Mutex;/**<Protects Cache, Cache_Index and Tile_Loads (but not the computation of the tiles)*/
+        mutable std::list<std::pair<int, std::shared_future<std::shared_ptr<const Tile>>>> Cache;/**<The cached tiles with their indices, most recently used first. The future of a tile that is being computed is not ready yet.*/
+        mutable std::unordered_map<int, std::list<std::pair<int, std::shared_future<std::shared_ptr<const Tile>>>>::iterator> Cache_Index;/**<The position in Cache of every cached tile, by tile index NTiles_y*ti+tj*/
+        mutable long Tile_Loads;/**<The number of tiles computed since construction*/
+        
+        /**
+         * @param[in] ii, jj The indices of a grid point
+         * @return The value of the density at the (ii,jj)-th grid point, read from File
+         */
+        double ReadValue(const int ii, const int jj) const;
+        /**
+         * Computes the values of the (ti,tj)-th tile and, unless Normalization is 0, its integrals and prefix sums.
+         * @param[in] ti, tj The indices of the tile
+         * @return The tile
+         */
+        std::shared_ptr<Tile> LoadTile(const int ti, const int tj) const;
+        /**
+         * Returns the (ti,tj)-th tile from the cache, loading it and evicting the least recently used tile if necessary. The tile is loaded outside of Cache_Mutex; its entry in the cache is created before, so that other threads needing the tile wait for it instead of loading it again. The tile remains valid for as long as the returned pointer is held, even if it is evicted.
+         * @param[in] ti, tj The indices of the tile
+         * @return The tile
+         */
+        std::shared_ptr<const Tile> GetTile(const int ti, const int tj) const;
+        /**
+         * Uses bilinear interpolation to find the value of the density at the point Test, taking the tile from T if it holds the grid square of Test.
+         * @param[in] Test The point of interest
+         * @param[in,out] T The tile used for the previous point (may be null), replaced by the tile of Test
+         * @return The value of the density function at Test
+         */
+        double InterpolateValue(const Point &Test, std::shared_ptr<const Tile> &T) const;
+        /**
+         * Computes the integral of the density over the grid squares inside Region, one tile at a time (see Density::CreateIntegralVector).
+         * @return The total
+         */
+        double CreateNormalization(void) const;
+        /**
+         * Sums the integrals over the grid squares whose four corners lie inside the polygon Test (see Density::SweepPolygon). The columns are visited one column of tiles at a time, holding only the tiles of that column that intersect the bounding box of Test.
+         * @param[in] Test The polygon of interest (non-empty)
+         * @param[out] sum, sumx, sumy The integrals of f, x*f and y*f
+         */
+        void SweepPolygon(const Poly &Test, double &sum, double &sumx, double &sumy) const;
+    };
+    // ProgressInfo Class-----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Container for the progress information passed to the progress callback of a Partition (see Partition::SetProgressCallback).
+     */
+    class ProgressInfo
+    {
+    public:
+        bool center_step;/**<True after a center update, false after a weight (volume) update*/
+        int level;/**<The level of the density pyramid that is being solved (0 = full resolution, see Parameters::pyramid_levels)*/
+        int center_iteration;/**<The number of the current center iteration, counted from 0*/
+        int volume_iteration;/**<The number of the current volume iteration within the center iteration, counted from 0 (-1 after a center update)*/
+        double volume_error;/**<The current volume error (see Partition::CalculateError)*/
+        double center_error;/**<The error returned by the last center update (INFINITY before the first one)*/
+        double step_time;/**<The time in seconds spent in the step that has just been completed*/
+        double elapsed_time;/**<The time in seconds since the start of Partition::CalculatePartition*/
+    };
+    // PartitionStats Class---------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Container for the timings (in seconds) and counters collected by a Partition (see Partition::GetStats). The times of nested phases are also included in the time of the enclosing phase, e.g., clean_covering_time and adjacency_time are part of diagram_time.
+     */
+    class PartitionStats
+    {
+    public:
+        //@{
+        /**
+         * Constructor. All timings and counters are set to 0.
+         */
+        PartitionStats(void);
+        //@}
+        //@{
+        double total_time;/**<The time spent in CalculatePartition*/
+        double diagram_time;/**<The time spent constructing power diagrams (see Partition::CreatePowerDiagram)*/
+        double clean_covering_time;/**<The time spent removing spurious vertices after All_Pairs constructions (see Partition::CleanCovering)*/
+        double adjacency_time;/**<The time spent collecting the Delaunay graph (see Partition::CreateSharedEdges)*/
+        double volumes_time;/**<The time spent integrating the density over the regions (see Partition::CalculateVolumes)*/
+        double weights_time;/**<The time spent computing weight updates (see Partition::GradientStepWeights and Partition::NewtonStepWeights), excluding the power diagrams built by the line search*/
+        double centers_time;/**<The time spent updating the centers (see Partition::GradientStepCenter)*/
+        long diagram_calls;/**<The number of power diagram constructions, including failed ones*/
+        long diagram_retries;/**<The number of power diagram constructions that failed because of a numerical degeneracy and had to be repeated*/
+        long incremental_updates;/**<The number of power diagrams that were updated incrementally (see Partition::UpdatePowerDiagram)*/
+        long bisector_clips;/**<The number of power bisectors that have been tested against a region during the construction of power diagrams*/
+        long volume_calls;/**<The number of calls to CalculateVolumes*/
+        long weight_steps;/**<The number of weight updates*/
+        long center_steps;/**<The number of center updates*/
+        long line_integrals;/**<The number of line integrals evaluated during weight updates*/
+        long line_search_steps;/**<The number of times a Newton step has been halved by the line search (see Partition::NewtonStepWeights)*/
+        //@}
+    };
+    // ScopedTimer Class------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Adds the time between its construction and its destruction to a total.
+     */
+    class ScopedTimer
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Starts the timer.
+         * @param[in,out] Total The total (in seconds) that the elapsed time is added to
+         */
+        ScopedTimer(double &Total):Total(Total), Start(std::chrono::steady_clock::now()){};
+        /**
+         * Destructor. Adds the elapsed time to Total.
+         */
+        ~ScopedTimer(void){Total += std::chrono::duration<double>(std::chrono::steady_clock::now()-Start).count();};
+        //@}
+    private:
+        double &Total;/**<The total that the elapsed time is added to*/
+        std::chrono::steady_clock::time_point Start;/**<The time at construction*/
+    };
+    // IterationSink Class----------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The base class for recording the evolution of a partition during Partition::CalculatePartition. A snapshot of the configuration is offered after every power diagram; which snapshots are kept is controlled by the interval given to the constructor.
+     */
+    class IterationSink
+    {
+    public:
+        //@{
+        /**
+         * Constructor.
+         * @param[in] interval Every interval-th snapshot is written (beginning with the first one), and the final snapshot is always written. If interval is 0, only the final snapshot is written.
+         */
+        IterationSink(const int interval = 1);
+        /**
+         * Destructor.
+         */
+        virtual ~IterationSink(void){};
+        //@}
+        /**
+         * Offers a snapshot of the configuration, which is written if permitted by the interval.
+         * @param[in] iteration The index of the snapshot, counted from 0
+         * @param[in] final Flag indicating whether this is the final snapshot
+         * @param[in] Centers, Weights, Covering The current configuration
+         */
+        void Record(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering);
+        /**
+         * Writes out any buffered data.
+         */
+        virtual void Flush(void){};
+    protected:
+        /**
+         * Writes a snapshot of the configuration.
+         * @param[in] iteration The index of the snapshot, counted from 0
+         * @param[in] final Flag indicating whether this is the final snapshot
+         * @param[in] Centers, Weights, Covering The current configuration
+         */
+        virtual void Write(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering) = 0;
+    private:
+        const int Interval;/**<Every Interval-th snapshot is written (0 = final only)*/
+    };
+    // CSVIterationSink Class-------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Writes snapshots as text, in the format historically produced by Partition::CalculatePartition. The centers file holds one "x,y" line per center and the partition file one line of space-separated "x,y" vertices per region. Every snapshot is terminated by an empty line in both files. Output is buffered and only flushed by Flush or the destructor.
+     */
+    class CSVIterationSink : public IterationSink
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Opens (and truncates) both files.
+         * @param[in] filename_partition Output filename to be written with partition data
+         * @param[in] filename_centers Output filename to be written with center data
+         * @param[in] interval See IterationSink
+         */
+        CSVIterationSink(const std::string filename_partition, const std::string filename_centers, const int interval = 1);
+        //@}
+        void Flush(void);
+    protected:
+        void Write(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering);
+    private:
+        std::ofstream File_Partition;/**<The partition file*/
+        std::ofstream File_Centers;/**<The centers file*/
+    };
+    // BinaryIterationSink Class----------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Writes snapshots to a compact binary trajectory file in native byte order. The file starts with a header consisting of the 8 characters "ACTRAJ01" followed by the int32 number of regions N. Every snapshot is stored as a record consisting of
+     * - int32 iteration, int32 final flag, int32 total number of vertices V,
+     * - N triples of doubles (x, y, weight) for the centers,
+     * - N int32 vertex counts,
+     * - V pairs of doubles (x, y) for the vertices of all regions in order.
+     *
+     * Records are accumulated in memory and written in large blocks.
+     */
+    class BinaryIterationSink : public IterationSink
+    {
+    public:
+        //@{
+        /**
+         * Constructor. Opens (and truncates) the file.
+         * @param[in] filename Output filename
+         * @param[in] interval See IterationSink
+         * @param[in] buffer_size The number of bytes that are accumulated before they are written to the file
+         */
+        BinaryIterationSink(const std::string filename, const int interval = 1, const size_t buffer_size = 1 << 20);
+        /**
+         * Destructor. Writes out any buffered data.
+         */
+        ~BinaryIterationSink(void);
+        //@}
+        void Flush(void);
+    protected:
+        void Write(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering);
+    private:
+        /**
+         * Appends raw bytes to Buffer, writing Buffer out when it is full.
+         * @param[in] data, size The bytes to be appended
+         */
+        void Append(const void *data, const size_t size);
+        std::ofstream File;/**<The trajectory file*/
+        std::vector<char> Buffer;/**<Bytes waiting to be written*/
+        const size_t Buffer_Size;/**<The number of bytes that are accumulated before they are written*/
+        int NRegions;/**<The number of regions given in the header (-1 until the header has been written)*/
+    };
     // Partition Class--------------------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------------------------------------
     /**
@@ -557,6 +1852,13 @@ namespace AreaCon {
          * @param[in] Alg_Params Various algorithmic parameters
          */
         Partition(int NRegions = 0, Density Prior = Density(), std::vector<double> desired_area = {}, Parameters Alg_Params = Parameters());
+        /**
+         * @param[in] NRegions The number of regions desired.
+         * @param[in] Prior The density function goverining partition creation, shared with the caller (e.g., a TiledDensity). The regions are integrated one at a time through the DensityFunction interface, so Alg_Params.integration_method must be Per_Region, and exact_integration, exact_line_integral and pyramid_levels>1 are not available. The lower volume bound of Prior is set to Alg_Params.Volume_Lower_Bound.
+         * @param[in] desired_area A vector containing the desired areas of the regions in the resulting configuration. Defaults to equal area.
+         * @param[in] Alg_Params Various algorithmic parameters
+         */
+        Partition(int NRegions, std::shared_ptr<DensityFunction> Prior, std::vector<double> desired_area = {}, Parameters Alg_Params = Parameters());
         //@}
         //@{
         /**
@@ -566,78 +1868,229 @@ namespace AreaCon {
          * @param[in] desired_area A vector containing the desired areas of the regions in the resulting configuration. Defaults to equal area.
          */
         void SetPartitionVariables(int NRegions = 0, Density Prior = Density(), std::vector<double> desired_area = {});
+        /**
+         * Sets the partition variables, with a density shared with the caller (see Partition::Partition).
+         * @param[in] NRegions The number of regions desired.
+         * @param[in] Prior The density function goverining partition creation
+         * @param[in] desired_area A vector containing the desired areas of the regions in the resulting configuration. Defaults to equal area.
+         */
+        void SetPartitionVariables(int NRegions, std::shared_ptr<DensityFunction> Prior, std::vector<double> desired_area = {});
         /**
          * Used to initialize algorithmic process variables Centers and Weights. If no input is given, default centers and weights are created.
          * @param[in] Centers The initial center locations.
          * @param[in] Weights The initial weight values.
          */
         void InitializePartition(std::vector<Point> Centers = {},std::vector<double> Weights = {});
+        /**
+         * Changes the values of the prior density at a rectangle of grid points (see Density::UpdateValues). Throws if the density is shared with the caller. Centers, Weights and the current power diagram are kept, so that the next call to CalculatePartition continues from the current configuration instead of starting from scratch.
+         * @param[in] i0, j0 The indices of the first grid point of the rectangle
+         * @param[in] i1, j1 The indices of the last grid point of the rectangle (inclusive)
+         * @param[in] Block The new values at the grid points of the rectangle (the value at the (i,j)-th grid point is stored in the ((j1-j0+1)*(i-i0)+j-j0)-th entry of Block)
+         */
+        void UpdateDensity(const int i0, const int j0, const int i1, const int j1, const std::vector<double> &Block);
+        /**
+         * Changes the values of the prior density at all grid points, re-processing only the grid squares that are affected (see Density::UpdateValues). Throws if the density is shared with the caller. Centers, Weights and the current power diagram are kept, so that the next call to CalculatePartition continues from the current configuration instead of starting from scratch.
+         * @param[in] Values The new values of the density at the grid points
+         */
+        void UpdateDensity(const std::vector<double> &Values);
         /**
          * @return The current value of Covering
          */
-        std::vector<Poly> GetCovering(void){return Covering;}
+        const std::vector<Poly> &GetCovering(void) const {return Covering;}
         /**
          * @return The current value of Centers
          */
-        std::vector<Point> GetCenters(void){return Centers;}
+        const std::vector<Point> &GetCenters(void) const {return Centers;}
         /**
          * @return The current value of Weights
          */
-        std::vector<double> GetWeights(void){return Weights;}
+        const std::vector<double> &GetWeights(void) const {return Weights;}
         /**
-         * The main function used for calculating partitions. Partitions are calculated and the resultant configuration is stored in the containers Centers and Covering. If WriteToFile = true, then the evolution of the centers and partitions will be written to the files filename_centers and filename_partitions, respectively.
+         * @return The edges of the Delaunay (dual) graph of the current Covering, together with the line segments shared by adjacent regions
+         */
+        const SparseAdjacency &GetAdjacency(void) const {return Adjacency;}
+        /**
+         * @return The timings and counters collected since the last call to ResetStats. CalculatePartition resets them when it starts.
+         */
+        PartitionStats GetStats(void) const {return Stats;}
+        /**
+         * Sets all timings and counters to 0.
+         */
+        void ResetStats(void){Stats = PartitionStats();}
+        /**
+         * Exchanges the scratch space of the partition with Other. Only buffers are exchanged, so that the results of the partition are unaffected.
+         * @param[in,out] Other The workspace
+         */
+        void SwapWorkspace(PartitionWorkspace &Other){std::swap(Workspace, Other);}
+        /**
+         * The main function used for calculating partitions. Partitions are calculated and the resultant configuration is stored in the containers Centers and Covering. If WriteToFile = true, then the evolution of the centers and partitions will be written to the files filename_centers and filename_partitions, respectively (see CSVIterationSink).
          * @param[in] WriteToFile Flag indicating if result should be written to file
          * @param[in] filename_partition Output filename to be written with partition data
          * @param[in] filename_centers Output filename to be written with center data
          */
         void CalculatePartition(bool WriteToFile, std::string filename_partition = "", std::string filename_centers = "" );
+        /**
+         * Calculates partitions as above, offering a snapshot of the configuration to Sink after every power diagram.
+         * @param[in,out] Sink The recipient of the snapshots
+         */
+        void CalculatePartition(IterationSink &Sink);
+        /**
+         * Sets a function that is called by CalculatePartition after every weight and center update, independently of Alg_Params.verbosity.
+         * @param[in] Callback The function (an empty function removes the callback)
+         */
+        void SetProgressCallback(const std::function<void(const ProgressInfo &Info)> &Callback){Progress_Callback = Callback;};
         //@}
     private:
         //@{
         std::vector<Point> Centers; /**<The vector of center locations.*/
         std::vector<Poly> Covering; /**<The covering of the area of interest.*/
         std::vector<double> Weights; /**<The vector of weights associated with each area.*/
+        std::vector<Point> Centroids; /**<The centroids of the regions in Covering, if they were calculated alongside the volumes (see CalculateVolumes). Empty otherwise.*/
+        std::vector<int> Owner; /**<The ownership map used by the Ownership_Map integration method.*/
+        std::vector<std::vector<int> > Edge_Labels; /**<The labels of the edges of each region in Covering. The kk-th entry labels the edge from the kk-th vertex to the next one with the index of the region on the other side, or -1 if the edge lies on the boundary of the region of interest.*/
+        std::vector<std::vector<int> > Cell_Neighbors; /**<The indices of the regions adjacent to each region in Covering (see Edge_Labels).*/
+        SparseAdjacency Adjacency; /**<The Delaunay graph of Covering, together with the shared line segments (see CreateSharedEdges).*/
+        std::vector<Point> Diagram_Centers; /**<The centers used to build Cell_Neighbors. The diagram can only be updated incrementally while Centers is unchanged.*/
+        std::vector<std::vector<int> > Updated_Neighbors; /**<Scratch space for the neighbors found by UpdatePowerDiagram, kept to avoid re-allocation.*/
+        PartitionWorkspace Workspace; /**<Scratch space, kept to avoid re-allocation (see SwapWorkspace).*/
         //@}
         //@{
         const Parameters Alg_Params;/**<Algorithmic parameters.*/
         std::vector<double> desired_area;/**<A vector specifying the desired areas of the resultant configurations.*/
         Density Prior;/**<The prior probability density function.*/
+        std::shared_ptr<DensityFunction> Shared_Prior;/**<The prior probability density function if it is shared with the caller, in which case Prior is empty (null otherwise).*/
         int NRegions;/**<The number of regions desired.*/
+        std::shared_ptr<ThreadPool> Pool;/**<The threads used for parallel computations (null if Alg_Params.num_threads == 1).*/
+        PartitionStats Stats;/**<The timings and counters collected so far (see GetStats).*/
+        std::function<void(const ProgressInfo &Info)> Progress_Callback;/**<The function called after every step of CalculatePartition (see SetProgressCallback).*/
         //@}
         //@{
         /**
          * Checks Parameters to ensure consistent sizes
          */
         void CheckParams(void);
+        /**
+         * @return The density through which the regions are integrated, i.e., Shared_Prior if it is set and Prior otherwise
+         */
+        const DensityFunction &GetPrior(void) const {if (Shared_Prior){return *Shared_Prior;} return Prior;}
         /**
          * Creates default centers within the region defined by the polygon Region. The parameter multiplier is used to create center points which are ensured to lie within the polygon.
          * @param[in] Region The region of interest
          * @param[in] multiplier A parameter used in center creation
          * @return A flag indicating whether centers were successfully created
          */
-        bool CreateDefaultCenters(const Poly Region, const double multiplier);
+        bool CreateDefaultCenters(const Poly &Region, const double multiplier);
         /**
          * Creates default centers within the region defined by the polygon Region. The parameter multiplier is used to create center points which are ensured to lie within the polygon.
          * @param[in] Region The region of interest
          * @param[in] initial_multiplier A parameter used in center creation
          * @param[in] max_steps An upper bound on the number of center creation attempts
          */
-        void CreateDefaultCenters(const Poly Region, const double initial_multiplier, const int max_steps);
+        void CreateDefaultCenters(const Poly &Region, const double initial_multiplier, const int max_steps);
         /**
-         * Creates the power diagram generated from the current values of Centers and Weights.
+         * Creates the power diagram generated from the current values of Centers and Weights, using the method specified by Alg_Params.diagram_method.
+         * @return A flag indicating whether the diagram was successfully created. If false, a center has been perturbed to avoid a numerical degeneracy and the function should be called again.
          */
         bool CreatePowerDiagram(void);
+        /**
+         * Creates the power diagram by clipping each region against the power bisectors of all other centers.
+         * @return A flag indicating whether the diagram was successfully created (see CreatePowerDiagram)
+         */
+        bool CreatePowerDiagramAllPairs(void);
+        /**
+         * Creates the power diagram by clipping each region only against the centers that can contribute to its boundary. Centers are visited ring by ring using a CenterGrid, and the search stops once the distance to the remaining centers guarantees that their power bisectors cannot intersect the current region. Clipping is carried out in double precision with Poly::ClipToHalfPlane.
+         * @return A flag indicating whether the diagram was successfully created (see CreatePowerDiagram)
+         */
+        bool CreatePowerDiagramNeighbors(void);
+        /**
+         * Creates Covering[ii] by clipping the region against the power bisectors of all other centers.
+         * @param[in] ii The index of the region
+         * @param[in] subj The region of interest, in the integer format used by the Clipper library
+         * @param[in] mult A multiplier that affects the degree of numerical accuracy
+         * @param[in,out] c The Clipper object used for clipping
+         * @param[out] clip_calls The number of power bisectors the region has been clipped against
+         * @return False if the construction failed due to coincident centers
+         */
+        bool CreateCellAllPairs(const int ii, const ClipperLib::Paths &subj, const long int mult, ClipperLib::Clipper &c, long &clip_calls);
+        /**
+         * Creates Covering[ii] by clipping the region against the power bisectors of the nearby centers (see CreatePowerDiagramNeighbors).
+         * @param[in] ii The index of the region
+         * @param[in] Grid The bucket grid holding Centers
+         * @param[in] weight_max The largest entry of Weights
+         * @param[in,out] Work Scratch space
+         * @param[out] Neighbors The indices of the regions adjacent to the region. The edge labels are stored in Edge_Labels[ii].
+         * @return False if the construction failed due to coincident centers
+         */
+        bool CreateCellNeighbors(const int ii, const CenterGrid &Grid, const double weight_max, CellWorkspace &Work, std::vector<int> &Neighbors);
+        /**
+         * Updates the power diagram after a change of Weights, keeping Centers and the adjacency of the regions (Cell_Neighbors) of the last diagram. Every region is rebuilt by clipping the region of interest against the (shifted) power bisectors of its previous neighbors only. A region is accepted if none of the neighbors of its neighbors reaches into it; otherwise its topology has changed and it is rebuilt with a full neighbor search (see CreateCellNeighbors), as are previously empty regions. Finally, the update is only accepted if the regions still tile the region of interest (i.e., no two regions overlap).
+         * @return A flag indicating whether the diagram was updated. If false, Covering is invalid and the diagram has to be rebuilt with CreatePowerDiagramNeighbors.
+         */
+        bool UpdatePowerDiagram(void);
+        /**
+         * Rebuilds Covering[ii] from its previous neighbors (see UpdatePowerDiagram).
+         * @param[in] ii The index of the region
+         * @param[out] Neighbors The neighbors of the updated region. The edge labels are stored in Edge_Labels[ii].
+         * @param[in,out] Work Scratch space
+         * @return False if the region has to be rebuilt with a full neighbor search
+         */
+        bool UpdateCellNeighbors(const int ii, std::vector<int> &Neighbors, CellWorkspace &Work);
+        /**
+         * Clips the convex region held in Work.Vertices to the half-plane of points that are closer (in the power distance) to Centers[ii] than to Centers[jj], in double precision. The region is only clipped if the power bisector passes through it, in which case the new edge is labelled with jj.
+         * @param[in] ii The index of the region being constructed
+         * @param[in] jj The index of the competing center
+         * @param[in,out] Work The vertices and edge labels of the region. Fewer than 3 vertices remain if the region has been clipped away.
+         * @param[out] clipped True if the bisector intersected the region
+         * @return False if Centers[ii] and Centers[jj] coincide
+         */
+        bool ClipCellToBisector(const int ii, const int jj, CellWorkspace &Work, bool &clipped) const;
+        /**
+         * Finds the distinct region indices among edge labels.
+         * @param[in] Labels The edge labels of a region
+         * @param[out] Neighbors The indices of the adjacent regions
+         */
+        void ExtractNeighbors(const std::vector<int> &Labels, std::vector<int> &Neighbors) const;
+        /**
+         * Labels the edges of Covering[ii] after the fact, for diagrams that were not built in double precision (All_Pairs). Every edge is labelled with the center that is closest (in the power distance) to its midpoint, other than Centers[ii], provided that the midpoint lies on their power bisector; otherwise the edge lies on the boundary of the region of interest.
+         * @param[in] ii The index of the region
+         * @param[out] Labels The edge labels of the region
+         */
+        void LabelEdges(const int ii, std::vector<int> &Labels) const;
+        /**
+         * Collects the edges of the Delaunay graph, together with the shared line segments, from Covering and Edge_Labels. Results are stored in Adjacency, where every edge is stored in the row of the region with the smaller index unless only the other region records it.
+         */
+        void CreateSharedEdges(void);
+        /**
+         * Clips the region held in solution to the half-plane of points that are closer (in the power distance) to Centers[ii] than to Centers[jj].
+         * @param[in] ii The index of the region being constructed
+         * @param[in] jj The index of the competing center
+         * @param[in] mult A multiplier that affects the degree of numerical accuracy
+         * @param[in,out] solution The region, in the integer format used by the Clipper library. On return, solution is empty if the region has been clipped away entirely.
+         * @param[in,out] c The Clipper object used for clipping
+         * @return A flag indicating whether the clipping was successful. If false, Centers[ii] and Centers[jj] coincide and one of them should be perturbed.
+         */
+        bool ClipToPowerBisector(const int ii, const int jj, const long int mult, ClipperLib::Paths &solution, ClipperLib::Clipper &c);
+        /**
+         * Moves Centers[ii] by a small amount, which is used to escape numerical degeneracies (e.g., coincident centers) during power diagram construction.
+         * @param[in] ii The index of the center to be moved
+         */
+        void PerturbCenter(const int ii);
+        /**
+         * Calls Task(index, worker) for index = 0,...,N-1, in parallel if a ThreadPool is available (see ThreadPool::ParallelFor).
+         * @param[in] N The number of tasks
+         * @param[in] Task The task to be carried out
+         */
+        void ParallelFor(const int N, const std::function<void(const int index, const int worker)> &Task) const;
+        /**
+         * @return The number of workers used by ParallelFor
+         */
+        int GetNWorkers(void) const {return Pool ? Pool->GetNThreads() : 1;};
         /**
          * A function used to eliminate redundancies in the covering that may arise due to numerical error.
          * @param[in] tolerance A tolerance for determining whether distinct vertices should be combined into a single vertex
          * @param[in] mult A multiplier that affects the degree of numerical accuracy
          */
         void CleanCovering(const double tolerance, const long int &mult);
-        /**
-         * Creates the Delaunay graph (Duel Graph) based on the partition stored in Covering.
-         * @param[out] Delaunay The Delaunay graph.
-         */
-        void CreateDelaunayGraph(DelaunayGraph &Delaunay) const;
         /**
          * Update the center locations based on the current configuration
          * @param[in] volumes The current volumes of the regions in Covering
@@ -654,9 +2107,72 @@ namespace AreaCon {
         /**
          * Update the weights based on the current configuration.
          * @param[in] volumes The current volumes of the regions in Covering
-         * @param[in] SharedEdges The current Delaunay graph.
+         * @param[in] Graph The current Delaunay graph (see CreateSharedEdges).
+         */
+        void GradientStepWeights(const std::vector<double> &volumes, const SparseAdjacency &Graph);
+        /**
+         * Update the weights by a damped Newton step for the volume equations. Raising the weight of a region by dw moves its boundary with a neighbor outward by dw/(2d), where d is the distance between the two centers, so the Jacobian of the volumes with respect to the weights is the graph Laplacian of Graph with edge coefficients L/(2d), where L is the line integral of the density over the shared edge. The Newton system is solved by conjugate gradients, and the step is halved until the volume error decreases sufficiently. The power diagram, volumes and error of the accepted step are left in Covering, volumes and error_vol. If the configuration contains empty regions, a gradient step is taken instead.
+         * @param[in,out] volumes The current volumes of the regions in Covering
+         * @param[in,out] error_vol The current volumetric error (see CalculateError)
+         * @param[in] Graph The current Delaunay graph (see CreateSharedEdges).
+         */
+        void NewtonStepWeights(std::vector<double> &volumes, double &error_vol, const SparseAdjacency &Graph);
+        /**
+         * Evaluates the line integral of the density along every edge of Graph.
+         * @param[in] Graph The current Delaunay graph (see CreateSharedEdges).
+         * @param[out] values The line integrals, in the order of the edges in Graph
+         */
+        void CalculateEdgeIntegrals(const SparseAdjacency &Graph, std::vector<double> &values);
+        /**
+         * Sums the values of the edges of Graph at their nodes, with a positive sign at the node whose row holds the edge and a negative sign at the neighbor. Every node gathers the values of its edges in increasing order of the edge index, i.e., in the order in which a serial loop over the edges would add them, so that the sums do not depend on the number of threads.
+         * @param[in] Graph The graph
+         * @param[in] values The value of every edge of Graph
+         * @param[out] totals The sum at every node
+         */
+        void AccumulateEdgeValues(const SparseAdjacency &Graph, const std::vector<double> &values, std::vector<double> &totals);
+        /**
+         * Solves (J+shift*I)x = b by conjugate gradients, where J is the graph Laplacian of Graph with the given edge coefficients.
+         * @param[in] Graph The Delaunay graph
+         * @param[in] coefficients The coefficient of every edge of Graph
+         * @param[in] shift A small non-negative shift removing the null space of the Laplacian
+         * @param[in] b The right-hand side
+         * @param[out] x The solution
+         */
+        void SolveLaplacian(const SparseAdjacency &Graph, const std::vector<double> &coefficients, const double shift, const std::vector<double> &b, std::vector<double> &x) const;
+        /**
+         * Constructs the power diagram, repeating the construction until it succeeds.
+         */
+        void RebuildPowerDiagram(void);
+        /**
+         * The implementation of CalculatePartition.
+         * @param[in,out] Sink The recipient of the snapshots (NULL if no snapshots are recorded)
+         */
+        void RunPartition(IterationSink *Sink);
+        /**
+         * Creates the coarse levels of the density pyramid (see Parameters::pyramid_levels). Levels whose grid would have fewer than 8 points in either direction are omitted.
+         * @param[out] Pyramid The levels, from the finest (half the resolution of Prior) to the coarsest
+         */
+        void CreatePyramid(std::vector<Density> &Pyramid) const;
+        /**
+         * Runs the iterations of CalculatePartition on the current Prior, starting from the current Centers and Weights.
+         * @param[in,out] Sink The recipient of the snapshots (NULL if no snapshots are recorded)
+         * @param[in,out] snapshot The number of the next snapshot
+         * @param[in] level The level of the density pyramid that Prior belongs to (0 = full resolution)
+         * @param[in] start The time at which CalculatePartition started
+         */
+        void SolveLevel(IterationSink *Sink, int &snapshot, const int level, const std::chrono::steady_clock::time_point start);
+        /**
+         * Adds the clip counters of the workspaces to Stats and resets them.
+         * @param[in,out] Work The workspaces
          */
-        void GradientStepWeights(const std::vector<double> &volumes, const DelaunayGraph &SharedEdges);
+        void CollectClipCalls(std::vector<CellWorkspace> &Work);
+        /**
+         * Offers a snapshot of the current configuration to Sink.
+         * @param[in,out] Sink The recipient of the snapshot (ignored if NULL)
+         * @param[in,out] iteration The index of the snapshot, incremented afterwards
+         * @param[in] final Flag indicating whether this is the final snapshot
+         */
+        void RecordSnapshot(IterationSink *Sink, int &iteration, const bool final = false) const;
         /**
          * Calculates a measure of volumetric error
          * @param[in] volumes The volumes of the regions in Covering.
@@ -664,10 +2180,116 @@ namespace AreaCon {
          */
         double CalculateError(const std::vector<double> &volumes);
         /**
-         * A function that calculates the volumes of the regions in Covering
+         * A function that calculates the volumes of the regions in Covering. The centroids are calculated in the same pass and stored in Centroids.
          * @return A vector containing the volumes of the regions in Covering.
          */
         std::vector<double> CalculateVolumes(void);
+        /**
+         * Returns the centroid of the region Covering[ii], re-using the value stored in Centroids if available.
+         * @param[in] ii The index of the region
+         * @param[in] volumes The current volumes of the regions in Covering
+         * @return The centroid
+         */
+        Point GetCentroid(const int ii, const std::vector<double> &volumes) const;
+    };
+    // BatchJob Class----------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * A partitioning problem to be solved by a BatchSolver, i.e., the arguments of the Partition constructor together with optional initial centers and weights (see Partition::InitializePartition).
+     */
+    class BatchJob
+    {
+    public:
+        //@{
+        /**
+         * Constructor.
+         * @param[in] NRegions The number of regions desired.
+         * @param[in] Prior The density function goverining partition creation
+         * @param[in] desired_area A vector containing the desired areas of the regions in the resulting configuration. Defaults to equal area.
+         * @param[in] Alg_Params Various algorithmic parameters. Every job is solved by a single thread of the solver, so num_threads must be 1 (otherwise the job fails, see BatchResult::Error).
+         * @param[in] Centers The initial centers (default centers if empty)
+         * @param[in] Weights The initial weights (0 if empty)
+         */
+        BatchJob(int NRegions = 0, Density Prior = Density(), std::vector<double> desired_area = {}, Parameters Alg_Params = Parameters(), std::vector<Point> Centers = {}, std::vector<double> Weights = {});
+        //@}
+        //@{
+        int NRegions;/**<The number of regions desired.*/
+        Density Prior;/**<The prior probability density function.*/
+        std::vector<double> desired_area;/**<A vector specifying the desired areas of the resultant configurations.*/
+        Parameters Alg_Params;/**<Algorithmic parameters.*/
+        std::vector<Point> Centers;/**<The initial centers (default centers if empty)*/
+        std::vector<double> Weights;/**<The initial weights (0 if empty)*/
+        //@}
+    };
+    // BatchResult Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The solution of a BatchJob.
+     */
+    class BatchResult
+    {
+    public:
+        //@{
+        std::vector<Poly> Covering;/**<The final regions (see Partition::GetCovering)*/
+        std::vector<Point> Centers;/**<The final centers*/
+        std::vector<double> Weights;/**<The final weights*/
+        PartitionStats Stats;/**<The timings and counters of the job*/
+        std::exception_ptr Error;/**<The exception thrown while solving the job, or null if it was solved*/
+        //@}
+    };
+    // BatchSolver Class-------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Solves many independent partitioning problems concurrently. Every job is solved by a single thread, and every thread owns a PartitionWorkspace that is re-used by all jobs it solves, also between calls to Solve. The jobs are dealt out to one queue per thread, largest first, and a thread whose queue is empty steals the last job of another queue, so that threads stay busy when the jobs differ in size. Since every Partition installs its own robustness constant (see RobustnessScope), jobs may use different Parameters.
+     */
+    class BatchSolver
+    {
+    public:
+        //@{
+        /**
+         * Constructor.
+         * @param[in] num_threads The number of threads used for solving jobs (1 = serial, 0 = the number of hardware threads)
+         */
+        BatchSolver(const int num_threads = 0);
+        //@}
+        /**
+         * @return The number of threads used for solving jobs
+         */
+        int GetNThreads(void) const {return Pool ? Pool->GetNThreads() : 1;};
+        /**
+         * Solves all jobs and waits for them to complete. A job that throws does not affect the others; its exception is stored in its result. Solve must not be called from several threads at once.
+         * @param[in] Jobs The jobs (the densities are moved into the partitions)
+         * @return The results, in the order of Jobs
+         */
+        std::vector<BatchResult> Solve(std::vector<BatchJob> Jobs);
+    private:
+        /**
+         * The job indices waiting to be solved by one thread.
+         */
+        class WorkQueue
+        {
+        public:
+            std::mutex Mutex;/**<Protects Jobs*/
+            std::deque<int> Jobs;/**<The indices of the jobs*/
+        };
+        std::shared_ptr<ThreadPool> Pool;/**<The threads used for solving jobs (null if serial)*/
+        std::vector<PartitionWorkspace> Workspaces;/**<The workspace of every thread*/
+        
+        /**
+         * Takes the next job of the queue-th queue or, if it is empty, steals the last job of another queue.
+         * @param[in,out] Queues The queues
+         * @param[in] queue The index of the queue of the calling thread
+         * @param[out] job The index of the job
+         * @return False if all queues are empty
+         */
+        bool NextJob(std::vector<WorkQueue> &Queues, const int queue, int &job) const;
+        /**
+         * Solves a single job with the given workspace.
+         * @param[in,out] Job The job (its density is moved into the partition)
+         * @param[in,out] Workspace The workspace lent to the partition
+         * @param[out] Result The result
+         */
+        void SolveJob(BatchJob &Job, PartitionWorkspace &Workspace, BatchResult &Result) const;
     };
     
 }//the AreaCon namespace
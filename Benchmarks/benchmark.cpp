@@ -0,0 +1,433 @@
+/********************************************/
+/**
+* @file benchmark.cpp
+* @details Benchmarks for the partitioning pipeline of AreaCon. Every scenario is synthetic and generated from a fixed seed, so that runs on the same machine are comparable across changes to the library. Results are written as JSON Lines, one record per benchmark, see PrintUsage for the options.
+* @copyright Copyright &copy; 2016. The Regents of the University of California. All rights reserved. Licensed pursuant to the terms and conditions available for viewing at: http://opensource.org/licenses/BSD-3-Clause .
+***********************************************/
+#include "areacon.h"
+#include <sys/resource.h>
+#include <random>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+
+using namespace AreaCon;
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+    // Options Class----------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The sizes of the scenarios and the settings of a benchmark run.
+     */
+    struct Options
+    {
+        std::vector<int> Grid_Sizes;/**<The number of grid points along each axis of the densities*/
+        std::vector<int> Region_Counts;/**<The numbers of regions of the power diagrams and partitions*/
+        std::vector<int> End_To_End_Grids;/**<The grid sizes of the end-to-end runs*/
+        std::vector<int> End_To_End_Regions;/**<The numbers of regions of the end-to-end runs*/
+        std::string filter;/**<Only benchmarks whose name contains filter are run*/
+        double min_time = 0.2;/**<The minimum time (in seconds) over which every micro-benchmark is repeated*/
+        int num_threads = 1;/**<The number of threads of the library (see Parameters::num_threads)*/
+        int max_iterations_centers = 100;/**<Upper bound on the center iterations of the end-to-end runs*/
+        unsigned seed = 1;/**<The seed of all random scenarios*/
+    };
+    /**
+     * @return The high-water mark of the resident set size of the process, in kilobytes
+     */
+    long PeakMemoryKB(void){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss/1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+    /**
+     * @return A uniformly distributed number in [0,1). The raw output of std::mt19937 is specified by the standard, unlike the distributions of <random>, so that the scenarios are the same on every platform.
+     */
+    double Uniform(std::mt19937 &Generator){
+        return Generator()/4294967296.0;
+    }
+    // Record Class-----------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * A single line of machine-readable output, i.e., a flat JSON object whose fields are written in the order in which they are added.
+     */
+    class Record
+    {
+    public:
+        Record(const std::string &benchmark){Add("benchmark", benchmark);}
+        Record &Add(const std::string &key, const std::string &value){
+            Fields<<(Fields.tellp()>0 ? "," : "")<<'"'<<key<<"\":\""<<value<<'"';
+            return *this;
+        }
+        Record &Add(const std::string &key, const char *value){return Add(key, std::string(value));}
+        Record &Add(const std::string &key, const double value){
+            Fields<<(Fields.tellp()>0 ? "," : "")<<'"'<<key<<"\":";
+            if (std::isfinite(value)){
+                Fields<<std::setprecision(9)<<value;
+            }else{
+                Fields<<"null";
+            }
+            return *this;
+        }
+        Record &Add(const std::string &key, const long value){
+            Fields<<(Fields.tellp()>0 ? "," : "")<<'"'<<key<<"\":"<<value;
+            return *this;
+        }
+        Record &Add(const std::string &key, const int value){return Add(key, (long) value);}
+        Record &Add(const std::string &key, const bool value){
+            Fields<<(Fields.tellp()>0 ? "," : "")<<'"'<<key<<"\":"<<(value ? "true" : "false");
+            return *this;
+        }
+        /**
+         * Writes the record, together with the current peak memory, to std::cout.
+         */
+        void Print(void){
+            Add("peak_rss_kb", PeakMemoryKB());
+            std::cout<<'{'<<Fields.str()<<'}'<<std::endl;
+        }
+    private:
+        std::ostringstream Fields;/**<The fields written so far*/
+    };
+    /**
+     * Repeats Task until at least min_time seconds have passed.
+     * @param[in] min_time The minimum total time
+     * @param[in] Task The task, which returns a value that is accumulated into checksum so that the work can not be optimized away
+     * @param[out] repetitions The number of calls of Task
+     * @param[in,out] checksum The sum of all values returned by Task
+     * @return The total time in seconds
+     */
+    double Repeat(const double min_time, const std::function<double(void)> &Task, long &repetitions, double &checksum){
+        Clock::time_point start = Clock::now();
+        double elapsed = 0;
+        repetitions = 0;
+        checksum = 0;
+        while (repetitions == 0 || elapsed<min_time){
+            checksum += Task();
+            repetitions++;
+            elapsed = std::chrono::duration<double>(Clock::now()-start).count();
+        }
+        return elapsed;
+    }
+    /**
+     * @return The regular polygon with NVertices vertices inscribed in the circle of radius 0.5 around (0.5,0.5)
+     */
+    Poly RegularPolygon(const int NVertices){
+        const double pi = 3.14159265358979323846;
+        std::vector<Point> Vertices;
+        for (int kk = 0; kk<NVertices; kk++){
+            Vertices.push_back(Point(0.5+0.5*cos(2*pi*kk/NVertices), 0.5+0.5*sin(2*pi*kk/NVertices)));
+        }
+        return Poly(Vertices);
+    }
+    /**
+     * Creates a synthetic density on the bounding box of Region.
+     * @param[in] Region The region of interest
+     * @param[in] G The number of grid points along each axis
+     * @param[in] mixture If false the density is uniform, otherwise it is a mixture of 8 Gaussians with random means, widths and weights over a constant floor
+     * @param[in] seed The seed of the mixture
+     * @param[in] num_threads The number of threads used for pre-processing the grid
+     * @return The density
+     */
+    Density CreateDensity(const Poly &Region, const int G, const bool mixture, const unsigned seed, const int num_threads){
+        const int NComponents = 8;
+        std::mt19937 Generator(seed);
+        double mx[NComponents], my[NComponents], s[NComponents], w[NComponents];
+        for (int kk = 0; kk<NComponents; kk++){
+            mx[kk] = Uniform(Generator);
+            my[kk] = Uniform(Generator);
+            s[kk] = 0.03+0.12*Uniform(Generator);
+            w[kk] = 0.5+Uniform(Generator);
+        }
+        double minx = INFINITY, miny = INFINITY, maxx = -INFINITY, maxy = -INFINITY;
+        for (const Point &p : Region.GetVertices()){
+            minx = std::min(minx, p.x);
+            miny = std::min(miny, p.y);
+            maxx = std::max(maxx, p.x);
+            maxy = std::max(maxy, p.y);
+        }
+        std::vector<double> Values((size_t) G*G, 1);
+        if (mixture){
+            for (int ii = 0; ii<G; ii++){
+                double x = minx+(maxx-minx)*ii/(G-1);
+                for (int jj = 0; jj<G; jj++){
+                    double y = miny+(maxy-miny)*jj/(G-1), value = 0.1;
+                    for (int kk = 0; kk<NComponents; kk++){
+                        value += w[kk]*exp(-((x-mx[kk])*(x-mx[kk])+(y-my[kk])*(y-my[kk]))/(2*s[kk]*s[kk]));
+                    }
+                    Values[(size_t) G*ii+jj] = value;
+                }
+            }
+        }
+        return Density(Region, G, G, std::move(Values), num_threads);
+    }
+    /**
+     * @return Count random points inside Region, generated by rejection sampling
+     */
+    std::vector<Point> RandomPoints(const Poly &Region, const int Count, std::mt19937 &Generator){
+        std::vector<Point> Points;
+        while (Points.size()<Count){
+            Point p(Uniform(Generator), Uniform(Generator));
+            if (Region.pnpoly(p)){
+                Points.push_back(p);
+            }
+        }
+        return Points;
+    }
+    /**
+     * @return The algorithmic parameters shared by all benchmarks
+     */
+    Parameters BenchmarkParameters(const Options &Opts, const PowerDiagramMethod method){
+        return Parameters(0.1, 0.1, 1, 0.002, 0.02, 200, Opts.max_iterations_centers, 10e-6, 10e-8, method, Opts.num_threads, Column_Spans);
+    }
+    /**
+     * @return The parameters of the shortest possible run of Partition::CalculatePartition (one center and one volume iteration), which constructs four power diagrams
+     */
+    Parameters DiagramParameters(const Options &Opts, const PowerDiagramMethod method){
+        return Parameters(0.1, 0.1, 1, 0.002, 0.02, 1, 1, 10e-6, 10e-8, method, Opts.num_threads, Column_Spans);
+    }
+    const char *DensityName(const bool mixture){return mixture ? "gaussian_mixture" : "uniform";}
+    bool Selected(const Options &Opts, const std::string &name){
+        return Opts.filter.empty() || name.find(Opts.filter) != std::string::npos;
+    }
+    bool Selected(const Options &Opts, std::initializer_list<const char *> Names){
+        for (const char *name : Names){
+            if (Selected(Opts, name)){
+                return true;
+            }
+        }
+        return false;
+    }
+    // Benchmarks-------------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * Poly::pnpoly on random points of the unit square, for polygons with few and many vertices.
+     */
+    void BenchmarkPnpoly(const Options &Opts){
+        const int NPoints = 100000;
+        std::mt19937 Generator(Opts.seed);
+        std::vector<Point> Points(NPoints);
+        for (Point &p : Points){
+            p = Point(Uniform(Generator), Uniform(Generator));
+        }
+        for (int NVertices : {6, 64}){
+            Poly Test = RegularPolygon(NVertices);
+            long repetitions;
+            double checksum;
+            double time = Repeat(Opts.min_time, [&](){
+                long inside = 0;
+                for (const Point &p : Points){
+                    inside += Test.pnpoly(p);
+                }
+                return (double) inside;
+            }, repetitions, checksum);
+            Record("Poly::pnpoly").Add("vertices", NVertices).Add("ops", repetitions*NPoints).Add("time_s", time).Add("time_per_op_s", time/(repetitions*NPoints)).Add("checksum", checksum/repetitions).Print();
+        }
+    }
+    /**
+     * Density construction (pre-processing of the integral tables), Density::LineIntegral on random chords and Density::CalculateWeightedArea on the cells of a power diagram, for every grid size.
+     */
+    void BenchmarkDensity(const Options &Opts){
+        const Poly Region = RegularPolygon(6);
+        const int NLines = 1000, NCells = 100;
+        for (bool mixture : {false, true}){
+            for (int G : Opts.Grid_Sizes){
+                Clock::time_point start = Clock::now();
+                Density Prior = CreateDensity(Region, G, mixture, Opts.seed, Opts.num_threads);
+                double build_time = std::chrono::duration<double>(Clock::now()-start).count();
+                if (Selected(Opts, "Density::Density")){
+                    Record("Density::Density").Add("density", DensityName(mixture)).Add("grid", G).Add("ops", 1).Add("time_s", build_time).Add("time_per_op_s", build_time).Print();
+                }
+                const double spacing = 1.0/(G-1);
+                std::mt19937 Generator(Opts.seed);
+                if (Selected(Opts, "Density::LineIntegral")){
+                    std::vector<Point> Ends = RandomPoints(Region, 2*NLines, Generator);
+                    long repetitions;
+                    double checksum;
+                    double time = Repeat(Opts.min_time, [&](){
+                        double sum = 0;
+                        for (int kk = 0; kk<NLines; kk++){
+                            sum += Prior.LineIntegral(spacing, Ends[2*kk], Ends[2*kk+1]);
+                        }
+                        return sum;
+                    }, repetitions, checksum);
+                    Record("Density::LineIntegral").Add("density", DensityName(mixture)).Add("grid", G).Add("ops", repetitions*NLines).Add("time_s", time).Add("time_per_op_s", time/(repetitions*NLines)).Add("checksum", checksum/repetitions).Print();
+                }
+                if (Selected(Opts, "Density::CalculateWeightedArea")){
+                    Partition Diagram(NCells, Prior, {}, DiagramParameters(Opts, Nearest_Neighbors));
+                    Diagram.InitializePartition(RandomPoints(Region, NCells, Generator));
+                    Diagram.CalculatePartition(false);
+                    const std::vector<Poly> &Cells = Diagram.GetCovering();
+                    long repetitions;
+                    double checksum;
+                    double time = Repeat(Opts.min_time, [&](){
+                        double sum = 0;
+                        for (const Poly &Cell : Cells){
+                            sum += Prior.CalculateWeightedArea(Cell);
+                        }
+                        return sum;
+                    }, repetitions, checksum);
+                    Record("Density::CalculateWeightedArea").Add("density", DensityName(mixture)).Add("grid", G).Add("regions", NCells).Add("ops", repetitions*NCells).Add("time_s", time).Add("time_per_op_s", time/(repetitions*NCells)).Add("checksum", checksum/repetitions).Print();
+                }
+            }
+        }
+    }
+    /**
+     * The construction of power diagrams from random centers and weights, broken down into the phases recorded by PartitionStats: the whole construction (Partition::CreatePowerDiagram), the removal of spurious vertices (Partition::CleanCovering, All_Pairs only) and the collection of the Delaunay graph (Partition::CreateSharedEdges). The diagrams are those of the shortest run of Partition::CalculatePartition (see DiagramParameters), which is repeated from the same centers and weights; only the time spent in the phases is reported.
+     */
+    void BenchmarkDiagrams(const Options &Opts){
+        const Poly Region = RegularPolygon(6);
+        const int G = 100;
+        Density Prior = CreateDensity(Region, G, true, Opts.seed, Opts.num_threads);
+        for (PowerDiagramMethod method : {Nearest_Neighbors, All_Pairs}){
+            const char *method_name = (method == All_Pairs) ? "all_pairs" : "nearest_neighbors";
+            for (int N : Opts.Region_Counts){
+                std::mt19937 Generator(Opts.seed);
+                std::vector<Point> Centers = RandomPoints(Region, N, Generator);
+                std::vector<double> Weights(N);
+                for (double &w : Weights){
+                    w = 0.01*Uniform(Generator)/N;
+                }
+                Partition Diagram(N, Prior, {}, DiagramParameters(Opts, method));
+                long repetitions, diagrams = 0, retries = 0;
+                double checksum, diagram_time = 0, clean_covering_time = 0, adjacency_time = 0;
+                //CalculatePartition resets the stats, so that they are collected after every run
+                Repeat(Opts.min_time, [&](){
+                    Diagram.InitializePartition(Centers, Weights);
+                    Diagram.CalculatePartition(false);
+                    PartitionStats Stats = Diagram.GetStats();
+                    diagrams += Stats.diagram_calls;
+                    retries += Stats.diagram_retries;
+                    diagram_time += Stats.diagram_time;
+                    clean_covering_time += Stats.clean_covering_time;
+                    adjacency_time += Stats.adjacency_time;
+                    return (double) Diagram.GetAdjacency().GetNEdges();
+                }, repetitions, checksum);
+                struct Phase{const char *name; double time;};
+                for (const Phase &phase : {Phase{"Partition::CreatePowerDiagram", diagram_time}, Phase{"Partition::CleanCovering", clean_covering_time}, Phase{"Partition::CreateSharedEdges", adjacency_time}}){
+                    if (Selected(Opts, phase.name) && !(method == Nearest_Neighbors && phase.time == 0)){
+                        Record(phase.name).Add("method", method_name).Add("regions", N).Add("ops", diagrams).Add("time_s", phase.time).Add("time_per_op_s", phase.time/diagrams).Add("retries", retries).Add("checksum", checksum/repetitions).Print();
+                    }
+                }
+            }
+        }
+    }
+    /**
+     * Complete runs of Partition::CalculatePartition with equal target areas (the default of an empty desired_area), for every combination of grid size and number of regions.
+     */
+    void BenchmarkPartition(const Options &Opts){
+        const Poly Region = RegularPolygon(6);
+        for (bool mixture : {false, true}){
+            for (int G : Opts.End_To_End_Grids){
+                Density Prior = CreateDensity(Region, G, mixture, Opts.seed, Opts.num_threads);
+                for (int N : Opts.End_To_End_Regions){
+                    std::mt19937 Generator(Opts.seed);
+                    Parameters Alg_Params = BenchmarkParameters(Opts, Nearest_Neighbors);
+                    Partition Solver(N, Prior, {}, Alg_Params);
+                    Solver.InitializePartition(RandomPoints(Region, N, Generator));
+                    double center_error = INFINITY, volume_error = INFINITY;
+                    long center_iterations = 0;
+                    Solver.SetProgressCallback([&](const ProgressInfo &Info){
+                        center_error = Info.center_error;
+                        volume_error = Info.volume_error;
+                        center_iterations += Info.center_step;
+                    });
+                    Clock::time_point start = Clock::now();
+                    Solver.CalculatePartition(false);
+                    double time = std::chrono::duration<double>(Clock::now()-start).count();
+                    PartitionStats Stats = Solver.GetStats();
+                    //A run has converged only if both stopping criteria of the last center iteration were met
+                    bool centers_converged = center_error<=Alg_Params.convergence_criterion, volumes_converged = volume_error<=Alg_Params.volume_tolerance;
+                    Record("Partition::CalculatePartition").Add("density", DensityName(mixture)).Add("grid", G).Add("regions", N).Add("time_s", time).Add("center_iterations", center_iterations).Add("weight_steps", Stats.weight_steps).Add("diagram_calls", Stats.diagram_calls).Add("converged", centers_converged && volumes_converged).Add("centers_converged", centers_converged).Add("volumes_converged", volumes_converged).Add("center_error", center_error).Add("volume_error", volume_error).Add("diagram_time_s", Stats.diagram_time).Add("volumes_time_s", Stats.volumes_time).Add("weights_time_s", Stats.weights_time).Add("centers_time_s", Stats.centers_time).Print();
+                }
+            }
+        }
+    }
+    void PrintUsage(const char *name){
+        std::cerr<<"Usage: "<<name<<" [options]\n"
+        <<"  --preset quick|default|full  Scenario sizes (default: default). full covers grids of 100^2 to 4000^2 and 10 to 5000 regions\n"
+        <<"  --filter NAME                Only run benchmarks whose name contains NAME, e.g. Density::LineIntegral\n"
+        <<"  --threads N                  Number of library threads (default: 1)\n"
+        <<"  --min-time SECONDS           Minimum time of every micro-benchmark (default: 0.2)\n"
+        <<"  --max-center-iterations N    Upper bound on the center iterations of CalculatePartition (default: 100)\n"
+        <<"  --seed N                     Seed of the random scenarios (default: 1)\n"
+        <<"Results are written to stdout as JSON Lines. peak_rss_kb is the high-water mark of the process, so that scenarios run in increasing size; use --filter to measure a single benchmark in isolation.\n";
+    }
+    /**
+     * Fills in the scenario sizes of a preset.
+     * @return False if the preset is unknown
+     */
+    bool SetPreset(const std::string &preset, Options &Opts){
+        if (preset == "quick"){
+            Opts.Grid_Sizes = {100, 200};
+            Opts.Region_Counts = {10, 50};
+            Opts.End_To_End_Grids = {100};
+            Opts.End_To_End_Regions = {10};
+        }else if (preset == "default"){
+            Opts.Grid_Sizes = {100, 500, 1000};
+            Opts.Region_Counts = {10, 100, 500, 1000};
+            Opts.End_To_End_Grids = {100, 500};
+            Opts.End_To_End_Regions = {10, 100};
+        }else if (preset == "full"){
+            Opts.Grid_Sizes = {100, 500, 1000, 2000, 4000};
+            Opts.Region_Counts = {10, 100, 500, 1000, 5000};
+            Opts.End_To_End_Grids = {100, 1000, 4000};
+            Opts.End_To_End_Regions = {10, 100, 1000, 5000};
+        }else{
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv){
+    Options Opts;
+    SetPreset("default", Opts);
+    for (int kk = 1; kk<argc; kk++){
+        std::string arg = argv[kk];
+        if (arg == "--help" || arg == "-h"){
+            PrintUsage(argv[0]);
+            return 0;
+        }else if (kk+1 == argc){
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++kk];
+        if (arg == "--preset" && SetPreset(value, Opts)){
+        }else if (arg == "--filter"){
+            Opts.filter = value;
+        }else if (arg == "--threads"){
+            Opts.num_threads = atoi(value.c_str());
+        }else if (arg == "--min-time"){
+            Opts.min_time = atof(value.c_str());
+        }else if (arg == "--max-center-iterations"){
+            Opts.max_iterations_centers = atoi(value.c_str());
+        }else if (arg == "--seed"){
+            Opts.seed = (unsigned) atol(value.c_str());
+        }else{
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    try{
+        if (Selected(Opts, "Poly::pnpoly")){
+            BenchmarkPnpoly(Opts);
+        }
+        if (Selected(Opts, {"Density::Density", "Density::LineIntegral", "Density::CalculateWeightedArea"})){
+            BenchmarkDensity(Opts);
+        }
+        if (Selected(Opts, {"Partition::CreatePowerDiagram", "Partition::CleanCovering", "Partition::CreateSharedEdges"})){
+            BenchmarkDiagrams(Opts);
+        }
+        if (Selected(Opts, "Partition::CalculatePartition")){
+            BenchmarkPartition(Opts);
+        }
+    }catch (const std::exception &e){
+        std::cerr<<"Benchmark failed: "<<e.what()<<'\n';
+        return 1;
+    }
+    return 0;
+}
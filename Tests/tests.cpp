@@ -0,0 +1,1095 @@
+/********************************************/
+/**
+* @file tests.cpp
+* @details Regression tests for AreaCon. Every test is a function that throws if one of its checks fails; the name of a test can be given on the command line to run it alone, otherwise all tests are run.
+* @copyright Copyright &copy; 2016. The Regents of the University of California. All rights reserved. Licensed pursuant to the terms and conditions available for viewing at: http://opensource.org/licenses/BSD-3-Clause .
+***********************************************/
+#include "areacon.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <sstream>
+
+using namespace AreaCon;
+
+/**
+ * Throws if condition does not hold (unlike assert, CHECK is not disabled in release builds).
+ */
+#define CHECK(condition) if (!(condition)) throw std::runtime_error(std::string(__FILE__)+":"+std::to_string(__LINE__)+": CHECK("+#condition+") failed")
+
+namespace {
+    /**
+     * @return The convex pentagon used as the region of interest of most tests
+     */
+    Poly Pentagon(void){
+        return Poly({Point(0,0), Point(2,0), Point(2.5,1), Point(1,2), Point(-0.3,1)});
+    }
+    /**
+     * @return A triangle, a quadrilateral and the pentagon, in general position with respect to the grids over the pentagon
+     */
+    std::vector<Poly> TestRegions(void){
+        return {Poly({Point(0.2,0.1), Point(2.1,0.6), Point(0.9,1.7)}), Poly({Point(-0.2,0.5), Point(1.1,0.2), Point(1.3,1.4), Point(0.1,1.2)}), Pentagon()};
+    }
+    /**
+     * @return The unit square
+     */
+    Poly UnitSquare(void){
+        return Poly({Point(0,0), Point(1,0), Point(1,1), Point(0,1)});
+    }
+    /**
+     * @return The values of a Gaussian bump over a constant floor, multiplied by scale, at the G*G grid points of the bounding box of Region
+     */
+    std::vector<double> GaussianValues(const Poly &Region, const int G, const double scale = 1){
+        double minx, miny, maxx, maxy;
+        Region.GetExtrema(minx, miny, maxx, maxy);
+        std::vector<double> Values((size_t) G*G);
+        for (int ii = 0; ii<G; ii++){
+            for (int jj = 0; jj<G; jj++){
+                double x = minx+(maxx-minx)*ii/(G-1), y = miny+(maxy-miny)*jj/(G-1);
+                Values[(size_t) G*ii+jj] = scale*(0.5+exp(-((x-1)*(x-1)+(y-1)*(y-1))*2));
+            }
+        }
+        return Values;
+    }
+    /**
+     * @return The values of f at the G*G grid points of the unit square
+     */
+    std::vector<double> UnitSquareValues(const int G, const std::function<double(double x, double y)> &f){
+        std::vector<double> Values((size_t) G*G);
+        for (int ii = 0; ii<G; ii++){
+            for (int jj = 0; jj<G; jj++){
+                Values[(size_t) G*ii+jj] = f((double) ii/(G-1), (double) jj/(G-1));
+            }
+        }
+        return Values;
+    }
+    /**
+     * @return The bilinear function whose interpolant on any grid is the function itself
+     */
+    double Bilinear(const double x, const double y){
+        return 1+x+2*y+3*x*y;
+    }
+    /**
+     * @return The parameters of the partition tests, which differ from the defaults only in the arguments
+     */
+    Parameters TestParameters(const int num_threads, const IntegrationMethod integration_method = Column_Spans, const int max_iterations_centers = 10, const bool exact_integration = false, const bool incremental_diagram = false, const WeightUpdateMethod weights_method = Gradient_Descent, const int pyramid_levels = 1){
+        return Parameters(0.1, 0.1, 1, 0.002, 0.02, 200, max_iterations_centers, 10e-6, 10e-8, Nearest_Neighbors, num_threads, integration_method, exact_integration, incremental_diagram, false, 0, weights_method, pyramid_levels);
+    }
+    /**
+     * Runs CalculatePartition from the default centers.
+     * @return The partition after the run
+     */
+    Partition RunPartition(const int NRegions, const Density &Prior, const Parameters &Alg_Params){
+        Partition Result(NRegions, Prior, {}, Alg_Params);
+        Result.InitializePartition();
+        Result.CalculatePartition(false);
+        return Result;
+    }
+    /**
+     * Draws centers uniformly from Region and weights uniformly from [0, max_weight].
+     * @param[in] seed The seed of the random number generator
+     * @param[out] Centers, Weights The NRegions centers and weights
+     */
+    void RandomCenters(const Poly &Region, const int NRegions, const double max_weight, const unsigned seed, std::vector<Point> &Centers, std::vector<double> &Weights){
+        std::mt19937 Generator(seed);
+        double minx, miny, maxx, maxy;
+        Region.GetExtrema(minx, miny, maxx, maxy);
+        Centers.clear();
+        Weights.clear();
+        while (Centers.size()<NRegions){
+            Point Candidate;
+            Candidate.x = minx+(maxx-minx)*(Generator()/4294967296.0);
+            Candidate.y = miny+(maxy-miny)*(Generator()/4294967296.0);
+            if (Region.pnpoly(Candidate)){
+                Centers.push_back(Candidate);
+                Weights.push_back(max_weight*(Generator()/4294967296.0));
+            }
+        }
+    }
+    /**
+     * Reads a snapshot of the regions from a partition file written by Partition::CalculatePartition, in which every snapshot consists of one line per region followed by an empty line.
+     * @param[in] snapshot The index of the snapshot (0 = before the first power diagram)
+     * @return The vertices of every region
+     */
+    std::vector<std::vector<Point>> ReadSnapshot(const std::string filename, const int NRegions, const int snapshot){
+        std::ifstream File(filename);
+        std::string Line;
+        std::vector<std::vector<Point>> Regions;
+        for (int line = 0; line<(snapshot+1)*(NRegions+1) && std::getline(File, Line); line++){
+            if (line>=snapshot*(NRegions+1) && line<snapshot*(NRegions+1)+NRegions){
+                std::istringstream Stream(Line);
+                std::vector<Point> Vertices;
+                double x, y;
+                char comma;
+                while (Stream>>x>>comma>>y){
+                    Vertices.push_back(Point(x, y));
+                }
+                Regions.push_back(Vertices);
+            }
+        }
+        return Regions;
+    }
+    /**
+     * @return Indicator of whether every vertex of A lies within tolerance of a vertex of B and vice versa
+     */
+    bool SameVertices(const std::vector<Point> &A, const std::vector<Point> &B, const double tolerance){
+        for (int pass = 0; pass<2; pass++){
+            const std::vector<Point> &From = pass ? B : A, &To = pass ? A : B;
+            for (const Point &Vertex : From){
+                double distance = INFINITY;
+                for (const Point &Other : To){
+                    distance = std::min(distance, Point::Distance(Vertex, Other));
+                }
+                if (distance>tolerance){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    /**
+     * @return The largest difference between the entries of Result and Expected, relative to the largest entry of Expected
+     */
+    double RelativeDifference(const std::vector<double> &Result, const std::vector<double> &Expected){
+        double difference = (Result.size() == Expected.size()) ? 0 : INFINITY, scale = 0;
+        for (int kk = 0; kk<Expected.size() && kk<Result.size(); kk++){
+            difference = std::max(difference, fabs(Result[kk]-Expected[kk]));
+            scale = std::max(scale, fabs(Expected[kk]));
+        }
+        return (scale>0) ? difference/scale : difference;
+    }
+    // Tests------------------------------------------------------------------------------------------------------------
+    // ------------------------------------------------------------------------------------------------------------------
+    /**
+     * The nearest-neighbor construction yields the same cells as the construction from all pairs of centers, for random centers and weights with hidden (empty) cells, and the same neighbor sets.
+     */
+    void TestNearestNeighbors(void){
+        const int NRegions = 20;
+        const std::string filename_partition = "areacon_tests_partition.txt", filename_centers = "areacon_tests_centers.txt";
+        Density Prior(Pentagon(), 60, 60, GaussianValues(Pentagon(), 60));
+        for (unsigned seed = 1; seed<=3; seed++){
+            std::vector<Point> Centers;
+            std::vector<double> Weights;
+            RandomCenters(Pentagon(), NRegions, 0.5, seed, Centers, Weights);
+            std::vector<std::vector<Point>> Initial[2];
+            std::vector<Poly> Final[2];
+            std::set<std::pair<int,int>> Neighbors[2];
+            for (int method = 0; method<2; method++){
+                //A single weight and center step; the second snapshot holds the diagram of the random centers and weights
+                Partition Result(NRegions, Prior, {}, Parameters(0.1, 0.1, 1, 0.002, 0.02, 1, 1, 10e-6, 10e-8, method ? Nearest_Neighbors : All_Pairs));
+                Result.InitializePartition(Centers, Weights);
+                Result.CalculatePartition(true, filename_partition, filename_centers);
+                Initial[method] = ReadSnapshot(filename_partition, NRegions, 1);
+                Final[method] = Result.GetCovering();
+                const SparseAdjacency &Adjacency = Result.GetAdjacency();
+                for (int ii = 0; ii<Adjacency.GetNRows(); ii++){
+                    for (int kk = Adjacency.Offsets[ii]; kk<Adjacency.Offsets[ii+1]; kk++){
+                        Neighbors[method].insert(std::make_pair(std::min(ii, Adjacency.Neighbors[kk]), std::max(ii, Adjacency.Neighbors[kk])));
+                    }
+                }
+            }
+            std::remove(filename_partition.c_str());
+            std::remove(filename_centers.c_str());
+            CHECK(Initial[0].size() == NRegions && Initial[1].size() == NRegions);
+            int hidden = 0;
+            for (int ii = 0; ii<NRegions; ii++){
+                //The snapshots are written with 6 significant digits
+                CHECK(Initial[0][ii].empty() == Initial[1][ii].empty() && SameVertices(Initial[0][ii], Initial[1][ii], 2e-5));
+                CHECK(SameVertices(Final[0][ii].GetVertices(), Final[1][ii].GetVertices(), 1e-6));
+                hidden += Initial[0][ii].empty();
+            }
+            CHECK(hidden>0);
+            CHECK(!Neighbors[0].empty() && Neighbors[0] == Neighbors[1]);
+        }
+    }
+    /**
+     * @return The indices (Ny-1)*i+j of the grid squares of the G*G grid of the unit square whose four corners lie in the closed convex polygon Cell, tested with exact orientation predicates on the grid points minx+i*dx
+     */
+    std::vector<int> SquaresInCell(const Poly &Cell, const int G){
+        const std::vector<Point> Vertices = Cell.GetVertices();
+        const double h = 1.0/(G-1);
+        auto Inside = [&Vertices, h](const int ii, const int jj){
+            const double x = ii*h, y = jj*h;
+            for (int kk = 0; kk<Vertices.size(); kk++){
+                const Point &p1 = Vertices[kk], &p2 = Vertices[(kk+1)%Vertices.size()];
+                if ((p2.x-p1.x)*(y-p1.y)-(p2.y-p1.y)*(x-p1.x)<0){
+                    return false;
+                }
+            }
+            return true;
+        };
+        std::vector<int> Squares;
+        for (int ii = 0; ii<G-1; ii++){
+            for (int jj = 0; jj<G-1; jj++){
+                if (Inside(ii, jj) && Inside(ii+1, jj) && Inside(ii, jj+1) && Inside(ii+1, jj+1)){
+                    Squares.push_back((G-1)*ii+jj);
+                }
+            }
+        }
+        return Squares;
+    }
+    /**
+     * The integrals of a covering computed in one pass are the sums over the grid squares inside every cell, and agree with the per-region sweep, also for cells whose edges pass through grid points.
+     */
+    void TestCoveringIntegrals(void){
+        const int G = 41;
+        Density Prior(UnitSquare(), G, G, GaussianValues(UnitSquare(), G));
+        const Int_Params Integral = Prior.GetIntegral();
+        const double scale = Prior.GetVolumeScale();
+        //Triangles around an interior point of a quadrilateral whose edges miss the grid points
+        const std::vector<Point> Corners = {Point(0.13,0.07), Point(0.91,0.22), Point(0.83,0.94), Point(0.05,0.71)};
+        const Point Inner(0.437, 0.561);
+        std::vector<Poly> General;
+        for (int kk = 0; kk<4; kk++){
+            General.push_back(Poly({Corners[kk], Corners[(kk+1)%4], Inner}));
+        }
+        //Counter-clockwise cells of the unit square split by the line x = 0.5 and the diagonal, which pass through grid points
+        const std::vector<Poly> Aligned = {Poly({Point(0,0), Point(0.5,0), Point(0.5,0.5)}), Poly({Point(0,0), Point(0.5,0.5), Point(0.5,1), Point(0,1)}), Poly({Point(0.5,0), Point(1,0), Point(1,1), Point(0.5,0.5)}), Poly({Point(0.5,0.5), Point(1,1), Point(0.5,1)})};
+        for (const std::vector<Poly> &Covering : {General, Aligned}){
+            std::vector<double> Volumes;
+            std::vector<Point> Centroids;
+            std::vector<int> Owner;
+            Prior.CalculateCoveringIntegrals(Covering, Volumes, Centroids, Owner);
+            CHECK(Volumes.size() == Covering.size() && Centroids.size() == Covering.size());
+            std::vector<int> Expected_Owner((G-1)*(G-1), -1);
+            for (int kk = 0; kk<Covering.size(); kk++){
+                double volume = 0, sumx = 0, sumy = 0;
+                for (int index : SquaresInCell(Covering[kk], G)){
+                    Expected_Owner[index] = kk;
+                    volume += Integral.Int[index];
+                    sumx += Integral.Intx[index];
+                    sumy += Integral.Inty[index];
+                }
+                CHECK(fabs(Volumes[kk]-volume/scale)<=1e-12);
+                CHECK(Point::Distance(Centroids[kk], Point(sumx/volume, sumy/volume))<=1e-12);
+            }
+            CHECK(Owner == Expected_Owner);
+        }
+        //Free-standing sweeps use the default robustness constant, so that grid points on the edges are counted as well
+        for (const std::vector<Poly> &Covering : {General, Aligned}){
+            std::vector<double> Volumes;
+            std::vector<Point> Centroids;
+            std::vector<int> Owner;
+            Prior.CalculateCoveringIntegrals(Covering, Volumes, Centroids, Owner);
+            for (int kk = 0; kk<Covering.size(); kk++){
+                const double volume = Prior.CalculateWeightedArea(Covering[kk]);
+                CHECK(fabs(Volumes[kk]-volume)<=1e-12);
+                CHECK(Point::Distance(Centroids[kk], Prior.CalculateCentroid(Covering[kk], volume))<=1e-12);
+            }
+        }
+    }
+    /**
+     * The integrals over the grid squares are those of the bilinear interpolant: for a bilinear density, the integral over a square is proportional to the value at its center.
+     */
+    void TestBilinearCoefficients(void){
+        const int G = 11;
+        const double h = 1.0/(G-1);
+        Density Plane(UnitSquare(), G, G, UnitSquareValues(G, Bilinear));
+        const std::vector<double> Int = Plane.GetIntegral().Int;
+        CHECK(Int.size() == (G-1)*(G-1));
+        for (int ii = 0; ii<G-1; ii++){
+            for (int jj = 0; jj<G-1; jj++){
+                CHECK(fabs(Int[ii*(G-1)+jj]/Int[0]-Bilinear((ii+0.5)*h, (jj+0.5)*h)/Bilinear(h/2, h/2))<=1e-12);
+            }
+        }
+    }
+    /**
+     * Exact integration agrees with the integrals of the grid squares on polygons made of whole grid squares, is exact for bilinear densities on arbitrary polygons, and the volumes of polygons that tile the region sum to 1.
+     */
+    void TestExactIntegration(void){
+        const Poly Square = UnitSquare();
+        const int G = 41;
+        Density Sweep(Square, G, G, GaussianValues(Square, G)), Exact = Sweep;
+        Exact.SetExactIntegration(true);
+        //The squares of the block are those with lower-left grid points (i,j), 10<=i<30 and 10<=j<20
+        const Poly Block({Point(0.25,0.25), Point(0.75,0.25), Point(0.75,0.5), Point(0.25,0.5)});
+        const std::vector<double> Int = Sweep.GetIntegral().Int;
+        double block = 0;
+        for (int ii = 10; ii<30; ii++){
+            for (int jj = 10; jj<20; jj++){
+                block += Int[(G-1)*ii+jj];
+            }
+        }
+        CHECK(fabs(Exact.CalculateWeightedArea(Block)-block/Sweep.GetVolumeScale())<=1e-12);
+        //Triangles around an interior point tile the square; only their two outer edges are grid-aligned
+        const Point Inner(0.437, 0.561);
+        double total = 0;
+        for (int kk = 0; kk<4; kk++){
+            total += Exact.CalculateWeightedArea(Poly({Square.GetVertices()[kk], Square.GetVertices()[(kk+1)%4], Inner}));
+        }
+        CHECK(fabs(total-1)<=1e-12);
+        //The bilinear interpolant of a bilinear function is the function itself. Its total over the square is 3.25, and the edge-midpoint rule is exact for quadratics on triangles.
+        Density Plane(Square, G, G, UnitSquareValues(G, Bilinear));
+        Plane.SetExactIntegration(true);
+        const Poly Triangle({Point(0.113,0.071), Point(0.87,0.33), Point(0.41,0.93)});
+        const std::vector<Point> Vertices = Triangle.GetVertices();
+        const double area = fabs((Vertices[1].x-Vertices[0].x)*(Vertices[2].y-Vertices[0].y)-(Vertices[2].x-Vertices[0].x)*(Vertices[1].y-Vertices[0].y))/2;
+        double expected = 0;
+        for (int kk = 0; kk<3; kk++){
+            expected += Bilinear((Vertices[kk].x+Vertices[(kk+1)%3].x)/2, (Vertices[kk].y+Vertices[(kk+1)%3].y)/2);
+        }
+        expected *= area/3/3.25;
+        CHECK(fabs(Plane.CalculateWeightedArea(Triangle)-expected)<=1e-12);
+    }
+    /**
+     * The prefix sums hold the running sums of the integrals of the grid squares of every column, and the column spans summed from them agree with the per-region sweep, with and without exact integration.
+     */
+    void TestColumnSpans(void){
+        const int G = 60;
+        Density Prior(Pentagon(), G, G, GaussianValues(Pentagon(), G));
+        const Int_Params Integral = Prior.GetIntegral();
+        CHECK(Integral.Int_Prefix.size() == (G-1)*G && Integral.Intx_Prefix.size() == (G-1)*G && Integral.Inty_Prefix.size() == (G-1)*G);
+        for (int ii = 0; ii<G-1; ii++){
+            double sum = 0, sumx = 0, sumy = 0;
+            for (int jj = 0; jj<G; jj++){
+                CHECK(Integral.Int_Prefix[G*ii+jj] == sum && Integral.Intx_Prefix[G*ii+jj] == sumx && Integral.Inty_Prefix[G*ii+jj] == sumy);
+                if (jj<G-1){
+                    sum += Integral.Int[(G-1)*ii+jj];
+                    sumx += Integral.Intx[(G-1)*ii+jj];
+                    sumy += Integral.Inty[(G-1)*ii+jj];
+                }
+            }
+        }
+        const std::vector<Poly> Regions = TestRegions();
+        for (bool exact : {false, true}){
+            Prior.SetExactIntegration(exact);
+            std::vector<double> Volumes;
+            std::vector<Point> Centroids;
+            Prior.CalculateSpanIntegrals(Regions, Volumes, Centroids);
+            CHECK(Volumes.size() == Regions.size() && Centroids.size() == Regions.size());
+            for (int kk = 0; kk<Regions.size(); kk++){
+                const double volume = Prior.CalculateWeightedArea(Regions[kk]);
+                CHECK(fabs(Volumes[kk]-volume)<=1e-12*volume);
+                CHECK(Point::Distance(Centroids[kk], Prior.CalculateCentroid(Regions[kk], volume))<=1e-12);
+            }
+        }
+    }
+    /**
+     * Runs with incremental diagram updates produce the same coverings, centers and weights as runs that rebuild every diagram.
+     */
+    void TestIncrementalDiagram(void){
+        const int NRegions = 20;
+        Density Prior(Pentagon(), 60, 60, GaussianValues(Pentagon(), 60));
+        Partition Rebuilt = RunPartition(NRegions, Prior, TestParameters(1, Column_Spans, 3, false, false));
+        Partition Updated = RunPartition(NRegions, Prior, TestParameters(1, Column_Spans, 3, false, true));
+        CHECK(Rebuilt.GetStats().incremental_updates == 0 && Updated.GetStats().incremental_updates>0);
+        const std::vector<Poly> Expected = Rebuilt.GetCovering(), Result = Updated.GetCovering();
+        for (int ii = 0; ii<NRegions; ii++){
+            CHECK(Expected[ii].GetNVertices() == Result[ii].GetNVertices());
+            for (int kk = 0; kk<Expected[ii].GetNVertices(); kk++){
+                CHECK(Point::Distance(Expected[ii].GetVertices()[kk], Result[ii].GetVertices()[kk])<=1e-12);
+            }
+            CHECK(Point::Distance(Rebuilt.GetCenters()[ii], Updated.GetCenters()[ii])<=1e-12);
+            CHECK(fabs(Rebuilt.GetWeights()[ii]-Updated.GetWeights()[ii])<=1e-12);
+        }
+    }
+    /**
+     * The interpolant is the bilinear function through the values at the corners of every grid square: for a bilinear density, the sampled line integral is the trapezoidal rule over the exact values, and interpolated values are exact.
+     */
+    void TestBilinearInterpolation(void){
+        const int G = 11;
+        Density Plane(UnitSquare(), G, G, UnitSquareValues(G, Bilinear));
+        const Point Starts[] = {Point(0.13,0.21), Point(0.95,0.07), Point(0.3,0.45)}, Ends[] = {Point(0.87,0.64), Point(0.04,0.93), Point(0.9,0.45)};
+        for (int kk = 0; kk<3; kk++){
+            //With a spacing of 0.25, the line is sampled at the parameters 0, 0.25, 0.5 and 0.75
+            double expected = 0;
+            for (int ll = 0; ll<3; ll++){
+                const Point a = Point::FindPointAlongLine(Starts[kk], Ends[kk], 0.25*ll), b = Point::FindPointAlongLine(Starts[kk], Ends[kk], 0.25*(ll+1));
+                expected += Bilinear(a.x, a.y)+Bilinear(b.x, b.y);
+            }
+            expected *= 0.25*Point::Distance(Starts[kk], Ends[kk])/2;
+            CHECK(fabs(Plane.LineIntegral(0.25, Starts[kk], Ends[kk])-expected)<=1e-12*expected);
+        }
+        //Points in general position, on grid lines and on the last row and column of grid points
+        std::vector<double> x = {0.13, 0.5, 0.77, 1, 0.31, 1, 0}, y = {0.21, 0.66, 0.3, 0.42, 1, 1, 0}, Result(x.size());
+        Plane.InterpolateValues((int) x.size(), x.data(), y.data(), Result.data());
+        for (int kk = 0; kk<x.size(); kk++){
+            CHECK(fabs(Result[kk]-Bilinear(x[kk], y[kk]))<=1e-12);
+        }
+        //A batch whose size is not a multiple of the vector width, including points outside of the grid, agrees with the points evaluated one at a time by the scalar loop
+        Density Prior(Pentagon(), 40, 40, GaussianValues(Pentagon(), 40));
+        std::mt19937 Generator(7);
+        std::uniform_real_distribution<double> Coordinate(-0.5, 2.7);
+        std::vector<double> Batch_x(103), Batch_y(103), Batch(103);
+        for (int kk = 0; kk<Batch.size(); kk++){
+            Batch_x[kk] = Coordinate(Generator);
+            Batch_y[kk] = Coordinate(Generator);
+        }
+        Prior.InterpolateValues((int) Batch.size(), Batch_x.data(), Batch_y.data(), Batch.data());
+        for (int kk = 0; kk<Batch.size(); kk++){
+            double value;
+            Prior.InterpolateValues(1, &Batch_x[kk], &Batch_y[kk], &value);
+            CHECK(fabs(Batch[kk]-value)<=1e-15*fabs(value));
+        }
+    }
+    /**
+     * The exact line integral agrees with the sampled rule at a small step, on chords of the region in general position and along a grid line.
+     */
+    void TestExactLineIntegral(void){
+        const int G = 60;
+        Density Prior(Pentagon(), G, G, GaussianValues(Pentagon(), G));
+        const std::vector<Point> Vertices = Prior.GetRegion().GetVertices();
+        std::vector<Point> Starts, Ends;
+        for (int kk = 0; kk<5; kk++){
+            Starts.push_back(Point::FindPointAlongLine(Vertices[kk], Vertices[(kk+1)%5], 0.3));
+            Ends.push_back(Point::FindPointAlongLine(Vertices[(kk+2)%5], Vertices[(kk+3)%5], 0.6));
+        }
+        //The grid spans [-0.3,2.5]x[0,2], so that x = -0.3+20*2.8/59 is a grid line
+        const double x = -0.3+20*2.8/(G-1);
+        Starts.push_back(Point(x, 0.2));
+        Ends.push_back(Point(x, 1.1));
+        for (int kk = 0; kk<Starts.size(); kk++){
+            double sampled = Prior.LineIntegral(1e-5, Starts[kk], Ends[kk]), exact = Prior.ExactLineIntegral(Starts[kk], Ends[kk]);
+            CHECK(fabs(sampled-exact)<=1e-8*fabs(exact));
+        }
+    }
+    /**
+     * Scanline agrees with pnpoly on random lines of points and on lines through the vertices and along the edges, for convex and non-convex polygons, with and without a robustness constant.
+     */
+    void TestScanline(void){
+        const Poly Notch({Point(0,0), Point(2,0), Point(2,2), Point(1,0.8), Point(0,2)});
+        const double Previous = Point::Robustness_Constant;
+        std::mt19937 Generator(5);
+        auto Uniform = [&Generator](const double low, const double high){return low+(high-low)*(Generator()/4294967296.0);};
+        CHECK(Pentagon().IsConvex() && !Notch.IsConvex());
+        for (double robustness : {0.0, 10e-8}){
+            Point::Robustness_Constant = robustness;
+            for (const Poly &Region : {Pentagon(), Notch}){
+                const std::vector<Point> Vertices = Region.GetVertices();
+                const int NVertices = (int) Vertices.size();
+                std::vector<Point> Starts, Steps;
+                std::vector<int> Counts;
+                for (int kk = 0; kk<200; kk++){
+                    const double angle = Uniform(0, 2*M_PI), step = Uniform(0.005, 0.05);
+                    Point Start;
+                    Start.x = Uniform(-0.5, 3);
+                    Start.y = Uniform(-0.5, 2.5);
+                    Starts.push_back(Start);
+                    Steps.push_back(Point(step*cos(angle), step*sin(angle)));
+                    Counts.push_back(200);
+                }
+                for (int kk = 0; kk<NVertices; kk++){
+                    const Point &Vertex = Vertices[kk], &Next = Vertices[(kk+1)%NVertices];
+                    //Points along the edge, including both of its vertices. Without a robustness constant, rounding decides whether they lie inside.
+                    if (robustness>0){
+                        Starts.push_back(Vertex);
+                        Steps.push_back(Point((Next.x-Vertex.x)/16, (Next.y-Vertex.y)/16));
+                        Counts.push_back(17);
+                    }
+                    //Horizontal and vertical lines through the vertex
+                    Starts.push_back(Point(Vertex.x-0.8, Vertex.y));
+                    Steps.push_back(Point(0.05, 0));
+                    Counts.push_back(33);
+                    Starts.push_back(Point(Vertex.x, Vertex.y-0.8));
+                    Steps.push_back(Point(0, 0.05));
+                    Counts.push_back(33);
+                }
+                for (int ll = 0; ll<Starts.size(); ll++){
+                    std::vector<int> Spans;
+                    Region.Scanline(Starts[ll], Steps[ll], Counts[ll], Spans);
+                    CHECK(Spans.size()%2 == 0);
+                    std::vector<bool> Inside(Counts[ll], false);
+                    for (int kk = 0; kk<Spans.size(); kk += 2){
+                        CHECK(Spans[kk]<=Spans[kk+1] && (kk == 0 || Spans[kk]>Spans[kk-1]+1));
+                        for (int point = Spans[kk]; point<=Spans[kk+1]; point++){
+                            Inside[point] = true;
+                        }
+                    }
+                    for (int kk = 0; kk<Counts[ll]; kk++){
+                        CHECK(Inside[kk] == Region.pnpoly(Point(Starts[ll].x+kk*Steps[ll].x, Starts[ll].y+kk*Steps[ll].y)));
+                    }
+                }
+                //With a robustness constant, the boundary counts as inside
+                if (robustness>0){
+                    for (int kk = 0; kk<NVertices; kk++){
+                        std::vector<int> Spans;
+                        Region.Scanline(Vertices[kk], Point((Vertices[(kk+1)%NVertices].x-Vertices[kk].x)/16, (Vertices[(kk+1)%NVertices].y-Vertices[kk].y)/16), 17, Spans);
+                        CHECK(Spans == std::vector<int>({0, 16}));
+                    }
+                }
+            }
+        }
+        Point::Robustness_Constant = Previous;
+    }
+    /**
+     * Records every snapshot that it is offered.
+     */
+    class RecordingSink : public IterationSink
+    {
+    public:
+        /**
+         * A recorded snapshot.
+         */
+        struct Snapshot{int iteration; bool final; std::vector<Point> Centers; std::vector<double> Weights; std::vector<Poly> Covering;};
+        std::vector<Snapshot> Snapshots;/**<The snapshots in the order of recording*/
+    protected:
+        void Write(const int iteration, const bool final, const std::vector<Point> &Centers, const std::vector<double> &Weights, const std::vector<Poly> &Covering){
+            Snapshots.push_back({iteration, final, Centers, Weights, Covering});
+        }
+    };
+    /**
+     * @return The contents of a file
+     */
+    std::string ReadFile(const std::string filename){
+        std::ifstream In(filename, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(In)), std::istreambuf_iterator<char>());
+    }
+    /**
+     * Reads a value of type T from the binary trajectory Contents at position, advancing position.
+     */
+    template<typename T> T ReadValue(const std::string &Contents, size_t &position){
+        T value;
+        CHECK(position+sizeof(T)<=Contents.size());
+        memcpy(&value, Contents.data()+position, sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+    /**
+     * The binary trajectory holds every interval-th snapshot and the final one in the documented layout, and the CSV files are byte-identical to the files written by the original CalculatePartition.
+     */
+    void TestIterationSinks(void){
+        const int NRegions = 6, interval = 3;
+        const std::string filename = "areacon_tests_trajectory.bin", filename_partition = "areacon_tests_partition.txt", filename_centers = "areacon_tests_centers.txt";
+        Density Prior(Pentagon(), 40, 40, GaussianValues(Pentagon(), 40));
+        const Parameters Alg_Params(0.1, 0.1, 1, 0.002, 0.02, 200, 3, 10e-6, 10e-8, Nearest_Neighbors);
+        RecordingSink Recording;
+        Partition Recorded(NRegions, Prior, {}, Alg_Params), Binary(NRegions, Prior, {}, Alg_Params), Text(NRegions, Prior, {}, Alg_Params);
+        Recorded.InitializePartition();
+        Recorded.CalculatePartition(Recording);
+        const std::vector<RecordingSink::Snapshot> &Snapshots = Recording.Snapshots;
+        CHECK(Snapshots.size()>2*interval && Snapshots.back().final);
+        {
+            BinaryIterationSink Sink(filename, interval);
+            Binary.InitializePartition();
+            Binary.CalculatePartition(Sink);
+        }
+        const std::string Contents = ReadFile(filename);
+        size_t position = 8;
+        CHECK(Contents.compare(0, 8, "ACTRAJ01") == 0 && ReadValue<std::int32_t>(Contents, position) == NRegions);
+        for (const RecordingSink::Snapshot &Expected : Snapshots){
+            if (Expected.iteration%interval != 0 && !Expected.final){
+                continue;
+            }
+            CHECK(ReadValue<std::int32_t>(Contents, position) == Expected.iteration && ReadValue<std::int32_t>(Contents, position) == Expected.final);
+            const int NVertices = ReadValue<std::int32_t>(Contents, position);
+            int total = 0;
+            for (int ii = 0; ii<NRegions; ii++){
+                CHECK(ReadValue<double>(Contents, position) == Expected.Centers[ii].x && ReadValue<double>(Contents, position) == Expected.Centers[ii].y);
+                CHECK(ReadValue<double>(Contents, position) == Expected.Weights[ii]);
+            }
+            for (int ii = 0; ii<NRegions; ii++){
+                CHECK(ReadValue<std::int32_t>(Contents, position) == Expected.Covering[ii].GetNVertices());
+                total += Expected.Covering[ii].GetNVertices();
+            }
+            CHECK(NVertices == total);
+            for (int ii = 0; ii<NRegions; ii++){
+                for (const Point &Vertex : Expected.Covering[ii].GetVertices()){
+                    CHECK(ReadValue<double>(Contents, position) == Vertex.x && ReadValue<double>(Contents, position) == Vertex.y);
+                }
+            }
+        }
+        CHECK(position == Contents.size());
+        //The original CalculatePartition wrote every snapshot with these statements
+        std::ostringstream Centers_Text, Partition_Text;
+        for (const RecordingSink::Snapshot &Expected : Snapshots){
+            for (int ii = 0; ii<NRegions; ii++){
+                Centers_Text<<Expected.Centers[ii].x<<","<<Expected.Centers[ii].y<<std::endl;
+                const std::vector<Point> Vert = Expected.Covering[ii].GetVertices();
+                for (int jj = 0; jj<Expected.Covering[ii].GetNVertices(); jj++){
+                    Partition_Text<<Vert[jj].x<<","<<Vert[jj].y<<" ";
+                }
+                Partition_Text<<std::endl;
+            }
+            Centers_Text<<std::endl;
+            Partition_Text<<std::endl;
+        }
+        Text.InitializePartition();
+        Text.CalculatePartition(true, filename_partition, filename_centers);
+        CHECK(ReadFile(filename_centers) == Centers_Text.str() && ReadFile(filename_partition) == Partition_Text.str());
+        std::remove(filename.c_str());
+        std::remove(filename_partition.c_str());
+        std::remove(filename_centers.c_str());
+    }
+    /**
+     * The warnings of a partition are printed to std::cout only if verbosity is at least 1, like its progress information.
+     */
+    void TestVerbosity(void){
+        Density Prior(UnitSquare(), 20, 20, std::vector<double>(400, 1));
+        for (const int verbosity : {0, 1}){
+            const Parameters Alg_Params(0.1, 0.1, 1, 0.002, 0.02, 200, 1, 10e-6, 10e-8, All_Pairs, 1, Per_Region, false, false, false, verbosity);
+            std::ostringstream Output;
+            std::streambuf *Stdout = std::cout.rdbuf(Output.rdbuf());
+            try{
+                //The desired areas are not normalized and the centers coincide, so that CheckParams and PerturbCenter both warn
+                Partition Result(2, Prior, {1, 1}, Alg_Params);
+                Result.InitializePartition({Point(0.5, 0.5), Point(0.5, 0.5)}, {0, 0});
+                Result.CalculatePartition(false);
+            }catch (...){
+                std::cout.rdbuf(Stdout);
+                throw;
+            }
+            std::cout.rdbuf(Stdout);
+            const std::string Text = Output.str();
+            CHECK(verbosity == 0 ? Text.empty() : Text.find("not normalized") != std::string::npos && Text.find("numerically unstable") != std::string::npos);
+        }
+    }
+    /**
+     * Checks that two densities on the same grid have the same values, the same integral tables to round-off and the same weighted areas in both integration modes.
+     */
+    void CheckSameDensity(Density &Result, Density &Expected){
+        const Int_Params &R = Result.GetIntegral(), &E = Expected.GetIntegral();
+        CHECK(Result.GetValues() == Expected.GetValues());
+        CHECK(R.Coefficient_a == E.Coefficient_a && R.Coefficient_b == E.Coefficient_b && R.Coefficient_c == E.Coefficient_c && R.Coefficient_d == E.Coefficient_d);
+        CHECK(RelativeDifference(R.Int, E.Int)<=1e-12 && RelativeDifference(R.Intx, E.Intx)<=1e-12 && RelativeDifference(R.Inty, E.Inty)<=1e-12);
+        CHECK(RelativeDifference(R.Int_Prefix, E.Int_Prefix)<=1e-12 && RelativeDifference(R.Intx_Prefix, E.Intx_Prefix)<=1e-12 && RelativeDifference(R.Inty_Prefix, E.Inty_Prefix)<=1e-12);
+        const Poly Triangle = TestRegions()[0];
+        for (bool exact : {false, true}){
+            Result.SetExactIntegration(exact);
+            Expected.SetExactIntegration(exact);
+            CHECK(fabs(Result.CalculateWeightedArea(Triangle)-Expected.CalculateWeightedArea(Triangle))<=1e-12);
+        }
+    }
+    /**
+     * Updating the values of a density on a rectangle, or on the full grid, gives the same density as constructing it from the new values. The tables are bitwise the same, also in compact storage mode and after many updates, so that round-off does not accumulate.
+     */
+    void TestUpdateValues(void){
+        const int G = 50, i0 = 10, j0 = 5, i1 = 20, j1 = 30;
+        const std::vector<double> Values = GaussianValues(Pentagon(), G);
+        std::vector<double> New_Values = Values, Block;
+        for (int ii = i0; ii<=i1; ii++){
+            for (int jj = j0; jj<=j1; jj++){
+                Block.push_back(3+cos(ii+jj));
+                New_Values[G*ii+jj] = Block.back();
+            }
+        }
+        auto SameTables = [](Density &Result, Density &Expected){
+            const Int_Params &R = Result.GetIntegral(), &E = Expected.GetIntegral();
+            bool same = R.Int == E.Int && R.Intx == E.Intx && R.Inty == E.Inty && R.Compact == E.Compact;
+            same = same && R.Int_Prefix == E.Int_Prefix && R.Intx_Prefix == E.Intx_Prefix && R.Inty_Prefix == E.Inty_Prefix;
+            for (bool exact : {false, true}){
+                Result.SetExactIntegration(exact);
+                Expected.SetExactIntegration(exact);
+                same = same && Result.GetVolumeScale() == Expected.GetVolumeScale();
+            }
+            return same;
+        };
+        Density Expected(Pentagon(), G, G, New_Values), Rectangle(Pentagon(), G, G, Values), Grid(Pentagon(), G, G, Values);
+        Rectangle.UpdateValues(i0, j0, i1, j1, Block);
+        CheckSameDensity(Rectangle, Expected);
+        CHECK(SameTables(Rectangle, Expected));
+        Grid.UpdateValues(New_Values);
+        CheckSameDensity(Grid, Expected);
+        Density Compact_Expected(Pentagon(), G, G, New_Values, 1, true), Compact(Pentagon(), G, G, Values, 1, true);
+        Compact.UpdateValues(i0, j0, i1, j1, Block);
+        CHECK(SameTables(Compact, Compact_Expected));
+        std::vector<double> Old_Block;
+        for (int ii = i0; ii<=i1; ii++){
+            Old_Block.insert(Old_Block.end(), Values.begin()+G*ii+j0, Values.begin()+G*ii+j1+1);
+        }
+        Density Repeated(Pentagon(), G, G, Values), Original(Pentagon(), G, G, Values);
+        for (int kk = 0; kk<20; kk++){
+            Repeated.UpdateValues(i0, j0, i1, j1, Block);
+            Repeated.UpdateValues(i0, j0, i1, j1, Old_Block);
+        }
+        CHECK(SameTables(Repeated, Original));
+    }
+    /**
+     * Solving on a density pyramid visits every level from the coarsest to the full resolution, and the last weight update on the full-resolution grid meets the volume tolerance.
+     */
+    void TestDensityPyramid(void){
+        const int NRegions = 10, G = 101, levels = 3;
+        Density Prior(UnitSquare(), G, G, GaussianValues(UnitSquare(), G));
+        const Parameters Alg_Params = TestParameters(1, Column_Spans, 10, true, false, Newton, levels);
+        Partition Result(NRegions, Prior, {}, Alg_Params);
+        std::vector<int> Levels;
+        double volume_error = INFINITY;
+        Result.SetProgressCallback([&Levels, &volume_error](const ProgressInfo &Info){
+            if (Levels.empty() || Levels.back() != Info.level){
+                Levels.push_back(Info.level);
+            }
+            if (Info.level == 0 && !Info.center_step){
+                volume_error = Info.volume_error;
+            }
+        });
+        Result.InitializePartition();
+        Result.CalculatePartition(false);
+        CHECK(Levels == std::vector<int>({2, 1, 0}));
+        CHECK(volume_error<=Alg_Params.volume_tolerance);
+    }
+    /**
+     * Downsample averages the values instead of sampling them: on a checkerboard the coarse values of odd grids are the mean away from the boundary, and those of even grids are close to it, while a linear density is kept exactly away from the boundary of odd grids.
+     */
+    void TestDownsample(void){
+        auto Checkerboard = [](const int G){
+            std::vector<double> Values((size_t) G*G);
+            for (int ii = 0; ii<G; ii++){
+                for (int jj = 0; jj<G; jj++){
+                    Values[(size_t) G*ii+jj] = ((ii+jj)%2 == 0) ? 3 : 1;
+                }
+            }
+            return Values;
+        };
+        for (int G : {41, 40}){
+            Density Fine(UnitSquare(), G, G, Checkerboard(G));
+            Density Coarse = Fine.Downsample();
+            const int g = (G+1)/2;
+            CHECK(Coarse.GetNx() == g && Coarse.GetNy() == g);
+            const std::vector<double> &Values = Coarse.GetValues();
+            double deviation = 0;
+            for (int ii = 1; ii<g-1; ii++){
+                for (int jj = 1; jj<g-1; jj++){
+                    deviation = std::max(deviation, fabs(Values[(size_t) g*ii+jj]-2));
+                }
+            }
+            CHECK(deviation<=((G%2 == 1) ? 1e-12 : 0.25));
+        }
+        const int G = 41, g = 21;
+        auto Linear = [](double x, double y){return 1+x+2*y;};
+        Density Coarse = Density(UnitSquare(), G, G, UnitSquareValues(G, Linear)).Downsample();
+        const std::vector<double> Values = Coarse.GetValues(), Expected = UnitSquareValues(g, Linear);
+        for (int ii = 1; ii<g-1; ii++){
+            for (int jj = 1; jj<g-1; jj++){
+                CHECK(fabs(Values[(size_t) g*ii+jj]-Expected[(size_t) g*ii+jj])<=1e-12);
+            }
+        }
+    }
+    /**
+     * @return A density with a single Gaussian bump of the given width on the grid of the unit square, used as the destination of file reads
+     */
+    Density UnitSquareDensity(const int G, const double width){
+        return Density(UnitSquare(), G, G, UnitSquareValues(G, [width](double x, double y){return 1+exp(-((x-0.5)*(x-0.5)+(y-0.5)*(y-0.5))/width);}));
+    }
+    /**
+     * Writing a density to a binary file and reading it back restores the values bitwise, with or without the pre-computed integrals; values stored as float32 give the density of the rounded values, also with the pre-computed integrals. Reading a truncated file throws and leaves the density unchanged.
+     */
+    void TestBinaryRoundTrip(void){
+        const int G = 40;
+        const std::string filename = "areacon_tests_density.bin", truncated = "areacon_tests_truncated.bin";
+        Density Original(Pentagon(), G, G, GaussianValues(Pentagon(), G));
+        const Int_Params &E = Original.GetIntegral();
+
+        Original.WriteBinaryFile(filename);
+        Density Copy = UnitSquareDensity(20, 0.1);
+        Copy.ReadBinaryFile(filename);
+        const Int_Params &R = Copy.GetIntegral();
+        CHECK(Copy.GetNx() == G && Copy.GetNy() == G && Copy.GetRegion().GetNVertices() == Pentagon().GetNVertices());
+        CHECK(Copy.GetValues() == Original.GetValues() && Copy.GetRegionBits() == Original.GetRegionBits());
+        CHECK(R.Int == E.Int && R.Int_Prefix == E.Int_Prefix && R.Intx_Prefix == E.Intx_Prefix && R.Inty_Prefix == E.Inty_Prefix);
+        CheckSameDensity(Copy, Original);
+
+        Original.WriteBinaryFile(filename, false, false);
+        Density Recomputed = UnitSquareDensity(20, 0.1);
+        Recomputed.ReadBinaryFile(filename);
+        CHECK(Recomputed.GetRegionBits() == Original.GetRegionBits());
+        CheckSameDensity(Recomputed, Original);
+
+        std::vector<double> Rounded = Original.GetValues();
+        for (double &value : Rounded){
+            value = (float) value;
+        }
+        Density Expected(Pentagon(), G, G, Rounded);
+        Original.WriteBinaryFile(filename, true, false);
+        Density Single = UnitSquareDensity(20, 0.1);
+        Single.ReadBinaryFile(filename);
+        CheckSameDensity(Single, Expected);
+        Original.WriteBinaryFile(filename, true, true);
+        Density Single_Integrals = UnitSquareDensity(20, 0.1);
+        Single_Integrals.ReadBinaryFile(filename);
+        const Int_Params &S = Single_Integrals.GetIntegral(), &X = Expected.GetIntegral();
+        CHECK(S.Int == X.Int && S.Int_Prefix == X.Int_Prefix && S.Intx_Prefix == X.Intx_Prefix && S.Inty_Prefix == X.Inty_Prefix);
+        CheckSameDensity(Single_Integrals, Expected);
+
+        Original.WriteBinaryFile(filename);
+        {
+            std::ifstream In(filename, std::ios::binary);
+            std::string Contents((std::istreambuf_iterator<char>(In)), std::istreambuf_iterator<char>());
+            std::ofstream Out(truncated, std::ios::binary);
+            Out.write(Contents.data(), Contents.size()/2);
+        }
+        Density Unchanged = UnitSquareDensity(20, 0.1), Reference = UnitSquareDensity(20, 0.1);
+        bool thrown = false;
+        try {
+            Unchanged.ReadBinaryFile(truncated);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        std::remove(truncated.c_str());
+        CHECK(thrown);
+        CHECK(Unchanged.GetRegionBits() == Reference.GetRegionBits());
+        CheckSameDensity(Unchanged, Reference);
+        std::remove(filename.c_str());
+    }
+    /**
+     * Compact storage of the integrals agrees with the default storage to about float32 precision, with and without exact integration, and switching back restores the default storage exactly.
+     */
+    void TestCompactStorage(void){
+        const int G = 60;
+        Density Default(Pentagon(), G, G, GaussianValues(Pentagon(), G)), Compact(Pentagon(), G, G, GaussianValues(Pentagon(), G), 1, true);
+        CHECK(Compact.GetCompactStorage() && !Compact.GetIntegral().Compact.empty() && Compact.GetIntegral().Int_Prefix.empty());
+        const std::vector<Poly> Regions = TestRegions();
+        for (bool exact : {false, true}){
+            Default.SetExactIntegration(exact);
+            Compact.SetExactIntegration(exact);
+            std::vector<double> Volumes, Compact_Volumes;
+            std::vector<Point> Centroids, Compact_Centroids;
+            Default.CalculateSpanIntegrals(Regions, Volumes, Centroids);
+            Compact.CalculateSpanIntegrals(Regions, Compact_Volumes, Compact_Centroids);
+            CHECK(RelativeDifference(Compact_Volumes, Volumes)<=1e-6);
+            for (int kk = 0; kk<Regions.size(); kk++){
+                double volume, compact_volume;
+                Point centroid, compact_centroid;
+                Default.CalculateVolumeAndCentroid(Regions[kk], volume, centroid);
+                Compact.CalculateVolumeAndCentroid(Regions[kk], compact_volume, compact_centroid);
+                CHECK(fabs(compact_volume-volume)<=1e-6*volume && Point::Distance(compact_centroid, centroid)<=1e-6);
+                CHECK(fabs(Compact.CalculateWeightedArea(Regions[kk])-Default.CalculateWeightedArea(Regions[kk]))<=1e-6*volume);
+                CHECK(Point::Distance(Compact_Centroids[kk], Centroids[kk])<=1e-6);
+            }
+        }
+        Compact.SetCompactStorage(false);
+        CheckSameDensity(Compact, Default);
+    }
+    /**
+     * A tiled density agrees with the in-memory density of the same file up to round-off, also when the cache holds far fewer tiles than the grid and tiles are evicted between queries. Concurrent queries compute every tile once, and a partition integrated through the shared tiled density agrees with the partition of the in-memory density.
+     */
+    void TestTiledDensity(void){
+        const int G = 100, max_tiles = 4;
+        const std::string filename = "areacon_tests_tiled.bin";
+        Density Prior(Pentagon(), G, G, GaussianValues(Pentagon(), G));
+        Prior.WriteBinaryFile(filename);
+        TiledDensity Tiled(filename, 16, max_tiles);
+        TiledDensity Serial(filename, 16, 64);
+        std::shared_ptr<TiledDensity> Concurrent = std::make_shared<TiledDensity>(filename, 16, 64);
+        std::remove(filename.c_str());
+        CHECK(Tiled.GetNx() == G && Tiled.GetNy() == G);
+        for (const Poly &Region : TestRegions()){
+            double volume, tiled_volume;
+            Point centroid, tiled_centroid;
+            Prior.CalculateVolumeAndCentroid(Region, volume, centroid);
+            Tiled.CalculateVolumeAndCentroid(Region, tiled_volume, tiled_centroid);
+            CHECK(fabs(tiled_volume-volume)<=1e-12*volume && Point::Distance(tiled_centroid, centroid)<=1e-12);
+            CHECK(fabs(Tiled.CalculateWeightedArea(Region)-Prior.CalculateWeightedArea(Region))<=1e-12*volume);
+            CHECK(Point::Distance(Tiled.CalculateCentroid(Region, volume), Prior.CalculateCentroid(Region, volume))<=1e-12);
+        }
+        const std::vector<Point> Vertices = Prior.GetRegion().GetVertices();
+        for (int kk = 0; kk<5; kk++){
+            const Point p1 = Point::FindPointAlongLine(Vertices[kk], Vertices[(kk+1)%5], 0.3), p2 = Point::FindPointAlongLine(Vertices[(kk+2)%5], Vertices[(kk+3)%5], 0.6);
+            const double line_integral = Prior.LineIntegral(0.01, p1, p2);
+            CHECK(fabs(Tiled.LineIntegral(0.01, p1, p2)-line_integral)<=1e-12*fabs(line_integral));
+            double x = p1.x, y = p1.y, value;
+            Prior.InterpolateValues(1, &x, &y, &value);
+            CHECK(fabs(Tiled.InterpolateValue(p1)-value)<=1e-12*fabs(value));
+        }
+        CHECK(Tiled.GetNCachedTiles()<=max_tiles && Tiled.GetTileLoads()>(long) (G/16+1)*(G/16+1));
+
+        const long initial_loads = Serial.GetTileLoads();
+        const double serial_volume = Serial.CalculateWeightedArea(Pentagon());
+        std::vector<double> Volumes(8);
+        std::vector<std::thread> Threads;
+        for (int tt = 0; tt<8; tt++){
+            Threads.push_back(std::thread([&, tt]{Volumes[tt] = Concurrent->CalculateWeightedArea(Pentagon());}));
+        }
+        for (std::thread &Thread : Threads){
+            Thread.join();
+        }
+        CHECK(Volumes == std::vector<double>(8, serial_volume));
+        CHECK(Concurrent->GetTileLoads() == Serial.GetTileLoads() && Serial.GetTileLoads()>initial_loads);
+
+        const int NRegions = 6;
+        for (WeightUpdateMethod weights_method : {Gradient_Descent, Newton}){
+            const Parameters Alg_Params = TestParameters(2, Per_Region, 3, false, false, weights_method);
+            Partition Shared(NRegions, Concurrent, {}, Alg_Params), Expected(NRegions, Prior, {}, Alg_Params);
+            Shared.InitializePartition();
+            Shared.CalculatePartition(false);
+            Expected.InitializePartition();
+            Expected.CalculatePartition(false);
+            for (int ii = 0; ii<NRegions; ii++){
+                CHECK(fabs(Shared.GetWeights()[ii]-Expected.GetWeights()[ii])<=1e-8 && Point::Distance(Shared.GetCenters()[ii], Expected.GetCenters()[ii])<=1e-8);
+            }
+        }
+        bool rejected = false;
+        try {
+            Partition Spans(NRegions, Concurrent, {}, TestParameters(1, Column_Spans));
+        } catch (const std::runtime_error &e) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+    /**
+     * The batch solver gives every job the result of a serial Partition, also when jobs with different robustness constants run concurrently, and failing jobs, including jobs with num_threads != 1, leave the others intact.
+     */
+    void TestBatchSolver(void){
+        const int NRegions = 8, failing = 4, threaded = 7;
+        const double Constants[] = {10e-8, 10e-6, 10e-4};
+        Density Prior(Pentagon(), 40, 40, GaussianValues(Pentagon(), 40));
+        std::vector<BatchJob> Jobs;
+        for (int kk = 0; kk<9; kk++){
+            Jobs.push_back(BatchJob(NRegions+kk, Prior, {}, Parameters(0.1, 0.1, 1, 0.002, 0.02, 200, 5, 10e-6, Constants[kk%3], (kk%2) ? Nearest_Neighbors : All_Pairs, (kk == threaded) ? 2 : 1)));
+        }
+        //Centers outside the region of interest make InitializePartition throw
+        Jobs[failing].Centers = std::vector<Point>(Jobs[failing].NRegions, Point(10, 10));
+        BatchSolver Solver(4);
+        const std::vector<BatchResult> Results = Solver.Solve(Jobs);
+        CHECK(Results.size() == Jobs.size());
+        for (int kk = 0; kk<Jobs.size(); kk++){
+            if (kk == failing || kk == threaded){
+                CHECK(Results[kk].Error);
+                std::string message;
+                try {
+                    std::rethrow_exception(Results[kk].Error);
+                } catch (const std::runtime_error &e) {
+                    message = e.what();
+                }
+                CHECK(!message.empty() && (kk == failing) == (message.find("num_threads") == std::string::npos));
+                continue;
+            }
+            CHECK(!Results[kk].Error);
+            Partition Serial(Jobs[kk].NRegions, Jobs[kk].Prior, Jobs[kk].desired_area, Jobs[kk].Alg_Params);
+            Serial.InitializePartition();
+            Serial.CalculatePartition(false);
+            CHECK(Results[kk].Weights == Serial.GetWeights() && Results[kk].Covering.size() == Jobs[kk].NRegions);
+            for (int ii = 0; ii<Jobs[kk].NRegions; ii++){
+                CHECK(Results[kk].Centers[ii].x == Serial.GetCenters()[ii].x && Results[kk].Centers[ii].y == Serial.GetCenters()[ii].y);
+            }
+        }
+    }
+    /**
+     * The data-parallel kernels of Device_Spans sum the same column spans in the same order as Column_Spans, so that integrals, centers and weights are bitwise identical, also on several host threads, on copies of a density whose values changed and when the device tables are first used by several threads at once.
+     */
+    void TestDeviceSpans(void){
+        const int G = 60, NRegions = 12;
+        Density Prior(Pentagon(), G, G, GaussianValues(Pentagon(), G));
+        const std::vector<Poly> Regions = TestRegions();
+        auto Integrate = [&Regions](const Density &D, const bool device){
+            std::vector<double> Volumes;
+            std::vector<Point> Centroids;
+            if (device){
+                D.CalculateDeviceIntegrals(Regions, Volumes, Centroids);
+            }else{
+                D.CalculateSpanIntegrals(Regions, Volumes, Centroids);
+            }
+            for (int kk = 0; kk<Regions.size(); kk++){
+                Volumes.push_back(Centroids[kk].x);
+                Volumes.push_back(Centroids[kk].y);
+            }
+            return Volumes;
+        };
+        const std::vector<double> Expected = Integrate(Prior, false);
+        CHECK(Integrate(Prior, true) == Expected);
+        Density Threaded = Prior;
+        Threaded.SetNumThreads(4);
+        CHECK(Integrate(Threaded, true) == Expected);
+        //The copy is made after the device tables of Prior were created, and must not use them once its own values change
+        Density Updated = Prior;
+        const std::vector<double> Values = Prior.GetValues();
+        Updated.UpdateValues(std::vector<double>(Values.rbegin(), Values.rend()));
+        CHECK(Integrate(Updated, true) == Integrate(Updated, false));
+        CHECK(Integrate(Prior, true) == Expected);
+        const Density Shared = Prior;
+        std::vector<std::vector<double>> Results(4);
+        std::vector<std::thread> Threads;
+        for (int tt = 0; tt<Results.size(); tt++){
+            Threads.push_back(std::thread([&, tt]{Results[tt] = Integrate(Shared, true);}));
+        }
+        for (std::thread &Thread : Threads){
+            Thread.join();
+        }
+        for (const std::vector<double> &Result : Results){
+            CHECK(Result == Expected);
+        }
+        for (WeightUpdateMethod weights_method : {Gradient_Descent, Newton}){
+            Partition Spans = RunPartition(NRegions, Prior, TestParameters(1, Column_Spans, 10, false, false, weights_method));
+            Partition Device = RunPartition(NRegions, Prior, TestParameters(1, Device_Spans, 10, false, false, weights_method));
+            CHECK(Device.GetWeights() == Spans.GetWeights());
+            for (int ii = 0; ii<NRegions; ii++){
+                CHECK(Device.GetCenters()[ii].x == Spans.GetCenters()[ii].x && Device.GetCenters()[ii].y == Spans.GetCenters()[ii].y);
+            }
+        }
+    }
+    /**
+     * The reductions of CalculatePartition are carried out in a fixed order, so that centers and weights are bitwise identical for any number of threads.
+     */
+    void TestThreadReproducibility(void){
+        const int NRegions = 12;
+        Density Prior(Pentagon(), 60, 60, GaussianValues(Pentagon(), 60));
+        for (IntegrationMethod method : {Per_Region, Column_Spans}){
+            for (WeightUpdateMethod weights_method : {Gradient_Descent, Newton}){
+                Partition Serial = RunPartition(NRegions, Prior, TestParameters(1, method, 10, false, false, weights_method));
+                for (int num_threads : {2, 4}){
+                    Partition Parallel = RunPartition(NRegions, Prior, TestParameters(num_threads, method, 10, false, false, weights_method));
+                    CHECK(Parallel.GetWeights() == Serial.GetWeights());
+                    for (int ii = 0; ii<NRegions; ii++){
+                        CHECK(Parallel.GetCenters()[ii].x == Serial.GetCenters()[ii].x && Parallel.GetCenters()[ii].y == Serial.GetCenters()[ii].y);
+                    }
+                }
+            }
+        }
+    }
+    /**
+     * The Newton weight update solves for normalized volumes, so that the number of steps does not depend on the total mass of the density.
+     */
+    void TestNewtonScaleInvariance(void){
+        const Poly Square = UnitSquare();
+        const int NRegions = 10, G = 100;
+        PartitionStats Reference;
+        for (double scale : {1.0, 100.0, 0.01}){
+            Density Prior(Square, G, G, GaussianValues(Square, G, scale));
+            PartitionStats Stats = RunPartition(NRegions, Prior, TestParameters(1, Column_Spans, 1, true, false, Newton)).GetStats();
+            if (scale == 1){
+                Reference = Stats;
+            }
+            CHECK(Stats.weight_steps == Reference.weight_steps);
+            CHECK(Stats.diagram_calls == Reference.diagram_calls);
+        }
+        CHECK(Reference.weight_steps<=2);
+    }
+    struct Test{const char *name; void (*run)(void);};
+    const Test Tests[] = {
+        {"nearest_neighbors", TestNearestNeighbors},
+        {"covering_integrals", TestCoveringIntegrals},
+        {"bilinear_coefficients", TestBilinearCoefficients},
+        {"exact_integration", TestExactIntegration},
+        {"column_spans", TestColumnSpans},
+        {"incremental_diagram", TestIncrementalDiagram},
+        {"bilinear_interpolation", TestBilinearInterpolation},
+        {"exact_line_integral", TestExactLineIntegral},
+        {"scanline", TestScanline},
+        {"iteration_sinks", TestIterationSinks},
+        {"verbosity", TestVerbosity},
+        {"update_values", TestUpdateValues},
+        {"density_pyramid", TestDensityPyramid},
+        {"downsample", TestDownsample},
+        {"binary_round_trip", TestBinaryRoundTrip},
+        {"compact_storage", TestCompactStorage},
+        {"tiled_density", TestTiledDensity},
+        {"batch_solver", TestBatchSolver},
+        {"device_spans", TestDeviceSpans},
+        {"thread_reproducibility", TestThreadReproducibility},
+        {"newton_scale_invariance", TestNewtonScaleInvariance},
+    };
+}
+
+int main(int argc, char **argv){
+    int failures = 0, count = 0;
+    for (const Test &test : Tests){
+        if (argc>1 && std::string(argv[1]) != test.name){
+            continue;
+        }
+        count++;
+        try{
+            test.run();
+            std::cout<<test.name<<": passed"<<std::endl;
+        }catch (const std::exception &e){
+            std::cout<<test.name<<": FAILED ("<<e.what()<<")"<<std::endl;
+            failures++;
+        }
+    }
+    if (count == 0){
+        std::cerr<<"Unknown test: "<<argv[1]<<'\n';
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}